@@ -0,0 +1,123 @@
+// -----------------------------------------------------------------
+// libdnsquery - a library to interrogate DNSs and more.
+// Copyright (C) 2018-2023  Gabriele Bonacini
+//
+// This program is free software for no profit use; you can redistribute 
+// it and/or modify it under the terms of the GNU General Public License 
+// as published by the Free Software Foundation; either version 2 of 
+// the License, or (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// A commercial license is also available for a lucrative use.
+// -----------------------------------------------------------------
+
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+#include <anyexcept.hpp>
+#include <epoch.hpp>
+
+// Bounded multi producer, multi consumer queue (D. Vyukov): every cell carries a sequence
+// number telling whether it is free for the producer or ready for the consumer of a given
+// lap, so that a push or a pop is a single compare and swap on its own index.
+
+namespace ringutils {
+
+    template<typename T>
+    class BoundedRing{
+        static_assert(std::is_nothrow_move_assignable_v<T>, "BoundedRing: moves must not throw.");
+
+        public:
+           explicit           BoundedRing(size_t entries)                                       anyexcept
+                                  :  cells{nullptr}, mask{0}, head{0}, tail{0}
+                              {
+                                  size_t  size  { 2 };
+                                  while(size < entries)
+                                      size  <<=  1;
+                                  try{
+                                      cells  =  std::make_unique<Cell[]>(size);
+                                  }catch(...){
+                                      throw std::string("BoundedRing: can't allocate the cells.");
+                                  }
+                                  for(size_t idx { 0 }; idx < size; ++idx)
+                                      cells[idx].seq.store(idx, std::memory_order_relaxed);
+                                  mask  =  size - 1;
+                              }
+
+           bool               push(T&& value)                                                   noexcept{
+                                  size_t  pos   { head.load(std::memory_order_relaxed) };
+                                  Cell*   cell  { nullptr };
+                                  for(;;){
+                                      cell  =  &cells[pos & mask];
+                                      const auto  lap  { static_cast<intptr_t>(cell->seq.load(std::memory_order_acquire)) -
+                                                         static_cast<intptr_t>(pos) };
+                                      if(lap == 0){
+                                          if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                                              break;
+                                      }else if(lap < 0){
+                                          return false;
+                                      }else{
+                                          pos  =  head.load(std::memory_order_relaxed);
+                                      }
+                                  }
+                                  cell->value  =  std::move(value);
+                                  cell->seq.store(pos + 1, std::memory_order_release);
+                                  return true;
+                              }
+
+           bool               pop(T& value)                                                     noexcept{
+                                  size_t  pos   { tail.load(std::memory_order_relaxed) };
+                                  Cell*   cell  { nullptr };
+                                  for(;;){
+                                      cell  =  &cells[pos & mask];
+                                      const auto  lap  { static_cast<intptr_t>(cell->seq.load(std::memory_order_acquire)) -
+                                                         static_cast<intptr_t>(pos + 1) };
+                                      if(lap == 0){
+                                          if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                                              break;
+                                      }else if(lap < 0){
+                                          return false;
+                                      }else{
+                                          pos  =  tail.load(std::memory_order_relaxed);
+                                      }
+                                  }
+                                  value  =  std::move(cell->value);
+                                  // What was moved from stays in the cell until the next lap overwrites it.
+                                  cell->seq.store(pos + mask + 1, std::memory_order_release);
+                                  return true;
+                              }
+
+           size_t             capacity(void)                                           const    noexcept{
+                                  return mask + 1;
+                              }
+
+        private:
+           struct Cell{
+                  std::atomic<size_t>  seq  { 0 };
+                  T                    value;
+           };
+
+           std::unique_ptr<Cell[]>                                  cells;
+           size_t                                                   mask;
+           alignas(epochutils::CACHE_LINE_SIZE) std::atomic<size_t>  head;
+           alignas(epochutils::CACHE_LINE_SIZE) std::atomic<size_t>  tail;
+
+                              BoundedRing(BoundedRing const&)                           = delete;
+                              BoundedRing(BoundedRing&&)                                = delete;
+           BoundedRing&       operator=(BoundedRing const&)                             = delete;
+           BoundedRing&       operator=(BoundedRing&&)                                  = delete;
+    };
+
+} // End Namespace
@@ -0,0 +1,364 @@
+// -----------------------------------------------------------------
+// libdnsquery - a library to interrogate DNSs and more.
+// Copyright (C) 2018-2023  Gabriele Bonacini
+//
+// This program is free software for no profit use; you can redistribute 
+// it and/or modify it under the terms of the GNU General Public License 
+// as published by the Free Software Foundation; either version 2 of 
+// the License, or (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// A commercial license is also available for a lucrative use.
+// -----------------------------------------------------------------
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <span>
+
+#include <anyexcept.hpp>
+#include <epoch.hpp>
+#include <dns_client.hpp>
+
+namespace dnscache{
+
+    using Clock               =  std::chrono::steady_clock;
+    using TimePoint           =  Clock::time_point;
+
+    constexpr uint32_t        DNS_CACHE_MAX_TTL      =  86400;
+    // RFC 2308 par. 5: negative answers should not be kept more than a few hours.
+    constexpr uint32_t        DNS_CACHE_MAX_NEG_TTL  =  10800;
+    constexpr uint8_t         DNS_RCODE_NXDOMAIN     =  3;
+    // RFC 8767 par. 4: stale answers are returned with a 30 seconds TTL and should
+    // not be kept more than one to three days after expiry.
+    constexpr uint32_t        DNS_CACHE_STALE_TTL    =  30;
+    constexpr uint32_t        DNS_CACHE_MAX_STALE    =  259200;
+    // Refresh-ahead defaults: an entry hit this many times while less than this fraction
+    // of its TTL is left gets refreshed.
+    constexpr uint32_t        DNS_CACHE_PREFETCH_HITS     =  8;
+    constexpr double          DNS_CACHE_PREFETCH_FRACTION =  0.1;
+    constexpr size_t          DNS_CACHE_MAX_ENTRIES  =  10000;
+    constexpr size_t          DNS_CACHE_MAX_BYTES    =  64 * 1024 * 1024;
+    // Power of two, sized for a few dozen threads sharing the cache.
+    constexpr size_t          DNS_CACHE_SHARDS       =  64;
+    // Wire format layout, see RFC 1035 par. 4.1 and RFC 6891 for the OPT pseudo record,
+    // whose TTL field holds flags.
+    constexpr size_t          DNS_WIRE_HEADER_SIZE   =  12;
+    constexpr size_t          DNS_WIRE_QDCOUNT_IDX   =  4;
+    constexpr uint16_t        DNS_WIRE_TYPE_OPT      =  41;
+    // Normalized name, then qtype and qclass in network order.
+    constexpr size_t          DNS_CACHE_KEY_SIZE     =  dnsclient::DNS_MAX_DOMAIN_SIZE + 2 * sizeof(uint16_t);
+
+    using CacheKeyBuffer      =  std::array<char, DNS_CACHE_KEY_SIZE>;
+
+    class CacheKey{
+        public:
+                              CacheKey(std::string_view name, uint16_t qtype,
+                                       uint16_t qclass)                                         noexcept;
+
+           bool               isValid(void)                                            const    noexcept;
+           std::string_view   view(void)                                               const    noexcept;
+           std::string_view   name(void)                                               const    noexcept;
+           CacheKey           withType(uint16_t qtype)                                 const    noexcept;
+           CacheKey           parent(void)                                             const    noexcept;
+
+        private:
+           CacheKeyBuffer     buffer;
+           size_t             length;
+    };
+
+    struct CachedRecord{
+           std::string        name;
+           uint16_t           type,
+                              classid;
+           uint32_t           ttl;
+           uint16_t           len;
+           std::string        data;
+    };
+
+    // RFC 2181 par. 5.4.1, lowest first: a live entry is never replaced by data ranked
+    // below it, so that glue can't overwrite an answer.
+    enum class CacheTrust : uint8_t { ADDITIONAL, AUTHORITY, ANSWER, AUTH_ANSWER };
+
+    using CachedRecords       =  std::vector<CachedRecord>;
+    using WireOffsets         =  std::vector<uint16_t>;
+    using WireResponse        =  std::vector<uint8_t>;
+
+    // Immutable once published, apart from the prefetch bookkeeping. In wire format the
+    // response is kept as received instead of the records, with the offsets of the fields
+    // patched on replay.
+    struct CacheEntry{
+           CachedRecords      records;
+           WireResponse       wire;
+           WireOffsets        ttlOffsets;
+           uint16_t           qtypeOffset  { 0 };
+           std::string        queryTxt;
+           TimePoint          stored,
+                              expiry;
+           uint8_t            rcode;
+           bool               negative;
+           CacheTrust         trust        { CacheTrust::ANSWER };
+           // CLOCK reference bit: set by the readers, cleared by the eviction hand.
+           mutable std::atomic<bool>      referenced  { false };
+           mutable std::atomic<uint32_t>  hits        { 0 };
+           mutable std::atomic<bool>      refreshing  { false };
+    };
+
+    using EntryPtr            =  std::shared_ptr<const CacheEntry>;
+
+    class CacheKeyHash{
+        public:
+           using is_transparent  =  void;
+
+           size_t             operator()(std::string_view key)                         const    noexcept;
+    };
+
+    struct CacheNode{
+           std::string        key;
+           EntryPtr           entry;
+    };
+
+    // Immutable once published: a writer replaces the bucket it changes as a whole.
+    using CacheBucket         =  std::vector<CacheNode>;
+    using CacheBuckets        =  std::unique_ptr<std::atomic<const CacheBucket*>[]>;
+
+    // The question asked again, and the key of the entry it renews: a denial is kept under
+    // the type wildcard or the denied ancestor, but asked about with a real type. A stale
+    // entry is renewed by the server of the client it was served to, the others by the
+    // prefetch one.
+    struct PrefetchJob{
+           std::string        question,
+                              entry,
+                              server;
+    };
+
+    using PrefetchQueue       =  std::deque<PrefetchJob>;
+
+    // What the leader of a coalesced query hands to the callers that waited for it. An
+    // abandoned flight ended for reasons of its leader only, a cancellation or a deadline
+    // of its own: the others ask again themselves.
+    struct FlightResult{
+           CachedRecords      records;
+           std::string        queryTxt,
+                              lastError;
+           dnsclient::QueryError  error;
+           bool               ok,
+                              stale;
+           size_t             answersNo;
+           bool               abandoned;
+    };
+
+    // Told that a flight is over, on the thread completing it, which it must not block.
+    struct FlightWaiter{
+           const void*        owner;
+           std::function<void(void)>  notify;
+    };
+
+    using FlightWaiters       =  std::vector<FlightWaiter>;
+
+    // A query in progress: the first caller asking a question sends it, the others
+    // asking the same question meanwhile wait here for its outcome. Those that can't
+    // block park a waiter instead, and read the outcome once told; one going away first
+    // takes its waiter back.
+    class Flight{
+        public:
+           void               complete(FlightResult&& res)                                      noexcept;
+           const FlightResult&  wait(void)                                                      noexcept;
+           bool               park(FlightWaiter&& waiter)                                       anyexcept;
+           void               unpark(const void* owner)                                         noexcept;
+           bool               isDone(void)                                             const    noexcept;
+
+        private:
+           mutable std::mutex flightMtx;
+           std::condition_variable  flightCv;
+           bool               done     { false };
+           FlightResult       result   {};
+           FlightWaiters      waiters;
+    };
+
+    using FlightPtr           =  std::shared_ptr<Flight>;
+    using FlightMap           =  std::unordered_map<std::string, FlightPtr, CacheKeyHash, std::equal_to<>>;
+
+    // A fixed array of buckets, sized once for the share of entries of the shard. Readers
+    // load a bucket without locking, writers serialize on the shard mutex, publish a modified
+    // copy of the bucket they change and retire the old one through the epoch domain: a
+    // store costs the length of a bucket, not the size of the shard. Every shard sits on
+    // its own cache lines: the counters updated by the writers share the line of the mutex
+    // they hold anyway, those updated by the readers have a line of their own.
+    struct alignas(epochutils::CACHE_LINE_SIZE) CacheShard{
+           std::mutex                     writeMtx;
+           CacheBuckets                   buckets;
+           size_t                         bucketsNo    { 0 };
+           FlightMap                      flights;
+           size_t                         clockHand    { 0 };
+           std::atomic<size_t>            count        { 0 },
+                                          bytes        { 0 };
+           std::atomic<uint64_t>          evictions    { 0 },
+                                          expirations  { 0 };
+           alignas(epochutils::CACHE_LINE_SIZE)
+           std::atomic<uint64_t>          hits         { 0 },
+                                          misses       { 0 };
+    };
+
+    struct CacheStats{
+           size_t             entries,
+                              bytes;
+           uint64_t           hits,
+                              misses,
+                              evictions,
+                              expirations;
+    };
+
+    using CacheShards         =  std::array<CacheShard, DNS_CACHE_SHARDS>;
+
+    class CacheSnapshot;
+
+    // Answers shared by any number of DnsClient instances: the records are returned with
+    // the TTLs decremented by the time spent in the cache. NXDOMAIN and NODATA answers are
+    // kept as in RFC 2308, for the lesser of the SOA TTL and the SOA MINIMUM field; as in
+    // RFC 8020, a NXDOMAIN also denies every name below it.
+    // With prefetch enabled, hot positive entries close to expiry are resolved again by a
+    // background thread and replaced before the readers notice they are gone.
+    // Entries are split in shards by key hash and lookups take no locks.
+    // The entry and memory limits are split evenly among the shards; when a shard is full
+    // a CLOCK hand sweeps it, dropping the expired entries and those not read since its
+    // last pass. Memory is what the entries allocate, keys and bucket nodes included; the
+    // bucket arrays, and the copies of a bucket being replaced, are not accounted.
+    // The live entries can be saved to a snapshot file, periodically if required; a loaded
+    // snapshot is mapped and its entries move to the cache when they are first asked for.
+    // With a stale window set, expired entries are kept that long to be served as in
+    // RFC 8767 when the upstream doesn't answer; serving one queues its refresh on the
+    // prefetch thread, started on demand even with prefetch disabled.
+    // Concurrent misses for the same key are coalesced in a single upstream query.
+    // The other in-bailiwick records of a response, the CNAME chain, the NS of the zones
+    // above the name asked for and their glue, are cached under their own keys.
+    class DnsCache{
+        public:
+           explicit           DnsCache(uint32_t maxTtl=DNS_CACHE_MAX_TTL,
+                                       size_t maxEntries=DNS_CACHE_MAX_ENTRIES,
+                                       uint32_t maxNegTtl=DNS_CACHE_MAX_NEG_TTL,
+                                       size_t maxBytes=DNS_CACHE_MAX_BYTES);
+                              ~DnsCache(void);
+
+           bool               lookup(const CacheKey& key, dnsclient::ParsedResponse& dest,
+                                     std::string& queryTxt, uint8_t& rcode)                     anyexcept;
+           bool               lookupStale(const CacheKey& key, dnsclient::ParsedResponse& dest,
+                                          std::string& queryTxt, uint8_t& rcode,
+                                          std::string_view server={})                           anyexcept;
+           bool               lookupWire(const CacheKey& key, WireResponse& dest,
+                                         uint16_t id, bool stale=false,
+                                         std::string_view server={})                            anyexcept;
+           bool               hasStale(const CacheKey& key)                            const    noexcept;
+           void               store(const CacheKey& key,
+                                    const dnsclient::ParsedResponse& records,
+                                    const std::string& queryTxt,
+                                    uint8_t rcode, size_t answersNo,
+                                    std::span<const uint8_t> wire={})                           anyexcept;
+           void               harvest(const CacheKey& key,
+                                      const dnsclient::ParsedResponse& records,
+                                      size_t answersNo,
+                                      const dnsclient::ParsedResponse& additional,
+                                      std::span<const uint8_t> wire)                            anyexcept;
+           void               setWireFormat(bool wire=true)                                     noexcept;
+           bool               isWireFormat(void)                                       const    noexcept;
+           FlightPtr          joinFlight(const CacheKey& key, bool& leader)                     anyexcept;
+           void               leaveFlight(const CacheKey& key)                                  noexcept;
+           void               setMaxTtl(uint32_t ttl)                                           noexcept;
+           void               setMaxNegativeTtl(uint32_t ttl)                                   noexcept;
+           void               setStaleWindow(uint32_t secs)                                     noexcept;
+           void               enablePrefetch(const std::string& server,
+                                             double fraction=DNS_CACHE_PREFETCH_FRACTION,
+                                             uint32_t minHits=DNS_CACHE_PREFETCH_HITS,
+                                             time_t timeout=3)                                  anyexcept;
+           void               disablePrefetch(void)                                             noexcept;
+           void               clear(void)                                                       noexcept;
+           size_t             size(void)                                               const    noexcept;
+           CacheStats         getStats(void)                                           const    noexcept;
+           size_t             loadSnapshot(const std::string& path)                             anyexcept;
+           void               saveSnapshot(const std::string& path)                    const    anyexcept;
+           void               enableSnapshots(const std::string& path,
+                                              std::chrono::seconds interval)                    anyexcept;
+           void               disableSnapshots(void)                                            noexcept;
+
+        private:
+           CacheShards        shards;
+           std::atomic<uint32_t>  maxTtl;
+           size_t             shardEntries,
+                              shardBytes;
+           std::atomic<uint32_t>  maxNegTtl;
+           std::atomic<uint32_t>  staleWindow;
+           std::atomic<bool>      wireFormat;
+           std::atomic<bool>      prefetchOn;
+           std::atomic<double>    prefetchFraction;
+           std::atomic<uint32_t>  prefetchHits;
+           std::mutex         prefetchMtx;
+           std::string        prefetchServer;
+           time_t             prefetchTimeout;
+           bool               prefetchStop;
+           PrefetchQueue      prefetchQueue;
+           std::condition_variable  prefetchCv;
+           std::thread        prefetchThread;
+           std::atomic<const CacheSnapshot*>  snapshot;
+           std::mutex         snapshotMtx;
+           std::string        snapshotPath;
+           std::chrono::seconds  snapshotInterval;
+           bool               snapshotStop;
+           std::condition_variable  snapshotCv;
+           std::thread        snapshotThread;
+
+           CacheShard&        shardOf(std::string_view key)                                     noexcept;
+           const CacheShard&  shardOf(std::string_view key)                            const    noexcept;
+           std::atomic<const CacheBucket*>&  bucketOf(std::string_view key)            const    noexcept;
+           void               evict(CacheShard& shard, size_t& used, size_t& count,
+                                    size_t needed, TimePoint now,
+                                    std::string_view replaced)                         const    noexcept;
+           static size_t      entryBytes(std::string_view key, const CacheEntry& entry)         noexcept;
+           void               insert(std::string_view key, EntryPtr&& entry)                    anyexcept;
+           const CacheEntry*  locate(std::string_view key)                             const    noexcept;
+           const CacheEntry*  find(std::string_view key, TimePoint now)                const    noexcept;
+           const CacheEntry*  findStale(std::string_view key, TimePoint now)           const    noexcept;
+           const CacheEntry*  acquire(const CacheKey& key, TimePoint now, bool stale,
+                                      bool wire, EntryPtr& restored, bool& cut,
+                                      std::string_view server={})                               anyexcept;
+           static bool        wireLayout(std::span<const uint8_t> wire, WireOffsets& ttlOffsets,
+                                         uint16_t& qtypeOffset)                                 anyexcept;
+           static CacheTrust  answerTrust(std::span<const uint8_t> wire)                        noexcept;
+           static uint32_t    negativeTtl(const dnsclient::ParsedResponse& records)             noexcept;
+           void               checkPrefetch(std::string_view key, const CacheEntry& entry,
+                                            TimePoint now)                                      noexcept;
+           void               scheduleRefresh(std::string_view question, std::string_view key,
+                                               const CacheEntry& entry,
+                                               std::string_view server={})                      noexcept;
+           void               startPrefetchThread(void)                                         anyexcept;
+           void               stopPrefetchThread(void)                                          noexcept;
+           void               prefetchLoop(void)                                                noexcept;
+           void               refresh(std::string_view key, const std::string& server,
+                                      time_t timeout)                                           noexcept;
+           EntryPtr           restore(std::string_view key)                                     anyexcept;
+           void               snapshotLoop(void)                                                noexcept;
+
+                              DnsCache(DnsCache const&)                                 = delete;
+                              DnsCache(DnsCache&&)                                      = delete;
+           DnsCache&          operator=(DnsCache const&)                                = delete;
+           DnsCache&          operator=(DnsCache&&)                                     = delete;
+    };
+
+} // End Namespace
@@ -0,0 +1,78 @@
+// -----------------------------------------------------------------
+// libdnsquery - a library to interrogate DNSs and more.
+// Copyright (C) 2018-2023  Gabriele Bonacini
+//
+// This program is free software for no profit use; you can redistribute 
+// it and/or modify it under the terms of the GNU General Public License 
+// as published by the Free Software Foundation; either version 2 of 
+// the License, or (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// A commercial license is also available for a lucrative use.
+// -----------------------------------------------------------------
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+
+#include <anyexcept.hpp>
+#include <dns_cache.hpp>
+
+namespace dnscache{
+
+    // On-disk layout, native byte order, all sizes in bytes:
+    //   header: magic(8) version(4) byte-order mark(4) entries(4)
+    //   entry:  key length(2) key expiry(8) body length(4) body
+    //   body:   stored(8) rcode(1) negative(1) query text length(4) query text records(2)
+    //           { name length(2) name type(2) class(2) ttl(4) rdata length(2) text length(4) text }
+    //           since version 2: wire length(4) wire offsets(2) { ttl offset(2) } qtype offset(2)
+    //           since version 3: trust(1)
+    // Times are absolute, in seconds since the epoch, so that expired entries can be
+    // dropped whenever the file is loaded.
+    constexpr char            DNS_SNAPSHOT_MAGIC[]    =  "DNSQSNAP";
+    constexpr uint32_t        DNS_SNAPSHOT_VERSION    =  3;
+    constexpr uint32_t        DNS_SNAPSHOT_BOM        =  0x01020304;
+
+    using SnapshotEntries     =  std::vector<std::pair<std::string, EntryPtr>>;
+    using SnapshotIndex       =  std::unordered_map<std::string_view, size_t, CacheKeyHash, std::equal_to<>>;
+
+    // A read-only mapping of a snapshot file: loading indexes the live keys only,
+    // an entry is decoded the first time it is asked for.
+    class CacheSnapshot{
+        public:
+           explicit           CacheSnapshot(const std::string& path)                                        anyexcept;
+                              ~CacheSnapshot(void);
+
+           EntryPtr           restore(std::string_view key)                                const    anyexcept;
+           size_t             size(void)                                                   const    noexcept;
+           int64_t            getExpiry(void)                                              const    noexcept;
+           const SnapshotIndex&  getIndex(void)                                            const    noexcept;
+
+           static void        save(const std::string& path, const SnapshotEntries& entries)                anyexcept;
+
+        private:
+           const char*        base;
+           size_t             length;
+           SnapshotIndex      index;
+           int64_t            lastExpiry;
+           uint32_t           version;
+
+                              CacheSnapshot(CacheSnapshot const&)                           = delete;
+                              CacheSnapshot(CacheSnapshot&&)                                = delete;
+           CacheSnapshot&     operator=(CacheSnapshot const&)                               = delete;
+           CacheSnapshot&     operator=(CacheSnapshot&&)                                    = delete;
+    };
+
+} // End Namespace
@@ -20,7 +20,10 @@
 
 #include <config.h>
 
+#include <fstream>
+
 #include <dns_client.hpp>
+#include <dns_engine.hpp>
 #include <parseCmdLine.hpp>
 
 void paramError(const char* progname, const char* err)  noexcept    __attribute__ ((noreturn));
@@ -28,4 +31,10 @@ void versionInfo(void)                                  noexcept    __attribute_
 bool isAnAddr(const std::string& param)                 anyexcept;
 const dnsclient::EnumerationRanges
      createEnumerationList(std::string& epar)           anyexcept;
+std::vector<std::string>
+     splitDnsList(const std::string& dnsList)           anyexcept;
+int  bulkResolve(const std::string& source, const std::string& dnsList,
+                 const std::string& defType, size_t window,
+                 time_t timeo, dnsengine::RateLimit limit,
+                 dnsclient::RetryPolicy retry)          anyexcept;
 
@@ -39,10 +39,15 @@
 #include <functional>
 #include <memory>
 #include <regex>
+#include <string_view>
+#include <span>
+#include <memory_resource>
+#include <chrono>
 
 #include <anyexcept.hpp>
 #include <trace.hpp>
 #include <network.hpp>
+#include <expected.hpp>
 
 #ifdef LINUX_OS
     #include <atomic>
@@ -57,6 +62,14 @@ extern "C" {
 
 extern template class rngreader::RngReader<std::vector<uint8_t>>;
 
+namespace dnscache{
+    class DnsCache;
+    class CacheKey;
+    class Flight;
+
+    using FlightPtr           =  std::shared_ptr<Flight>;
+}
+
 namespace dnsclient {
 
     enum  ERR_GROUPS : uint16_t { GROUP_ZERO_LIM = 23,     GROUP_ONE_LIM    = 3'841,
@@ -72,6 +85,13 @@ namespace dnsclient {
                                  DNS_MAX_DOMAIN_SIZE     =  253};
 
     constexpr size_t             DNS_RESP_DATA_TCP_DELTA =  sizeof(uint16_t);
+    // Inline storage for the per query parse state, big enough for a full udp response:
+    // larger tcp responses spill over to the heap.
+    constexpr size_t             DNS_ARENA_SIZE          =  8192;
+    constexpr size_t             DNS_HEADER_SIZE         =  DNS_RESP_DATA_IDX;
+    constexpr size_t             DNS_QUERY_SEGMENTS      =  4;   // Len, Header, Name, Footer
+    // Random bytes each thread reads at once for the transaction ids.
+    constexpr size_t             DNS_TRANID_POOL         =  256;
 
     enum DNS_HEADER_IDX { DNS_TRANID_IDX   =  0,
                           DNS_FLAGS_IDX    =  2,
@@ -159,7 +179,9 @@ namespace dnsclient {
                                                   0b0000'1101,
                                                   0b0000'1110,  
                                                   0b0000'1111  
-                                                }};  
+                                                }};
+    const uint8_t              DNS_RCODE_SERVFAIL  =  2;  
+    const uint8_t              DNS_RCODE_REFUSED   =  5;
 
     // const uint8_t             DNS_RET          =       0b0000'1111;            // RETURN 
 
@@ -172,16 +194,22 @@ namespace dnsclient {
     enum  RESP_RECORD_IDX     {  PARSED_RESP_NAME_IDX,   PARSED_RESP_TYPE_IDX,
                                  PARSED_RESP_CLASS_IDX,  PARSED_RESP_TTL_IDX,
                                  PARSED_RESP_LEN_IDX,    PARSED_RESP_DATA_IDX};
-    using ParsedRespRecord    =  std::tuple<std::string, uint16_t, uint16_t, uint32_t, uint16_t, std::string>;
-    using ParsedResponse      =  std::vector<ParsedRespRecord>;
-    using RRToStringpMap      =  std::map<size_t, std::string>;
-    using ResponseTypeIdx     =  std::map<size_t, std::vector<size_t>>;
-    using StringToRRMap       =  std::map<std::string, size_t>;
+    using ArenaString         =  std::pmr::string;
+    using ParsedRespRecord    =  std::tuple<ArenaString, uint16_t, uint16_t, uint32_t, uint16_t, ArenaString>;
+    using ParsedResponse      =  std::pmr::vector<ParsedRespRecord>;
+    using RRName              =  std::pair<std::string_view, uint16_t>;
+    using ResponseTypeIdx     =  std::pmr::map<size_t, std::pmr::vector<size_t>>;
+    using ArenaBuffer         =  std::array<std::byte, DNS_ARENA_SIZE>;
     using Query               =  std::vector<uint8_t>;
+    using QueryHeader         =  std::array<uint8_t, DNS_HEADER_SIZE>;
+    using QueryHeaderLen      =  std::array<uint8_t, DNS_RESP_DATA_TCP_DELTA>;
+    using QuerySegments       =  std::array<networkutils::Iovec, DNS_QUERY_SEGMENTS>;
     using DnsName             =  std::string;
+    using DnsNames            =  std::vector<DnsName>;
     using SiteName            =  std::string;
     using RngReaderVectUint8  =  rngreader::RngReader<std::vector<uint8_t>>;
     using SocketPtr           =  std::unique_ptr<networkutils::Socket>;
+    using CachePtr            =  std::shared_ptr<dnscache::DnsCache>;
     using EnumerationRanges   =  std::array<std::string, dnsclient::DNS_ENUM_RANGES>;
     using CmdLineInterpMap    =  std::map<std::string, std::function<int(void)>>;
 
@@ -191,7 +219,48 @@ namespace dnsclient {
                                 RR_TYPES_WKS=11,     RR_TYPES_PTR=12,
                                 RR_TYPES_MX=15,      RR_TYPES_TXT=16,
                                 RR_TYPES_AAAA=28,    RR_TYPES_LOC=29,
-                                RR_TYPES_SRV=33};
+                                RR_TYPES_SRV=33,     RR_TYPES_NAPTR=35,
+                                RR_TYPES_SVCB=64,    RR_TYPES_HTTPS=65,
+                                RR_TYPES_ANY=255,    RR_TYPES_CAA=257};
+
+    enum  RR_CLASSES          { CLASS_IN=1,          CLASS_CS=2,
+                                CLASS_CH=3,          CLASS_HS=4,
+                                CLASS_ANY=255};
+
+    //         BITS
+    // ELEM    0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
+    //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    // 12|14,..|                                               |
+    // ..      /                     QNAME                     /
+    // ..      /                                               /
+    //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    // ..      |                     QTYPE                     |
+    //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    // ..      |                     QCLASS                    |
+    //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
+    // The footer starts with the root label that terminates QNAME.
+
+    constexpr size_t          DNS_QUERY_FOOTER_SIZE  =  1 + 2 * sizeof(uint16_t);
+    using QueryFooter         =  std::array<uint8_t, DNS_QUERY_FOOTER_SIZE>;
+
+    constexpr QueryFooter     makeQueryFooter(uint16_t qtype, uint16_t qclass)                          noexcept{
+        return {{ 0x00,
+                  static_cast<uint8_t>(qtype  >> 8),  static_cast<uint8_t>(qtype  & 0xff),
+                  static_cast<uint8_t>(qclass >> 8),  static_cast<uint8_t>(qclass & 0xff) }};
+    }
+
+    template<uint16_t QTYPE, uint16_t QCLASS = CLASS_IN>
+    class DnsQuery{
+        public:
+           static constexpr uint16_t     qtype   { QTYPE  };
+           static constexpr uint16_t     qclass  { QCLASS };
+           static constexpr QueryFooter  footer  { makeQueryFooter(QTYPE, QCLASS) };
+    };
+
+    using StdQuery            =  DnsQuery<RR_TYPES_A>;
+    using InfoQuery           =  DnsQuery<RR_TYPES_TXT, CLASS_CH>;
+    using MailQuery           =  DnsQuery<RR_TYPES_MX>;
+    using LocQuery            =  DnsQuery<RR_TYPES_LOC>;
  
     enum class QUERY_TYPE    {  STD_QUERY,     DUMP_QUERY,     PING_QUERY,     INFO_QUERY, 
                                 #ifdef OFFENSIVE_REL
@@ -201,8 +270,40 @@ namespace dnsclient {
                                 MAIL_QUERY,    LOC_QUERY
                              };
     
-    using QTypeDescToClass    =  std::map<std::string, QUERY_TYPE>;
-    using QTypeToDescript     =  std::map<QUERY_TYPE, std::string>;
+    using QTypeDescr          =  std::pair<std::string_view, QUERY_TYPE>;
+
+    // Outcome of a query sent with the non throwing API: the rcode is valid for QUERY_RCODE, the
+    // offset points to the first malformed byte of the response for QUERY_PARSE_ERROR.
+    // QUERY_CANCELLED is only reported for queries abandoned by their caller.
+    enum class QUERY_STATUS  {  QUERY_OK,          QUERY_TIMEOUT,     QUERY_NET_ERROR,
+                                QUERY_TRUNCATED,   QUERY_PARSE_ERROR, QUERY_RCODE,
+                                QUERY_INVALID,     QUERY_CANCELLED
+                             };
+
+    struct QueryError{
+        QUERY_STATUS          status;
+        uint8_t               rcode;
+        size_t                offset;
+    };
+
+    using QueryResult         =  expectedutils::Expected<const ParsedResponse*, QueryError>;
+
+    // How a query lost, or refused by its server, is sent again. attempts counts the first
+    // one too, each waiting timeoutMs (0: the client timeout). Retries pause backoffMs,
+    // doubled every time up to maxBackoffMs, and ask the next server when rotate is set.
+    // deadlineMs (0: none) bounds the whole query, tcp fallback included.
+    struct RetryPolicy{
+        size_t                attempts      { 1 };
+        uint32_t              timeoutMs     { 0 },
+                              backoffMs     { 25 },
+                              maxBackoffMs  { 1'000 },
+                              deadlineMs    { 0 };
+        bool                  rotate        { true };
+    };
+
+    // Pause before the retry-th retry: half of it is random, so that the clients hit by the
+    // same loss don't retry all together.
+    std::chrono::milliseconds  retryBackoff(const RetryPolicy& policy, size_t retry)     noexcept;
 
     class BitMaskHdlr{
         public:
@@ -218,28 +319,58 @@ namespace dnsclient {
           DnsBase(void);
 
           void              sendQuery(bool assemble=true)                                        anyexcept;
+          QueryResult       trySendQuery(bool assemble=true)                                     noexcept;
           bool              isTruncated(void)                                           const    noexcept;
           void              setForceTcp(bool tcp=true)                                           noexcept;
+          void              setTcpFallback(bool fallback=true)                                   noexcept;
+          void              setCache(CachePtr sharedCache)                                       noexcept;
+          bool              isFromCache(void)                                           const    noexcept;
+          void              setStaleTimeoutSecs(time_t tou)                                      noexcept;
+          bool              isStale(void)                                               const    noexcept;
+          size_t            getAnswersNo(void)                                          const    noexcept;
+          const ParsedResponse&  getParsedResponse(void)                              const    noexcept;
+          const std::string&  getLastError(void)                                      const    noexcept;
           void              setSite(SiteName site)                                               anyexcept;
           void              setDNSserver(DnsName dns)                                            anyexcept;
+          void              setDNSservers(DnsNames dns)                                          anyexcept;
+          void              setRetryPolicy(RetryPolicy policy)                                   noexcept;
+
+          // Split query, for callers multiplexing many queries on their own udp sockets:
+          // beginQuery() answers from the cache when it can, otherwise it leaves the query
+          // pending in getQuerySegments(). The response is handed to endQuery(), a lost one
+          // reported to abortQuery(); both fall back to the cache as trySendQuery() does.
+          // A truncated udp response, with the tcp fallback on, leaves the query pending
+          // again: the caller sends it on tcp, length prefixed, and hands over the payload.
+          QueryResult       beginQuery(bool& pending)                                            noexcept;
+          std::span<const networkutils::Iovec>  getQuerySegments(void)                 const    noexcept;
+          uint16_t          getTranId(void)                                             const    noexcept;
+          QueryResult       endQuery(std::span<const uint8_t> response, bool& pending)           noexcept;
+          QueryResult       abortQuery(QUERY_STATUS status, const std::string& reason)           noexcept;
+          // After a miss of beginQuery(), the first caller asking the question leads its flight,
+          // the others wait for its outcome; null when the query isn't cached. The leader ends
+          // it, abandoned when the outcome is its own only: a cancellation or a caller deadline.
+          // As trySendQuery(), the caller gives the upstream the stale timeout only while
+          // a stale answer is at hand.
+          dnscache::FlightPtr  joinFlight(bool& leader)                                const    noexcept;
+          void              endFlight(dnscache::Flight& flight, const QueryResult& result,
+                                      bool abandoned=false)                             const    noexcept;
+          bool              hasStale(void)                                              const    noexcept;
+          time_t            getStaleTimeoutSecs(void)                                   const    noexcept;
 
         protected: 
-           QTypeDescToClass         queryTypeDescrToClass;
-           QTypeToDescript          queryTypeToDescription;
-           const Query              queryHeaderConst,
-                                    queryHeaderLenConst,
-                                    queryFooterConst,
-                                    queryFooterTxtConst,
-                                    queryFooterMailConst,
-                                    queryFooterLocConst;
-           Query                    queryHeader,
-                                    queryHeaderLen,
-                                    queryFooter,
-                                    queryFooterTxt,
-                                    queryFooterMail,
-                                    queryFooterLoc,
+           static const QueryHeader     queryHeaderConst;
+           static const QueryHeaderLen  queryHeaderLenConst;
+           QueryHeader              queryHeader;
+           QueryHeaderLen           queryHeaderLen;
+           Query                    queryName,
                                     queryAssembl;
-           bool                     tcpQuery;
+           QueryFooter              customFooter;
+           const QueryFooter*       queryFooter;
+           QuerySegments            querySegments;
+           size_t                   querySegmentsNo;
+           bool                     tcpQuery,
+                                    tcpFallback,
+                                    tcpLeg;
            QUERY_TYPE               activeType;
            SocketPtr                socketptr;
            SiteName                 sitename;
@@ -255,34 +386,75 @@ namespace dnsclient {
                                     responseEndIdx;
            uint16_t                 queryType,
                                     queryClass;
-           ParsedResponse           parsedResponse;
+           ArenaBuffer              arenaBuffer;
+           std::pmr::monotonic_buffer_resource  arena;
+           ParsedResponse           parsedResponse,
+                                    additionalResponse;
            ResponseTypeIdx          responseTypeIdx;
+           size_t                   respLen,
+                                    parseOffset;
+           std::string              lastError;
+           CachePtr                 cache;
+           bool                     cacheHit,
+                                    staleHit;
+           time_t                   staleTimeoutSecs;
+           DnsNames                 dnsNames;
+           size_t                   dnsIdx;
+           RetryPolicy              retryPolicy;
+           uint32_t                 attemptMs;
+           std::chrono::steady_clock::time_point  queryDeadline;
+           uint8_t                  respRcode;
+           size_t                   answersNo;
 
 
            void              setTranId(void)                                                     anyexcept;
 
            void              resetHeader(void)                                                   anyexcept;
-           void              resetFooterStd(void)                                                anyexcept;
-           void              resetFooterTxt(void)                                                anyexcept;
-           void              resetFooterMail(void)                                               anyexcept;
-           void              resetFooterLoc(void)                                                anyexcept;
+           void              prepareResponse(void)                                               anyexcept;
+           static
+           const QueryFooter&  getFooter(QUERY_TYPE qtype)                                       noexcept;
 
-           void              assembleQuery(bool addLen=false,
-                                           QUERY_TYPE qtype=QUERY_TYPE::STD_QUERY)               anyexcept;
+           void              encodeName(void)                                                    anyexcept;
+           void              buildSegments(bool addLen=false)                                    noexcept;
+           void              assembleQuery(bool addLen=false)                                    anyexcept;
 
            void              extractQueryPartFromResponse(void)                                  anyexcept;
-           size_t            extractTextFromResponse(size_t txtIdx, std::string& result)         anyexcept;
-
-           void              sendQueryTcp(bool assemble)                                         anyexcept;
-           void              sendQueryUdp(bool assemble)                                         anyexcept;
+           size_t            extractTextFromResponse(size_t txtIdx, ArenaString& result)         anyexcept;
+
+           QueryResult       sendQueryTcp(bool assemble)                                         noexcept;
+           QueryResult       sendQueryUdp(bool assemble)                                         noexcept;
+           QueryResult       sendSegments(bool tcp)                                              noexcept;
+           QueryResult       parseResponse(void)                                                 noexcept;
+           void              resetArena(void)                                                    noexcept;
+           bool              isCacheable(void)                                          const    noexcept;
+           dnscache::CacheKey  cacheKey(void)                                           const    noexcept;
+           bool              lookupCache(bool stale=false)                                       noexcept;
+           bool              lookupWireCache(const dnscache::CacheKey& key, bool stale)          noexcept;
+           QueryResult       resolve(bool assemble)                                              noexcept;
+           const DnsName&    activeServer(void)                                         const    noexcept;
+           bool              isRetriable(const QueryResult& result)                     const    noexcept;
+           bool              armAttempt(uint32_t tou)                                            noexcept;
+           QueryResult       finishQuery(const QueryResult& result, bool staleAtHand)            noexcept;
+           QueryResult       followFlight(dnscache::Flight& flight)                              noexcept;
+           void              leadFlight(dnscache::Flight& flight, const QueryResult& result,
+                                        bool abandoned)                                 const    noexcept;
+           void              storeCache(void)                                                    noexcept;
+           QueryResult       queryFailure(QUERY_STATUS status, size_t offset=0)                  noexcept;
+           size_t            skipName(size_t idx)                                       const    noexcept;
+           bool              validateResponse(void)                                              noexcept;
 
            void              extractResponse(size_t mainIdx)                                     anyexcept;
-           void              extractSoaTextFromResponse(size_t txtIdx, std::string& result)      anyexcept;
-           void              extractInfoTextFromResponse(size_t txtIdx, std::string& result)     anyexcept;
-           void              extractAddrFromResponse(size_t ipIdx, std::string& result)          anyexcept;
-           void              extractLocFromResponse(size_t ipIdx, std::string& result)           anyexcept;
-           void              extractMxFromResponse(size_t ipIdx, std::string& result)            anyexcept;
-           void              extractAddr6FromResponse(size_t ipIdx, std::string& result)         anyexcept;
+           size_t            extractRecord(size_t blkIdx, ParsedResponse& dest)                  anyexcept;
+           void              extractAdditional(size_t blkIdx)                                    noexcept;
+           void              extractSoaTextFromResponse(size_t txtIdx, ArenaString& result)      anyexcept;
+           void              extractInfoTextFromResponse(size_t txtIdx, ArenaString& result)     anyexcept;
+           void              extractAddrFromResponse(size_t ipIdx, ArenaString& result)          anyexcept;
+           void              extractLocFromResponse(size_t ipIdx, ArenaString& result)           anyexcept;
+           void              extractMxFromResponse(size_t ipIdx, ArenaString& result)            anyexcept;
+           void              extractSrvFromResponse(size_t idx, ArenaString& result)             anyexcept;
+           void              extractGenericFromResponse(size_t idx, uint16_t len,
+                                                        ArenaString& result)                     anyexcept;
+           void              extractAddr6FromResponse(size_t ipIdx, ArenaString& result)         anyexcept;
 
            size_t            getQueryClassIdx(void)                                              noexcept;
            size_t            getRespIdx(void)                                                    noexcept;
@@ -304,6 +476,11 @@ namespace dnsclient {
            #endif
            void                setQueryType(QUERY_TYPE type=QUERY_TYPE::STD_QUERY)              noexcept;
            bool                setQueryType(const std::string& descr)                           noexcept;
+           template<uint16_t QTYPE, uint16_t QCLASS=CLASS_IN>
+           void                setQuery(void)                                                   noexcept;
+           void                setQueryRR(uint16_t qtype, uint16_t qclass=CLASS_IN)             noexcept;
+           bool                setQueryRR(const std::string& rrtype,
+                                          uint16_t qclass=CLASS_IN)                             noexcept;
            void                setRecursionDes(bool rec)                                        noexcept;
            void                setTimeoutSecs(time_t tou)                                       noexcept;
            #ifdef OFFENSIVE_REL
@@ -312,7 +489,7 @@ namespace dnsclient {
            static std::string  reverseQueryHostString(const std::string& saddr,
                                                       bool checkFormat=false)                   anyexcept;
            const std::string&  getQueryTxtFromResp(void)                               const    noexcept;
-           const std::string&  getLastTxtFromResp(void)                                const    noexcept;
+           std::string_view    getLastTxtFromResp(void)                                const    noexcept;
            const std::string   getAllTxtFromResp(void)                                 const    noexcept;
            const std::string   getAllTxtSpecTypeResp(const std::string& type)          const    noexcept;
            const std::string   getOnextSpecTypeResp(const std::string& type)           const    noexcept;
@@ -320,6 +497,7 @@ namespace dnsclient {
            uint16_t            getQueryClass(void)                                     const    noexcept;
            uint8_t             getReturnCode(void)                                     const    noexcept;
            ssize_t             getRespLength(void)                                     const    noexcept;
+           std::span<const uint8_t>  getRawResponse(void)                              const    noexcept;
            const std::string&  getWarning(void)                                        const    noexcept;
            double              getElapsedTime(void)                                    const    noexcept;
            bool                isTimeout(void)                                         const    noexcept;
@@ -331,15 +509,17 @@ namespace dnsclient {
         private:
            SiteName                 bindVersion;
            const std::string        emptyResponse;
-           RRToStringpMap           rRToStringpMap;
-           StringToRRMap            stringToRRMap;
 
         protected:
 
-           void              assembleQuery(bool addLen=false, 
-                                           QUERY_TYPE qtype=QUERY_TYPE::STD_QUERY)               anyexcept;
+           void              assembleQuery(bool addLen=false)                                    anyexcept;
     };
 
+    template<uint16_t QTYPE, uint16_t QCLASS>
+    void  DnsClient::setQuery(void) noexcept{
+         queryFooter  =  &DnsQuery<QTYPE, QCLASS>::footer;
+    }
+
     class DnsTraceroute : public DnsClient {
           void              sendQuery(bool assemble=true)                                        anyexcept = delete;
           bool              isTruncated(void)                                           const    noexcept  = delete;
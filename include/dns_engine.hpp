@@ -0,0 +1,544 @@
+// -----------------------------------------------------------------
+// libdnsquery - a library to interrogate DNSs and more.
+// Copyright (C) 2018-2023  Gabriele Bonacini
+//
+// This program is free software for no profit use; you can redistribute 
+// it and/or modify it under the terms of the GNU General Public License 
+// as published by the Free Software Foundation; either version 2 of 
+// the License, or (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// A commercial license is also available for a lucrative use.
+// -----------------------------------------------------------------
+
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <deque>
+#include <span>
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
+#include <thread>
+#include <stop_token>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <coroutine>
+
+#include <poll.h>
+
+#include <anyexcept.hpp>
+#include <bounded_ring.hpp>
+#include <epoch.hpp>
+#include <network.hpp>
+#include <dns_client.hpp>
+#include <dns_cache.hpp>
+
+namespace dnsengine{
+
+    using Clock               =  std::chrono::steady_clock;
+    using TimePoint           =  Clock::time_point;
+
+    // Queries each worker keeps on the wire at once.
+    constexpr size_t          ENGINE_MAX_INFLIGHT    =  64;
+    constexpr time_t          ENGINE_TIMEOUT_SECS    =  3;
+    // Longest sleep of an idle worker before it looks again for work to steal.
+    constexpr int             ENGINE_IDLE_POLL_MS    =  100;
+    constexpr size_t          ENGINE_RING_ENTRIES    =  4096;
+    constexpr size_t          ENGINE_WINDOW_INITIAL  =  16;
+    // An answer slower than this many times the fastest seen is a sign of queueing.
+    constexpr double          ENGINE_WINDOW_LATENCY  =  4.0;
+    // Floor of the retransmission timeout style estimate after which a query is presumed lost.
+    constexpr int64_t         ENGINE_WINDOW_RTO_MS   =  250;
+    // Failures in a row, timeouts, network errors or REFUSED, taking an upstream out of
+    // rotation; a SERVFAIL is often the fault of a zone, not of the resolver.
+    constexpr size_t          ENGINE_DEAD_FAILURES   =  8;
+    // Health probes to the upstreams out of rotation: interval and question.
+    constexpr int             ENGINE_PROBE_MS        =  1000;
+    constexpr const char*     ENGINE_PROBE_NAME      =  "a.root-servers.net";
+    // One query in this many goes to an upstream other than the best, to keep its figures fresh.
+    constexpr size_t          ENGINE_EXPLORE_EVERY   =  64;
+    constexpr size_t          ENGINE_ANY_UPSTREAM    =  SIZE_MAX;
+    // RFC 6298 par. 2.1: an attempt before the first rtt sample of its upstream.
+    constexpr int64_t         ENGINE_RETRY_RTO_MS    =  1000;
+
+    // Queries per second to an upstream, 0 for no limit, and how many may go back to back
+    // after a pause; 0 as burst means a millisecond worth of queries plus one, enough to
+    // absorb the resolution of the workers' sleep.
+    struct RateLimit{
+           double             qps      { 0 };
+           size_t             burst    { 0 };
+    };
+
+    // Token bucket kept as a GCRA (theoretical arrival time): a single atomic, shared by all
+    // the workers sending to the same upstream, spaces the queries by 1/qps on a nanosecond
+    // clock, allowing up to burst of them ahead of schedule.
+    class TokenBucket{
+        public:
+           explicit           TokenBucket(RateLimit limit={})                                   noexcept;
+
+           bool               tryTake(TimePoint now, TimePoint& retryAt)                        noexcept;
+           void               giveBack(void)                                                    noexcept;
+           bool               isLimited(void)                                          const    noexcept;
+
+        private:
+           int64_t            interval,
+                              tolerance;
+           alignas(epochutils::CACHE_LINE_SIZE) std::atomic<int64_t>  arrival;
+
+                              TokenBucket(TokenBucket const&)                           = delete;
+                              TokenBucket(TokenBucket&&)                                = delete;
+           TokenBucket&       operator=(TokenBucket const&)                             = delete;
+           TokenBucket&       operator=(TokenBucket&&)                                  = delete;
+    };
+
+    // Queries on the wire to an upstream at once: AIMD adapted between min and max, starting
+    // from initial; 0 as max means as many as the workers have slots. min == max fixes it.
+    struct WindowLimit{
+           size_t             initial  { ENGINE_WINDOW_INITIAL },
+                              min      { 1 },
+                              max      { 0 };
+    };
+
+    enum class WindowSignal { NEUTRAL, HEALTHY, CONGESTED };
+
+    // Congestion window, shared by the workers of an upstream as the token bucket: each
+    // healthy answer grows it by 1/window, a query per round trip, while the latency stays
+    // close to the fastest seen; a timeout, SERVFAIL or REFUSED halves it. Losses of
+    // queries sent before the last decrease belong to the same episode and are ignored.
+    // As in TCP, a query unanswered after srtt + 4 * rttvar is presumed lost and leaves the
+    // window then, instead of holding its place until the engine timeout.
+    class CongestionWindow{
+        public:
+           explicit           CongestionWindow(WindowLimit limit, size_t slots)                 noexcept;
+
+           bool               tryAcquire(void)                                                  noexcept;
+           bool               release(WindowSignal signal, TimePoint sentAt, TimePoint now)     noexcept;
+           bool               hasRoom(void)                                            const    noexcept;
+           Clock::duration    lossTimeout(Clock::duration ceiling)                     const    noexcept;
+           Clock::duration    smoothedRtt(void)                                        const    noexcept;
+           double             getWindow(void)                                          const    noexcept;
+           size_t             getInflight(void)                                        const    noexcept;
+
+        private:
+           double             minWindow,
+                              maxWindow;
+           alignas(epochutils::CACHE_LINE_SIZE) std::atomic<double>   window;
+           std::atomic<size_t>                                        inflight;
+           std::atomic<bool>                                          blocked;
+           alignas(epochutils::CACHE_LINE_SIZE) std::atomic<int64_t>  fastestNs,
+                                                                      decreasedNs,
+                                                                      srttNs,
+                                                                      rttvarNs;
+
+                              CongestionWindow(CongestionWindow const&)                 = delete;
+                              CongestionWindow(CongestionWindow&&)                      = delete;
+           CongestionWindow&  operator=(CongestionWindow const&)                        = delete;
+           CongestionWindow&  operator=(CongestionWindow&&)                             = delete;
+    };
+
+    using UpstreamList        =  std::vector<std::string>;
+    using RcodeCounts         =  std::array<uint64_t, 16>;
+
+    // A snapshot of the figures of an upstream; the timeouts count the queries presumed lost.
+    struct UpstreamStats{
+           std::string        server;
+           double             latencyMs    { 0 },
+                              timeoutRate  { 0 },
+                              window       { 0 };
+           uint64_t           queries      { 0 },
+                              timeouts     { 0 };
+           RcodeCounts        rcodes       {};
+           bool               alive        { true };
+    };
+
+    using UpstreamStatsList   =  std::vector<UpstreamStats>;
+
+    // An upstream resolver of the engine, with its own token bucket and congestion window.
+    // The expected cost of a query, the smoothed rtt plus the engine timeout weighted by the
+    // timeout rate, ranks it among the others; ENGINE_DEAD_FAILURES failures in a row take it
+    // out of rotation, any answer but REFUSED, usually to a health probe, brings it back.
+    // All the figures are atomics, updated by the workers as the window is.
+    class Upstream{
+        public:
+                              Upstream(std::string srv, RateLimit rateLimit,
+                                       WindowLimit windowLimit, size_t slots)                  anyexcept;
+
+           void               sent(void)                                                        noexcept;
+           void               record(dnsclient::QUERY_STATUS status, uint8_t rcode)            noexcept;
+           double             cost(Clock::duration timeout)                            const    noexcept;
+           bool               isAlive(void)                                            const    noexcept;
+           bool               startProbe(void)                                                  noexcept;
+           void               endProbe(void)                                                    noexcept;
+           UpstreamStats      getStats(void)                                           const    anyexcept;
+           const std::string& getServer(void)                                          const    noexcept;
+           TokenBucket&       getLimiter(void)                                                  noexcept;
+           CongestionWindow&  getWindow(void)                                                   noexcept;
+           const CongestionWindow&  getWindow(void)                                    const    noexcept;
+
+        private:
+           std::string        server;
+           TokenBucket        limiter;
+           CongestionWindow   window;
+           alignas(epochutils::CACHE_LINE_SIZE) std::atomic<double>   timeoutRate;
+           std::atomic<size_t>                                        failures;
+           std::atomic<bool>                                          alive,
+                                                                      probing;
+           alignas(epochutils::CACHE_LINE_SIZE) std::atomic<uint64_t> queries,
+                                                                      timeouts;
+           std::array<std::atomic<uint64_t>, 16>                      rcodes;
+
+                              Upstream(Upstream const&)                                 = delete;
+                              Upstream(Upstream&&)                                      = delete;
+           Upstream&          operator=(Upstream const&)                                = delete;
+           Upstream&          operator=(Upstream&&)                                     = delete;
+    };
+
+    using Upstreams           =  std::vector<std::unique_ptr<Upstream>>;
+    using UpstreamOrder       =  std::vector<size_t>;
+
+    // The deadline, if set, is absolute and caps the engine timeout; a stop requested on the
+    // token abandons the query: it fails as QUERY_CANCELLED, freeing its slot at once, and
+    // a late response is dropped by the transaction id lookup.
+    struct EngineQuery{
+           std::string        name;
+           uint16_t           qtype     { dnsclient::RR_TYPES_A },
+                              qclass    { dnsclient::CLASS_IN };
+           TimePoint          deadline  {};
+           std::stop_token    cancel;
+    };
+
+    // Owns its records: it outlives the client that resolved the query.
+    struct EngineAnswer{
+           EngineQuery        query;
+           dnscache::CachedRecords  records;
+           std::string        queryTxt,
+                              lastError;
+           dnsclient::QueryError  error    {};
+           bool               ok       { false },
+                              cached   { false },
+                              stale    { false };
+           size_t             answersNo  { 0 };
+    };
+
+    using EngineCallback      =  std::function<void(EngineAnswer&&)>;
+
+    // A query of a batch: the tag is the caller's, it comes back with the completion.
+    struct RingRequest{
+           EngineQuery        query;
+           uint64_t           tag      { 0 };
+    };
+
+    struct RingCompletion{
+           EngineAnswer       answer;
+           uint64_t           tag      { 0 };
+    };
+
+    using SubmissionQueue     =  ringutils::BoundedRing<RingRequest>;
+    using CompletionQueue     =  ringutils::BoundedRing<RingCompletion>;
+
+    // The queues of an EngineRing, shared with its queries in flight: the ring may be
+    // destroyed while the workers still complete what it submitted.
+    struct RingState{
+           explicit           RingState(size_t entries)                                         anyexcept;
+
+           bool               pull(RingRequest& request)                                        noexcept;
+           void               complete(uint64_t tag, EngineAnswer&& answer)                     noexcept;
+
+           SubmissionQueue    submissions;
+           CompletionQueue    completions;
+           // Submitted and not reaped, not yet pulled by a worker, completed and not reaped.
+           std::atomic<size_t>  outstanding,
+                              queued,
+                              ready,
+                              waiters;
+           std::mutex         waitMtx;
+           std::condition_variable  waitCv;
+    };
+
+    using RingStatePtr        =  std::shared_ptr<RingState>;
+    using RingStates          =  std::vector<RingStatePtr>;
+
+    // Completed either by the callback or, for a batch, on the ring it came from. Only the
+    // health probes are bound to an upstream, and skip the cache.
+    struct EngineJob{
+           EngineQuery        query;
+           EngineCallback     done;
+           RingStatePtr       ring;
+           uint64_t           tag      { 0 };
+           size_t             upstream { ENGINE_ANY_UPSTREAM };
+    };
+
+    class EngineWorker;
+
+    // Wakes the worker of a cancelled query, which then finds it in its next expire().
+    struct CancelWaker{
+           EngineWorker*      worker;
+
+           void               operator()(void)                                         const    noexcept;
+    };
+
+    using CancelCallback      =  std::stop_callback<CancelWaker>;
+
+    // The flight is the one the query leads, if any; tcp carries the fallback of a truncated answer.
+    struct EngineSlot{
+           std::unique_ptr<dnsclient::DnsClient>  client;
+           std::unique_ptr<CancelCallback>        onCancel;
+           dnscache::FlightPtr                    flight;
+           std::unique_ptr<networkutils::SocketTcpAsync>  tcp;
+           EngineJob          job;
+           TimePoint          deadline,
+                              sentAt,
+                              attemptEnd,
+                              resendAt;
+           // Where the query went, and the server of the client, which refreshes what it serves stale.
+           size_t             upstream { 0 },
+                              server   { 0 },
+                              attempt  { 0 };
+           bool               busy     { false },
+                              sent     { false },
+                              lost     { false },
+                              uncached { false },
+                              backingOff { false };
+    };
+
+    // A query missing the cache while the same one is on the wire, of any worker or
+    // client: it waits for that answer without a slot, woken by the waiter of its flight.
+    struct ParkedJob{
+           EngineJob          job;
+           dnscache::FlightPtr  flight;
+           std::unique_ptr<CancelCallback>  onCancel;
+    };
+
+    using JobQueue            =  std::deque<EngineJob>;
+    using ParkedJobs          =  std::vector<ParkedJob>;
+    using EngineSlots         =  std::vector<EngineSlot>;
+    using FreeSlots           =  std::vector<size_t>;
+    using TcpSlots            =  std::vector<size_t>;
+    using InflightMap         =  std::unordered_map<uint16_t, size_t>;
+    using ResponseBuffer      =  std::array<uint8_t, networkutils::DNS_RESPONSE_SIZE>;
+    using WakePipe            =  std::array<int, 2>;
+    using AsyncSockets        =  std::vector<std::unique_ptr<networkutils::SocketUdpAsync>>;
+    using PollFds             =  std::vector<pollfd>;
+    using StalledSockets      =  std::vector<bool>;
+
+    class ResolverEngine;
+
+    // One per core: an event loop multiplexing its queries on sockets of its own, one per
+    // upstream and one per tcp fallback, with a client per query on the wire. The callbacks
+    // run on the loop, and must not block it.
+    class alignas(epochutils::CACHE_LINE_SIZE) EngineWorker{
+        public:
+                              EngineWorker(ResolverEngine& owner, size_t id)                    anyexcept;
+                              ~EngineWorker(void);
+
+           void               start(void)                                                       anyexcept;
+           void               stop(void)                                                        noexcept;
+           void               push(EngineJob&& job)                                             anyexcept;
+           size_t             steal(JobQueue& dest)                                             noexcept;
+           size_t             queued(void)                                             const    noexcept;
+           bool               isSleeping(void)                                         const    noexcept;
+           void               wake(void)                                                        noexcept;
+
+        private:
+           ResolverEngine&    engine;
+           size_t             workerId;
+           std::mutex         queueMtx;
+           JobQueue           queue;
+           std::atomic<size_t>  queueLen;
+           std::atomic<bool>  sleeping,
+                              stopping,
+                              landed;
+           WakePipe           wakePipe;
+           AsyncSockets       sockets;
+           PollFds            fds;
+           StalledSockets     stalled;
+           UpstreamOrder      order;
+           EngineSlots        slots;
+           FreeSlots          freeSlots;
+           TcpSlots           tcpSlots;
+           InflightMap        inflight;
+           ParkedJobs         parked;
+           size_t             unsent,
+                              sends;
+           TimePoint          throttledUntil;
+           ResponseBuffer     buffer;
+           std::thread        thread;
+
+           void               loop(void)                                                        noexcept;
+           void               fill(TimePoint now)                                               noexcept;
+           void               dispatch(EngineJob&& job, TimePoint now)                          noexcept;
+           void               flush(TimePoint now)                                              noexcept;
+           bool               reserve(size_t upstream, TimePoint now, TimePoint& retryAt)       noexcept;
+           bool               canSend(TimePoint now)                                   const    noexcept;
+           void               receive(size_t upstream)                                          noexcept;
+           void               transfer(size_t idx)                                              noexcept;
+           void               expire(TimePoint now)                                             noexcept;
+           bool               canRetry(const EngineSlot& slot, bool refused)           const    noexcept;
+           void               retry(EngineSlot& slot, dnsclient::QUERY_STATUS status,
+                                    uint8_t rcode, TimePoint now)                               noexcept;
+           int                pollTimeout(TimePoint now)                               const    noexcept;
+           void               settle(EngineSlot& slot, dnsclient::QUERY_STATUS status,
+                                     uint8_t rcode, TimePoint now)                              noexcept;
+           void               complete(size_t idx, const dnsclient::QueryResult& result)        noexcept;
+           void               park(size_t idx, dnscache::FlightPtr&& flight)                    noexcept;
+           void               land(TimePoint now)                                               noexcept;
+           void               follow(EngineJob&& job, const dnscache::FlightResult& res)        noexcept;
+           void               reject(EngineJob&& job, dnsclient::QUERY_STATUS status,
+                                     const std::string& reason)                                 noexcept;
+           void               shutdown(void)                                                    noexcept;
+
+                              EngineWorker(EngineWorker const&)                         = delete;
+                              EngineWorker(EngineWorker&&)                              = delete;
+           EngineWorker&      operator=(EngineWorker const&)                            = delete;
+           EngineWorker&      operator=(EngineWorker&&)                                 = delete;
+    };
+
+    using EngineWorkers       =  std::vector<std::unique_ptr<EngineWorker>>;
+
+    // co_await engine.query(name, RR_TYPES_AAAA): the coroutine is suspended while the query
+    // is on the wire and resumed with the answer on the worker loop that completed it, so
+    // what follows the co_await must not block. Any coroutine type of the caller will do.
+    class QueryAwaiter{
+        public:
+                              QueryAwaiter(ResolverEngine& owner, EngineQuery qry)              noexcept;
+
+           bool               await_ready(void)                                        const    noexcept;
+           void               await_suspend(std::coroutine_handle<> handle)                     anyexcept;
+           EngineAnswer       await_resume(void)                                                noexcept;
+
+        private:
+           ResolverEngine&    engine;
+           EngineQuery        query;
+           EngineAnswer       answer;
+
+                              QueryAwaiter(QueryAwaiter const&)                         = delete;
+                              QueryAwaiter(QueryAwaiter&&)                              = delete;
+           QueryAwaiter&      operator=(QueryAwaiter const&)                            = delete;
+           QueryAwaiter&      operator=(QueryAwaiter&&)                                 = delete;
+    };
+
+    // Thread per core resolver: queries are submitted from any thread and resolved by the
+    // workers, pinned one per core, each with its own socket, clients and job queue. New
+    // jobs are spread round robin, those submitted by a callback stay on its worker; a
+    // worker with free slots and nothing queued takes half the queue of the busiest one.
+    // The workers share nothing but the cache, whose lookups take no locks: splitting it
+    // per core would split its hit rate as well.
+    // With more upstreams, each query goes to the cheapest one in rotation with room in
+    // its window, the next ones take the overflow; a query in ENGINE_EXPLORE_EVERY tries
+    // another first. A thread probes the upstreams out of rotation every ENGINE_PROBE_MS;
+    // with all of them out, all are used.
+    // A query lost, or refused with other upstreams at hand, is sent again as the retry
+    // policy says, another upstream first: an attempt lasts timeoutMs or, when 0, the loss
+    // timeout of its upstream. The engine timeout, or deadlineMs, bounds the whole query;
+    // with a stale answer at hand, the stale timeout of the client does, as in RFC 8767.
+    // The misses of the same question share the flight of the clients sharing the cache:
+    // one goes upstream, the others wait for its answer without a slot.
+    class ResolverEngine{
+        public:
+           explicit           ResolverEngine(UpstreamList servers, size_t workersNo=0,
+                                             dnsclient::CachePtr cache=nullptr,
+                                             time_t timeoutSecs=ENGINE_TIMEOUT_SECS,
+                                             RateLimit rateLimit={},
+                                             WindowLimit windowLimit={},
+                                             dnsclient::RetryPolicy retryPolicy={})             anyexcept;
+           explicit           ResolverEngine(std::string server, size_t workersNo=0,
+                                             dnsclient::CachePtr cache=nullptr,
+                                             time_t timeoutSecs=ENGINE_TIMEOUT_SECS,
+                                             RateLimit rateLimit={},
+                                             WindowLimit windowLimit={},
+                                             dnsclient::RetryPolicy retryPolicy={})             anyexcept;
+                              ~ResolverEngine(void);
+
+           void               submit(EngineQuery query, EngineCallback done)                    anyexcept;
+           QueryAwaiter       query(std::string name, uint16_t qtype=dnsclient::RR_TYPES_A,
+                                    uint16_t qclass=dnsclient::CLASS_IN)                        noexcept;
+           QueryAwaiter       query(EngineQuery query)                                          noexcept;
+           size_t             getWorkersNo(void)                                       const    noexcept;
+           const std::string& getServer(void)                                          const    noexcept;
+           size_t             getUpstreamsNo(void)                                     const    noexcept;
+           UpstreamStatsList  getStats(void)                                           const    anyexcept;
+           time_t             getTimeoutSecs(void)                                     const    noexcept;
+           const dnsclient::RetryPolicy&  getRetryPolicy(void)                         const    noexcept;
+           const dnsclient::CachePtr&  getCache(void)                                  const    noexcept;
+           double             getWindow(size_t upstream=0)                             const    noexcept;
+
+        private:
+           Upstreams          upstreams;
+           dnsclient::CachePtr  cache;
+           time_t             timeoutSecs;
+           dnsclient::RetryPolicy  retryPolicy;
+           EngineWorkers      workers;
+           std::atomic<size_t>  nextWorker;
+
+           std::thread        prober;
+           std::mutex         probeMtx;
+           std::condition_variable  probeCv;
+           bool               probeStop;
+
+           std::shared_mutex  ringsMtx;
+           RingStates         rings;
+           std::atomic<size_t>  ringsNo,
+                              nextRing;
+
+           friend class EngineWorker;
+           friend class EngineRing;
+
+           bool               stealFor(size_t thief, JobQueue& dest)                            noexcept;
+           void               balance(size_t loaded)                                            noexcept;
+           void               attach(const RingStatePtr& ring)                                  anyexcept;
+           void               detach(const RingStatePtr& ring)                                  noexcept;
+           size_t             pullRings(size_t max, JobQueue& dest)                             noexcept;
+           bool               hasRingWork(void)                                                 noexcept;
+           void               wakeIdle(void)                                                    noexcept;
+           void               rank(UpstreamOrder& order)                               const    noexcept;
+           Clock::duration    queryBudget(void)                                        const    noexcept;
+           Clock::duration    attemptTimeout(const Upstream& upstream)                 const    noexcept;
+           void               probe(void)                                                       noexcept;
+
+                              ResolverEngine(ResolverEngine const&)                     = delete;
+                              ResolverEngine(ResolverEngine&&)                          = delete;
+           ResolverEngine&    operator=(ResolverEngine const&)                          = delete;
+           ResolverEngine&    operator=(ResolverEngine&&)                               = delete;
+    };
+
+    // Batch interface, for callers with thousands of names at once. submit() moves a batch
+    // into the lock free submission queue and wakes the idle workers once, not per query;
+    // the workers pull from it as their slots free up and push the answers in the
+    // completion queue, drained in bulk by reap(). No more than capacity() queries are
+    // submitted and not yet reaped, so that a completion always finds room. Any thread may
+    // submit, one at a time reaps. The ring must not outlive its engine.
+    class EngineRing{
+        public:
+           explicit           EngineRing(ResolverEngine& owner, size_t entries=ENGINE_RING_ENTRIES)  anyexcept;
+                              ~EngineRing(void);
+
+           size_t             submit(std::span<RingRequest> requests)                           noexcept;
+           size_t             reap(std::span<RingCompletion> dest, size_t waitFor=0,
+                                   int timeoutMs=-1)                                            noexcept;
+           size_t             pending(void)                                            const    noexcept;
+           size_t             capacity(void)                                           const    noexcept;
+
+        private:
+           ResolverEngine&    engine;
+           RingStatePtr       state;
+
+                              EngineRing(EngineRing const&)                             = delete;
+                              EngineRing(EngineRing&&)                                  = delete;
+           EngineRing&        operator=(EngineRing const&)                              = delete;
+           EngineRing&        operator=(EngineRing&&)                                   = delete;
+    };
+
+} // End Namespace
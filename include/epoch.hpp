@@ -0,0 +1,102 @@
+// -----------------------------------------------------------------
+// libdnsquery - a library to interrogate DNSs and more.
+// Copyright (C) 2018-2023  Gabriele Bonacini
+//
+// This program is free software for no profit use; you can redistribute 
+// it and/or modify it under the terms of the GNU General Public License 
+// as published by the Free Software Foundation; either version 2 of 
+// the License, or (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// A commercial license is also available for a lucrative use.
+// -----------------------------------------------------------------
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+#include <anyexcept.hpp>
+
+// Epoch based reclamation: readers announce the epoch they started in and never block,
+// writers unlink a shared object and retire it; the object is freed only when all
+// the readers that could have seen it are gone.
+
+namespace epochutils {
+
+    // Fixed instead of std::hardware_destructive_interference_size, which is not ABI stable.
+    constexpr size_t        CACHE_LINE_SIZE   =  64;
+    constexpr size_t        EPOCH_MAX_READERS =  256;
+    constexpr uint64_t      EPOCH_IDLE        =  UINT64_MAX;
+
+    struct alignas(CACHE_LINE_SIZE) ReaderSlot{
+           std::atomic<uint64_t>  epoch  { EPOCH_IDLE };
+           std::atomic<bool>      used   { false };
+    };
+
+    struct RetiredObject{
+           void*              ptr;
+           void               (*deleter)(void*);
+           uint64_t           epoch;
+    };
+
+    using ReaderSlots         =  std::array<ReaderSlot, EPOCH_MAX_READERS>;
+    using RetiredObjects      =  std::vector<RetiredObject>;
+
+    class EpochDomain{
+        public:
+                              ~EpochDomain(void);
+
+           static EpochDomain&  getInstance(void)                                                noexcept;
+
+           void               enter(void)                                                       noexcept;
+           void               leave(void)                                                       noexcept;
+
+           template<typename T>
+           void               retire(const T* ptr)                                              noexcept{
+                                  retireObject(const_cast<T*>(ptr), [](void* obj){ delete static_cast<T*>(obj); });
+                              }
+
+        private:
+           ReaderSlots                        slots;
+           alignas(CACHE_LINE_SIZE) std::atomic<uint64_t>  globalEpoch;
+           // Readers without a slot: while any is running nothing is freed.
+           alignas(CACHE_LINE_SIZE) std::atomic<size_t>    overflowReaders;
+           std::mutex                         retiredMtx;
+           RetiredObjects                     retired;
+
+                              EpochDomain(void)                                                 noexcept;
+
+           ReaderSlot*        acquireSlot(void)                                                 noexcept;
+           void               retireObject(void* ptr, void (*deleter)(void*))                   noexcept;
+           void               reclaim(void)                                                     noexcept;
+
+                              EpochDomain(EpochDomain const&)                           = delete;
+                              EpochDomain(EpochDomain&&)                                = delete;
+           EpochDomain&       operator=(EpochDomain const&)                             = delete;
+           EpochDomain&       operator=(EpochDomain&&)                                  = delete;
+    };
+
+    // Read-side critical section: the shared objects loaded while it lives stay valid.
+    class EpochGuard{
+        public:
+                              EpochGuard(void)                                                  noexcept;
+                              ~EpochGuard(void);
+
+        private:
+                              EpochGuard(EpochGuard const&)                             = delete;
+                              EpochGuard(EpochGuard&&)                                  = delete;
+           EpochGuard&        operator=(EpochGuard const&)                              = delete;
+           EpochGuard&        operator=(EpochGuard&&)                                   = delete;
+    };
+
+} // End Namespace
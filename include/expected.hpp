@@ -0,0 +1,64 @@
+// -----------------------------------------------------------------
+// libdnsquery - a library to interrogate DNSs and more.
+// Copyright (C) 2018-2023  Gabriele Bonacini
+//
+// This program is free software for no profit use; you can redistribute 
+// it and/or modify it under the terms of the GNU General Public License 
+// as published by the Free Software Foundation; either version 2 of 
+// the License, or (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// A commercial license is also available for a lucrative use.
+// -----------------------------------------------------------------
+
+#pragma once
+
+#include <utility>
+#include <variant>
+
+// A reduced std::expected (C++23) for the C++20 builds: a value or an error, never an exception.
+
+namespace expectedutils {
+
+    template<typename E>
+    class Unexpected{
+        public:
+           explicit constexpr  Unexpected(E err)                                       noexcept
+                               : errValue{std::move(err)}
+                               {}
+           constexpr const E&  error(void)                                    const    noexcept { return errValue; }
+
+        private:
+           E                   errValue;
+    };
+
+    template<typename T, typename E>
+    class Expected{
+        public:
+           constexpr           Expected(T val)                                         noexcept
+                               : content{std::in_place_index<0>, std::move(val)}
+                               {}
+           constexpr           Expected(Unexpected<E> err)                             noexcept
+                               : content{std::in_place_index<1>, err.error()}
+                               {}
+
+           constexpr bool      has_value(void)                                    const    noexcept { return content.index() == 0; }
+           constexpr explicit  operator bool(void)                            const    noexcept { return has_value(); }
+
+           constexpr const T&  value(void)                                    const    noexcept { return *std::get_if<0>(&content); }
+           constexpr T&        value(void)                                             noexcept { return *std::get_if<0>(&content); }
+           constexpr const E&  error(void)                                    const    noexcept { return *std::get_if<1>(&content); }
+
+           constexpr const T&  operator*(void)                                const    noexcept { return value(); }
+           constexpr const T*  operator->(void)                               const    noexcept { return &value(); }
+
+        private:
+           std::variant<T, E>  content;
+    };
+
+} // End Namespace
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <signal.h>
 
 #include <cstdint>
@@ -30,6 +31,7 @@
 #include <memory>
 #include <chrono>
 #include <atomic>
+#include <span>
 
 #include <anyexcept.hpp>
 #include <trace.hpp>
@@ -56,15 +58,25 @@ namespace networkutils{
     using TimePoint           =  std::chrono::time_point<std::chrono::system_clock>;
     using DurationTime        =  std::chrono::duration<double>;
     using Timeval             =  struct timeval;
+    using Iovec               =  struct iovec;
+    using Msghdr              =  struct msghdr;
+
+    enum class SOCK_STATUS    {  SOCK_OK,           SOCK_TIMEOUT,      SOCK_ERROR };
 
     class Socket{
         public:
             virtual void        sendMsg(const Buffer& query, 
                                         Response& response)                   anyexcept = 0 ;
+            virtual void        sendMsgv(const Iovec* segments, size_t segmentsNo,
+                                         Response& response)                  anyexcept;
+            virtual SOCK_STATUS trySendMsgv(const Iovec* segments, size_t segmentsNo,
+                                            Response& response)               noexcept;
 
             virtual void        setTimeoutSecs(time_t tou)                    noexcept;
+            void                setTimeoutMs(uint32_t tou)                    noexcept;
             bool                isTimeout(void)                      const    noexcept;
             const std::string&  getWarningMsg(void)                  const    noexcept;
+            const std::string&  getErrorMsg(void)                    const    noexcept;
             double              getElapsedTime(void)                 const    noexcept;
             ssize_t             getRecvLen(void)                     const    noexcept;
 
@@ -76,17 +88,22 @@ namespace networkutils{
             socklen_t                len;
             ssize_t                  rcvResp;
             Timeval                  timeout_sec;
-            static std::atomic_bool  sigpipeOn;  
-            std::string              wrnMsg;
+            mutable std::string      wrnMsg,
+                                     errMsg;
+            mutable const char*      wrnText;
+            mutable const char*      errText;
+            int                      errNo;
             bool                     timeExc,
                                      signalExit;
             TimePoint                start,
                                      end;
             DurationTime             elapsed_seconds;
             fd_set                   sockSet;
-            Sigaction                sigActionPipe;
 
             explicit           Socket(ServerId hst);
+
+            SOCK_STATUS        setError(const char* text, int err)          noexcept;
+            void               raiseOnError(SOCK_STATUS status)    const    anyexcept;
     };
 
     enum class SocketTypes    {  UdpSocket,         UdpSocketVerbose,  UdpSocketPing,
@@ -95,28 +112,26 @@ namespace networkutils{
                                  TcpSocket,         TcpSocketVerbose
                               };
 
-    using SocketCreatorFx     =  std::function<std::unique_ptr<Socket>(void)>;
+    using SocketCreatorFx     =  std::function<std::unique_ptr<Socket>(const ServerId&, const std::string&)>;
     using CreatorsMap         =  std::map<SocketTypes, SocketCreatorFx>;
 
+    // Stateless once built: any thread can create sockets for any server through it.
     class SocketCreator{
         public:
-            static SocketCreator&    getInstance(ServerId   hst  = "",
-                                        const std::string&  sp   = "",
-                                        time_t              tout = 3)   anyexcept;
-            std::unique_ptr<Socket>  createSocket(SocketTypes stype)    anyexcept;
+            static const SocketCreator&  getInstance(void)                      anyexcept;
+            std::unique_ptr<Socket>  createSocket(SocketTypes stype,
+                                                  const ServerId& hst,
+                                                  const std::string& sp,
+                                                  time_t tout)          const   anyexcept;
 
         private:
-            explicit SocketCreator(ServerId hst,   const std::string&  sp,
-                                   time_t   tou);
+            SocketCreator(void);
 
             SocketCreator(SocketCreator const&)                         = delete;             
             SocketCreator(SocketCreator&&)                              = delete;                  
             SocketCreator& operator=(SocketCreator const&)              = delete; 
             SocketCreator& operator=(SocketCreator &&)                  = delete; 
 
-            ServerId     servername;
-            time_t       timeoutSecs;
-            std::string  spoofing;
             CreatorsMap  creatorsMap;
     };
 
@@ -127,6 +142,10 @@ namespace networkutils{
 
             void sendMsg(const Buffer& query,
                          Response& response)                             anyexcept override;
+            void sendMsgv(const Iovec* segments, size_t segmentsNo,
+                          Response& response)                            anyexcept override;
+            SOCK_STATUS trySendMsgv(const Iovec* segments, size_t segmentsNo,
+                                    Response& response)                  noexcept  override;
 
             void setCloseOnError(bool)                                   noexcept;
 
@@ -161,17 +180,82 @@ namespace networkutils{
 
             void sendMsg(const Buffer& query,
                          Response& response)                             anyexcept override;
+            void sendMsgv(const Iovec* segments, size_t segmentsNo,
+                          Response& response)                            anyexcept override;
+            SOCK_STATUS trySendMsgv(const Iovec* segments, size_t segmentsNo,
+                                    Response& response)                  noexcept  override;
         protected:
             SockaddrIn               sv;
             Response                 tcpBuffer;
     };
 
+    // Connected and non blocking, for event loops multiplexing many queries on one socket:
+    // nothing here waits, the owner polls getFd(). A full send buffer is reported as
+    // SOCK_TIMEOUT, an empty receive queue as 0 bytes read.
+    class SocketUdpAsync{
+        public:
+            explicit SocketUdpAsync(ServerId hst);
+            ~SocketUdpAsync(void);
+
+            int                 getFd(void)                                   const    noexcept;
+            SOCK_STATUS         trySend(const Iovec* segments,
+                                        size_t segmentsNo)                             noexcept;
+            ssize_t             tryRecv(uint8_t* buffer, size_t size)                  noexcept;
+            const std::string&  getErrorMsg(void)                             const    noexcept;
+
+        private:
+            int              fd;
+            SockaddrIn       sv;
+            std::string      errMsg;
+
+            SocketUdpAsync(SocketUdpAsync const&)                        = delete;
+            SocketUdpAsync(SocketUdpAsync&&)                             = delete;
+            SocketUdpAsync& operator=(SocketUdpAsync const&)             = delete;
+            SocketUdpAsync& operator=(SocketUdpAsync&&)                  = delete;
+    };
+
+    // A query on tcp for the same event loops: the connect starts with the socket, then the
+    // owner polls getFd(), for writing while wantsWrite(), and calls advance() on its events.
+    // SOCK_TIMEOUT means not done yet, SOCK_OK that getResponse() holds the whole payload.
+    class SocketTcpAsync{
+        public:
+            SocketTcpAsync(ServerId hst, const Iovec* segments, size_t segmentsNo);
+            ~SocketTcpAsync(void);
+
+            int                 getFd(void)                                   const    noexcept;
+            bool                wantsWrite(void)                              const    noexcept;
+            SOCK_STATUS         advance(void)                                          noexcept;
+            std::span<const uint8_t>  getResponse(void)                       const    noexcept;
+            const std::string&  getErrorMsg(void)                             const    noexcept;
+
+        private:
+            int              fd;
+            SockaddrIn       sv;
+            Buffer           query;
+            Response         tcpBuffer;
+            size_t           sentLen,
+                             recvLen;
+            bool             connected;
+            std::string      errMsg;
+
+            SOCK_STATUS      setError(const char* text, int err)                   noexcept;
+
+            SocketTcpAsync(SocketTcpAsync const&)                        = delete;
+            SocketTcpAsync(SocketTcpAsync&&)                             = delete;
+            SocketTcpAsync& operator=(SocketTcpAsync const&)             = delete;
+            SocketTcpAsync& operator=(SocketTcpAsync&&)                  = delete;
+    };
+
     class SocketUdpVerbose : public SocketUdp {
         public:
             explicit SocketUdpVerbose(ServerId hst);
 
             void sendMsg(const Buffer& query,
                          Response& response)                             anyexcept override final;
+            void sendMsgv(const Iovec* segments, size_t segmentsNo,
+                          Response& response)                            anyexcept override final;
+            SOCK_STATUS trySendMsgv(const Iovec* segments, size_t segmentsNo,
+                                    Response& response)                  noexcept  override final;
     };
 
     class SocketUdpPing : public SocketUdp{
@@ -180,13 +264,15 @@ namespace networkutils{
 
             void sendMsg(const Buffer& query,
                          Response& response)                             anyexcept override final;
+            void sendMsgv(const Iovec* segments, size_t segmentsNo,
+                          Response& response)                            anyexcept override final;
+            SOCK_STATUS trySendMsgv(const Iovec* segments, size_t segmentsNo,
+                                    Response& response)                  noexcept  override final;
     };
 
-    using Msghdr=struct msghdr;
     using IcmpBuff=std::array<uint8_t, DNS_BUFF_SIZE>;
 
     using SockaddrStorage=struct sockaddr_storage;
-    using Iovec=struct iovec;
     using Cmsghdr=struct cmsghdr;
     using Icmphdr=struct icmphdr;
     using SockExtendedErr=struct sock_extended_err;
@@ -232,6 +318,10 @@ namespace networkutils{
 
             void sendMsg(const Buffer& query,
                          Response& response)                             anyexcept override final;
+            void sendMsgv(const Iovec* segments, size_t segmentsNo,
+                          Response& response)                            anyexcept override final;
+            SOCK_STATUS trySendMsgv(const Iovec* segments, size_t segmentsNo,
+                                    Response& response)                  noexcept  override final;
     };
 
 } // End Namespace
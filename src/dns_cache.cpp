@@ -0,0 +1,1045 @@
+// -----------------------------------------------------------------
+// libdnsquery - a library to interrogate DNSs and more.
+// Copyright (C) 2018-2023  Gabriele Bonacini
+//
+// This program is free software for no profit use; you can redistribute 
+// it and/or modify it under the terms of the GNU General Public License 
+// as published by the Free Software Foundation; either version 2 of 
+// the License, or (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// A commercial license is also available for a lucrative use.
+// -----------------------------------------------------------------
+
+#include <dns_cache.hpp>
+#include <dns_cache_snapshot.hpp>
+
+#include <algorithm>
+#include <bit>
+#include <limits>
+#include <charconv>
+#include <unordered_set>
+#include <map>
+
+namespace dnscache{
+
+    using std::string,
+          std::string_view,
+          std::get,
+          std::lock_guard,
+          std::mutex,
+          std::memory_order_relaxed,
+          std::memory_order_acquire,
+          std::memory_order_release,
+          std::memory_order_seq_cst,
+          std::unique_lock,
+          std::thread,
+          std::span,
+          std::min,
+          std::numeric_limits,
+          std::from_chars,
+          std::chrono::seconds,
+          std::chrono::duration_cast,
+          epochutils::EpochDomain,
+          epochutils::EpochGuard,
+          dnsclient::ParsedResponse,
+          dnsclient::PARSED_RESP_NAME_IDX,
+          dnsclient::PARSED_RESP_TYPE_IDX,
+          dnsclient::PARSED_RESP_CLASS_IDX,
+          dnsclient::PARSED_RESP_TTL_IDX,
+          dnsclient::PARSED_RESP_LEN_IDX,
+          dnsclient::PARSED_RESP_DATA_IDX,
+          dnsclient::RR_TYPES_NULL,
+          dnsclient::RR_TYPES_NS,
+          dnsclient::RR_TYPES_CNAME,
+          dnsclient::RR_TYPES_SOA;
+
+    namespace {
+
+        template<typename T>
+        T  readWire(span<const uint8_t> wire, size_t idx) noexcept{
+            T  value  { 0 };
+            for(size_t byte { 0 }; byte < sizeof(T); ++byte)
+                value  =  static_cast<T>(value << 8 | wire[idx + byte]);
+            return value;
+        }
+
+        template<typename T>
+        void  writeWire(span<uint8_t> wire, size_t idx, T value) noexcept{
+            for(size_t byte { sizeof(T) }; byte > 0; --byte){
+                wire[idx + byte - 1]  =  static_cast<uint8_t>(value & 0xff);
+                value                 =  static_cast<T>(value >> 8);
+            }
+        }
+
+        string  normalized(string_view name){
+            if(!name.empty() && name.back() == '.')
+                name.remove_suffix(1);
+            string  norm  { name };
+            for(char& chr : norm)
+                chr  =  (chr >= 'A' && chr <= 'Z') ? static_cast<char>(chr - 'A' + 'a') : chr;
+            return norm;
+        }
+
+        bool  isSubdomain(string_view name, string_view zone) noexcept{
+            return !zone.empty() && name.ends_with(zone) &&
+                   (name.size() == zone.size() || name[name.size() - zone.size() - 1] == '.');
+        }
+
+    } // End Anonymous Namespace
+
+    CacheKey::CacheKey(string_view name, uint16_t qtype, uint16_t qclass) noexcept
+        : buffer{}, length{0}
+    {
+        if(!name.empty() && name.back() == '.')
+            name.remove_suffix(1);
+        if(name.empty() || name.size() > dnsclient::DNS_MAX_DOMAIN_SIZE)
+            return;
+
+        for(const char chr : name)
+            buffer[length++]  =  (chr >= 'A' && chr <= 'Z') ? static_cast<char>(chr - 'A' + 'a') : chr;
+
+        buffer[length++]  =  static_cast<char>(qtype  >> 8);
+        buffer[length++]  =  static_cast<char>(qtype  & 0xff);
+        buffer[length++]  =  static_cast<char>(qclass >> 8);
+        buffer[length++]  =  static_cast<char>(qclass & 0xff);
+    }
+
+    bool  CacheKey::isValid(void) const noexcept{
+        return length != 0;
+    }
+
+    string_view  CacheKey::view(void) const noexcept{
+        return { buffer.data(), length };
+    }
+
+    string_view  CacheKey::name(void) const noexcept{
+        return isValid() ? string_view(buffer.data(), length - 2 * sizeof(uint16_t)) : string_view();
+    }
+
+    CacheKey  CacheKey::parent(void) const noexcept{
+        // The same question for the name without its first label, invalid past the top level.
+        CacheKey      other  { *this };
+        const size_t  dot    { name().find('.') };
+        if(dot == string_view::npos){
+            other.length  =  0;
+            return other;
+        }
+
+        std::copy(buffer.begin() + static_cast<ptrdiff_t>(dot + 1), buffer.begin() + static_cast<ptrdiff_t>(length),
+                  other.buffer.begin());
+        other.length  =  length - dot - 1;
+        return other;
+    }
+
+    CacheKey  CacheKey::withType(uint16_t qtype) const noexcept{
+        CacheKey  other  { *this };
+        if(other.isValid()){
+            other.buffer[length - 4]  =  static_cast<char>(qtype >> 8);
+            other.buffer[length - 3]  =  static_cast<char>(qtype & 0xff);
+        }
+        return other;
+    }
+
+    size_t  CacheKeyHash::operator()(string_view key) const noexcept{
+        return std::hash<string_view>{}(key);
+    }
+
+    void  Flight::complete(FlightResult&& res) noexcept{
+        {
+            // The waiters are told under the lock: once unpark() returns, nothing calls theirs.
+            lock_guard<mutex>   lock { flightMtx };
+            result  =  std::move(res);
+            done    =  true;
+            for(const auto& waiter : waiters)
+                waiter.notify();
+            waiters.clear();
+        }
+        flightCv.notify_all();
+    }
+
+    const FlightResult&  Flight::wait(void) noexcept{
+        unique_lock<mutex>  lock { flightMtx };
+        flightCv.wait(lock, [this]{ return done; });
+        return result;
+    }
+
+    bool  Flight::park(FlightWaiter&& waiter) anyexcept{
+        lock_guard<mutex>   lock { flightMtx };
+        if(done)
+            return false;
+
+        waiters.push_back(std::move(waiter));
+        return true;
+    }
+
+    void  Flight::unpark(const void* owner) noexcept{
+        lock_guard<mutex>   lock { flightMtx };
+        if(const auto waiter { std::find_if(waiters.begin(), waiters.end(),
+                                            [owner](const FlightWaiter& item){ return item.owner == owner; }) };
+           waiter != waiters.end())
+            waiters.erase(waiter);
+    }
+
+    bool  Flight::isDone(void) const noexcept{
+        lock_guard<mutex>   lock { flightMtx };
+        return done;
+    }
+
+    DnsCache::DnsCache(uint32_t maxt, size_t maxe, uint32_t maxn, size_t maxb)
+        :  shards{},
+           maxTtl{maxt},
+           shardEntries{std::max<size_t>(1, (maxe + DNS_CACHE_SHARDS - 1) / DNS_CACHE_SHARDS)},
+           shardBytes{maxb / DNS_CACHE_SHARDS},
+           maxNegTtl{maxn},
+           staleWindow{0},
+           wireFormat{false},
+           prefetchOn{false},
+           prefetchFraction{DNS_CACHE_PREFETCH_FRACTION},
+           prefetchHits{DNS_CACHE_PREFETCH_HITS},
+           prefetchMtx{},
+           prefetchServer{},
+           prefetchTimeout{3},
+           prefetchStop{false},
+           prefetchQueue{},
+           prefetchCv{},
+           prefetchThread{},
+           snapshot{nullptr},
+           snapshotMtx{},
+           snapshotPath{},
+           snapshotInterval{0},
+           snapshotStop{false},
+           snapshotCv{},
+           snapshotThread{}
+    {
+        // As many buckets as the entries a shard can hold, by number or by memory.
+        const size_t  bucketsNo  { std::bit_ceil(std::max<size_t>(1, min(shardEntries, shardBytes / sizeof(CacheEntry)))) };
+        for(auto& shard : shards){
+            shard.buckets    =  std::make_unique<std::atomic<const CacheBucket*>[]>(bucketsNo);
+            shard.bucketsNo  =  bucketsNo;
+        }
+    }
+
+    DnsCache::~DnsCache(void){
+        stopPrefetchThread();
+        disableSnapshots();
+        for(auto& shard : shards)
+            for(size_t idx { 0 }; idx < shard.bucketsNo; ++idx)
+                delete shard.buckets[idx].load(memory_order_relaxed);
+        delete snapshot.load(memory_order_relaxed);
+    }
+
+    CacheShard&  DnsCache::shardOf(string_view key) noexcept{
+        // The low bits pick the bucket inside the shard.
+        return shards[(CacheKeyHash{}(key) >> 24) % DNS_CACHE_SHARDS];
+    }
+
+    const CacheShard&  DnsCache::shardOf(string_view key) const noexcept{
+        return shards[(CacheKeyHash{}(key) >> 24) % DNS_CACHE_SHARDS];
+    }
+
+    std::atomic<const CacheBucket*>&  DnsCache::bucketOf(string_view key) const noexcept{
+        const size_t       hash   { CacheKeyHash{}(key) };
+        const CacheShard&  shard  { shards[(hash >> 24) % DNS_CACHE_SHARDS] };
+        return shard.buckets[hash & (shard.bucketsNo - 1)];
+    }
+
+    const CacheEntry*  DnsCache::acquire(const CacheKey& key, TimePoint now, bool stale, bool wire,
+                                         EntryPtr& restored, bool& cut, string_view server) anyexcept{
+        // Must run inside an EpochGuard, like find().
+        const CacheKey      wildcard  { key.withType(RR_TYPES_NULL) };
+        const CacheEntry*   entry     { stale ? findStale(key.view(), now) : find(key.view(), now) };
+        string_view         found     { key.view() };
+
+        // A NXDOMAIN denies the name itself, whatever the type asked for.
+        if(entry == nullptr){
+            entry  =  stale ? findStale(wildcard.view(), now) : find(wildcard.view(), now);
+            found  =  wildcard.view();
+        }
+        if(entry == nullptr && !stale){
+            if((restored = restore(key.view())))
+                found  =  key.view();
+            else if((restored = restore(wildcard.view())))
+                found  =  wildcard.view();
+            entry  =  restored.get();
+        }
+
+        // RFC 8020: nothing exists below a NXDOMAIN, the closest denied ancestor answers.
+        // Not in wire format, whose response would still carry the question of the ancestor.
+        CacheKey  ancestor  { wildcard.parent() };
+        cut  =  false;
+        while(entry == nullptr && !wire && ancestor.isValid()){
+            entry  =  stale ? findStale(ancestor.view(), now) : find(ancestor.view(), now);
+            if(entry == nullptr && !stale)
+                entry  =  (restored = restore(ancestor.view())).get();
+            if(entry != nullptr && entry->rcode == DNS_RCODE_NXDOMAIN){
+                cut       =  true;
+                found     =  ancestor.view();
+            }else{
+                entry     =  nullptr;
+                ancestor  =  ancestor.parent();
+            }
+        }
+
+        // Each lookup serves its own storage format only.
+        if(entry != nullptr && entry->wire.empty() == wire)
+            entry  =  nullptr;
+
+        CacheShard&  shard  { shardOf(key.view()) };
+        if(entry == nullptr){
+            if(!stale)
+                shard.misses.fetch_add(1, memory_order_relaxed);
+            return nullptr;
+        }
+
+        shard.hits.fetch_add(1, memory_order_relaxed);
+        if(!entry->referenced.load(memory_order_relaxed))
+            entry->referenced.store(true, memory_order_relaxed);
+        if(stale){
+            // A question for the type wildcard would be answered, and cached, as NODATA.
+            const string_view  view   { key.view() };
+            const auto         qtype  { static_cast<uint16_t>(static_cast<uint8_t>(view[view.size() - 4]) << 8 |
+                                                              static_cast<uint8_t>(view[view.size() - 3])) };
+            scheduleRefresh(cut ? ancestor.withType(qtype).view() : view, found, *entry, server);
+        }else
+            checkPrefetch(found, *entry, now);
+
+        return entry;
+    }
+
+    bool  DnsCache::lookup(const CacheKey& key, ParsedResponse& dest, string& queryTxt, uint8_t& rcode) anyexcept{
+        if(!key.isValid())
+            return false;
+
+        const TimePoint     now    { Clock::now() };
+        const EpochGuard    guard;
+        EntryPtr            restored;
+        bool                cut    { false };
+        const CacheEntry*   entry  { acquire(key, now, false, false, restored, cut) };
+        if(entry == nullptr)
+            return false;
+
+        const auto  aged  { static_cast<uint32_t>(duration_cast<seconds>(now - entry->stored).count()) };
+        for(const auto& rec : entry->records)
+            dest.emplace_back(string_view(rec.name), rec.type, rec.classid, rec.ttl > aged ? rec.ttl - aged : 0,
+                              rec.len, string_view(rec.data));
+        queryTxt.assign(cut ? key.name() : string_view(entry->queryTxt));
+        rcode  =  entry->rcode;
+
+        return true;
+    }
+
+    bool  DnsCache::lookupStale(const CacheKey& key, ParsedResponse& dest, string& queryTxt, uint8_t& rcode,
+                                string_view server) anyexcept{
+        if(!key.isValid())
+            return false;
+
+        const TimePoint     now    { Clock::now() };
+        const EpochGuard    guard;
+        EntryPtr            restored;
+        bool                cut    { false };
+        const CacheEntry*   entry  { acquire(key, now, true, false, restored, cut, server) };
+        if(entry == nullptr)
+            return false;
+
+        for(const auto& rec : entry->records)
+            dest.emplace_back(string_view(rec.name), rec.type, rec.classid, min(rec.ttl, DNS_CACHE_STALE_TTL),
+                              rec.len, string_view(rec.data));
+        queryTxt.assign(cut ? key.name() : string_view(entry->queryTxt));
+        rcode  =  entry->rcode;
+
+        return true;
+    }
+
+    bool  DnsCache::lookupWire(const CacheKey& key, WireResponse& dest, uint16_t id, bool stale,
+                               string_view server) anyexcept{
+        if(!key.isValid())
+            return false;
+
+        const TimePoint     now    { Clock::now() };
+        const EpochGuard    guard;
+        EntryPtr            restored;
+        bool                cut    { false };
+        const CacheEntry*   entry  { acquire(key, now, stale, true, restored, cut, server) };
+        if(entry == nullptr)
+            return false;
+
+        // Sized to the entry: a tcp or large udp response is replayed as it came.
+        dest.assign(entry->wire.begin(), entry->wire.end());
+        writeWire<uint16_t>(dest, 0, id);
+        // A NXDOMAIN stored under the wildcard key is replayed for the type asked for.
+        const string_view  keyView  { key.view() };
+        dest[entry->qtypeOffset]      =  static_cast<uint8_t>(keyView[keyView.size() - 4]);
+        dest[entry->qtypeOffset + 1]  =  static_cast<uint8_t>(keyView[keyView.size() - 3]);
+
+        const auto  aged  { static_cast<uint32_t>(duration_cast<seconds>(now - entry->stored).count()) };
+        for(const uint16_t offset : entry->ttlOffsets){
+            const uint32_t  ttl  { readWire<uint32_t>(dest, offset) };
+            writeWire<uint32_t>(dest, offset, stale ? min(ttl, DNS_CACHE_STALE_TTL) : (ttl > aged ? ttl - aged : 0));
+        }
+
+        return true;
+    }
+
+    bool  DnsCache::hasStale(const CacheKey& key) const noexcept{
+        if(!key.isValid() || staleWindow.load(memory_order_relaxed) == 0)
+            return false;
+
+        const TimePoint     now    { Clock::now() };
+        const EpochGuard    guard;
+        return findStale(key.view(), now) != nullptr || findStale(key.withType(RR_TYPES_NULL).view(), now) != nullptr;
+    }
+
+    void  DnsCache::store(const CacheKey& key, const ParsedResponse& records, const string& queryTxt,
+                          uint8_t rcode, size_t answersNo, span<const uint8_t> wire) anyexcept{
+        const bool  nxdomain  { rcode == DNS_RCODE_NXDOMAIN },
+                    negative  { nxdomain || (rcode == 0 && answersNo == 0) };
+
+        if(!key.isValid() || records.empty() || (rcode != 0 && !nxdomain))
+            return;
+
+        auto            entry   { std::make_shared<CacheEntry>() };
+        entry->queryTxt  =  queryTxt;
+        entry->stored    =  Clock::now();
+        entry->rcode     =  rcode;
+        entry->negative  =  negative;
+        entry->trust     =  answerTrust(wire);
+        if(wireFormat.load(memory_order_relaxed) && !wire.empty()){
+            entry->wire.assign(wire.begin(), wire.end());
+            if(!wireLayout(entry->wire, entry->ttlOffsets, entry->qtypeOffset))
+                entry->wire.clear();
+        }
+
+        const uint32_t  ttlCap  { negative ? min(negativeTtl(records), maxNegTtl.load(memory_order_relaxed))
+                                           : maxTtl.load(memory_order_relaxed) };
+        uint32_t        minTtl  { numeric_limits<uint32_t>::max() };
+        entry->records.reserve(records.size());
+        for(const auto& rec : records){
+            // Placeholders for answers without records carry nothing to cache.
+            if(get<PARSED_RESP_TYPE_IDX>(rec) == RR_TYPES_NULL)
+                return;
+
+            const uint32_t  ttl  { min(get<PARSED_RESP_TTL_IDX>(rec), ttlCap) };
+            minTtl  =  min(minTtl, ttl);
+            if(!entry->wire.empty())
+                continue;
+            entry->records.push_back({ string(get<PARSED_RESP_NAME_IDX>(rec)),  get<PARSED_RESP_TYPE_IDX>(rec),
+                                       get<PARSED_RESP_CLASS_IDX>(rec),         ttl,
+                                       get<PARSED_RESP_LEN_IDX>(rec),           string(get<PARSED_RESP_DATA_IDX>(rec)) });
+        }
+
+        if(minTtl == 0)
+            return;
+        entry->expiry  =  entry->stored + seconds(negative ? ttlCap : minTtl);
+        for(const uint16_t offset : entry->ttlOffsets)
+            writeWire<uint32_t>(entry->wire, offset, min(readWire<uint32_t>(entry->wire, offset), ttlCap));
+
+        insert(nxdomain ? key.withType(RR_TYPES_NULL).view() : key.view(), std::move(entry));
+    }
+
+    void  DnsCache::harvest(const CacheKey& key, const ParsedResponse& records, size_t answersNo,
+                            const ParsedResponse& additional, span<const uint8_t> wire) anyexcept{
+        // Harvested entries are records, replayed in the records format only.
+        if(!key.isValid() || wireFormat.load(memory_order_relaxed))
+            return;
+        const uint8_t       rcode    { static_cast<uint8_t>(wire.size() > dnsclient::DNS_RCODE_IDX
+                                                            ? wire[dnsclient::DNS_RCODE_IDX] & dnsclient::DNS_RET.back() : 0) };
+        if(rcode != 0 && rcode != DNS_RCODE_NXDOMAIN)
+            return;
+
+        const string_view   keyView  { key.view() };
+        const uint16_t      qclass   { static_cast<uint16_t>(static_cast<uint8_t>(keyView[keyView.size() - 2]) << 8 |
+                                                             static_cast<uint8_t>(keyView[keyView.size() - 1])) };
+        const string        qname    { key.name() };
+        const CacheTrust    trust    { answerTrust(wire) };
+        answersNo  =  min(answersNo, records.size());
+
+        // The CNAME chain starting from the name asked for, in whatever order it comes.
+        std::unordered_set<string>  chain  { qname };
+        for(bool grown { true }; grown; ){
+            grown  =  false;
+            for(size_t idx { 0 }; idx < answersNo; ++idx)
+                if(get<PARSED_RESP_TYPE_IDX>(records[idx]) == RR_TYPES_CNAME &&
+                   chain.contains(normalized(get<PARSED_RESP_NAME_IDX>(records[idx]))))
+                    grown  =  chain.insert(normalized(get<PARSED_RESP_DATA_IDX>(records[idx]))).second || grown;
+        }
+
+        using Group   =  std::pair<CacheTrust, std::vector<const dnsclient::ParsedRespRecord*>>;
+        std::map<std::pair<string, uint16_t>, Group>  groups;
+        const auto  collect  { [&](const dnsclient::ParsedRespRecord& rec, string&& owner, CacheTrust rank){
+                                   const uint16_t  type  { get<PARSED_RESP_TYPE_IDX>(rec) };
+                                   if(type == RR_TYPES_NULL || get<PARSED_RESP_CLASS_IDX>(rec) != qclass)
+                                       return;
+                                   Group&  group  { groups[{ std::move(owner), type }] };
+                                   group.first  =  rank;
+                                   group.second.push_back(&rec);
+                               } };
+
+        // NS records are in bailiwick for the zones containing a name of the chain, their
+        // addresses only when the name server itself sits in that zone.
+        std::unordered_set<string>  servers;
+        for(size_t idx { 0 }; idx < records.size(); ++idx){
+            const auto&  rec    { records[idx] };
+            string       owner  { normalized(get<PARSED_RESP_NAME_IDX>(rec)) };
+            if(idx < answersNo && chain.contains(owner)){
+                if(get<PARSED_RESP_TYPE_IDX>(rec) == RR_TYPES_NS)
+                    if(string server { normalized(get<PARSED_RESP_DATA_IDX>(rec)) }; isSubdomain(server, owner))
+                        servers.insert(std::move(server));
+                collect(rec, std::move(owner), trust);
+                continue;
+            }
+            if(idx < answersNo || get<PARSED_RESP_TYPE_IDX>(rec) != RR_TYPES_NS ||
+               std::none_of(chain.begin(), chain.end(), [&owner](const string& name){ return isSubdomain(name, owner); }))
+                continue;
+            if(string server { normalized(get<PARSED_RESP_DATA_IDX>(rec)) }; isSubdomain(server, owner))
+                servers.insert(std::move(server));
+            collect(rec, std::move(owner), CacheTrust::AUTHORITY);
+        }
+        for(const auto& rec : additional){
+            const uint16_t  type   { get<PARSED_RESP_TYPE_IDX>(rec) };
+            string          owner  { normalized(get<PARSED_RESP_NAME_IDX>(rec)) };
+            if((type == dnsclient::RR_TYPES_A || type == dnsclient::RR_TYPES_AAAA) && servers.contains(owner))
+                collect(rec, std::move(owner), CacheTrust::ADDITIONAL);
+        }
+
+        const TimePoint  now     { Clock::now() };
+        const uint32_t   ttlCap  { maxTtl.load(memory_order_relaxed) };
+        for(const auto& [id, group] : groups){
+            const CacheKey  groupKey  { id.first, id.second, qclass };
+            // Already stored as the answer to the question itself.
+            if(!groupKey.isValid() || groupKey.view() == keyView)
+                continue;
+
+            auto      entry   { std::make_shared<CacheEntry>() };
+            uint32_t  minTtl  { numeric_limits<uint32_t>::max() };
+            entry->queryTxt  =  get<PARSED_RESP_NAME_IDX>(*group.second.front());
+            entry->stored    =  now;
+            entry->rcode     =  0;
+            entry->negative  =  false;
+            entry->trust     =  group.first;
+            entry->records.reserve(group.second.size());
+            for(const auto* rec : group.second){
+                const uint32_t  ttl  { min(get<PARSED_RESP_TTL_IDX>(*rec), ttlCap) };
+                minTtl  =  min(minTtl, ttl);
+                entry->records.push_back({ string(get<PARSED_RESP_NAME_IDX>(*rec)),  get<PARSED_RESP_TYPE_IDX>(*rec),
+                                           get<PARSED_RESP_CLASS_IDX>(*rec),         ttl,
+                                           get<PARSED_RESP_LEN_IDX>(*rec),           string(get<PARSED_RESP_DATA_IDX>(*rec)) });
+            }
+            if(minTtl == 0)
+                continue;
+            entry->expiry  =  now + seconds(minTtl);
+
+            insert(groupKey.view(), std::move(entry));
+        }
+    }
+
+    CacheTrust  DnsCache::answerTrust(span<const uint8_t> wire) noexcept{
+        return wire.size() > dnsclient::DNS_AA_IDX && (wire[dnsclient::DNS_AA_IDX] & dnsclient::DNS_AA) != 0
+                   ? CacheTrust::AUTH_ANSWER : CacheTrust::ANSWER;
+    }
+
+    uint32_t  DnsCache::negativeTtl(const ParsedResponse& records) noexcept{
+        // RFC 2308 par. 5: the lesser of the SOA TTL and of its MINIMUM field, the last one in
+        // the parsed SOA text. Without a SOA the answer is not cached.
+        uint32_t  ttl  { 0 };
+        for(const auto& rec : records){
+            if(get<PARSED_RESP_TYPE_IDX>(rec) != RR_TYPES_SOA)
+                continue;
+
+            string_view  data  { get<PARSED_RESP_DATA_IDX>(rec) };
+            if(!data.empty() && data.back() == ';')
+                data.remove_suffix(1);
+            data.remove_prefix(data.rfind(';') + 1);
+
+            uint32_t  minimum  { 0 };
+            if(from_chars(data.data(), data.data() + data.size(), minimum).ec != std::errc())
+                continue;
+
+            const uint32_t  soaTtl  { min(get<PARSED_RESP_TTL_IDX>(rec), minimum) };
+            ttl  =  ttl == 0 ? soaTtl : min(ttl, soaTtl);
+        }
+        return ttl;
+    }
+
+    const CacheEntry*  DnsCache::locate(string_view key) const noexcept{
+        // Must run inside an EpochGuard: the bucket and its entries are kept alive by it.
+        const CacheBucket*  bucket  { bucketOf(key).load(memory_order_seq_cst) };
+        if(bucket == nullptr)
+            return nullptr;
+
+        const auto  node  { std::find_if(bucket->begin(), bucket->end(), [key](const CacheNode& item){ return item.key == key; }) };
+        return node == bucket->end() ? nullptr : node->entry.get();
+    }
+
+    const CacheEntry*  DnsCache::find(string_view key, TimePoint now) const noexcept{
+        const CacheEntry*  entry  { locate(key) };
+        return entry == nullptr || entry->expiry <= now ? nullptr : entry;
+    }
+
+    bool  DnsCache::wireLayout(span<const uint8_t> wire, WireOffsets& ttlOffsets, uint16_t& qtypeOffset) anyexcept{
+        // Offsets are stored on 16 bits, as the DNS compression pointers.
+        if(wire.size() < DNS_WIRE_HEADER_SIZE || wire.size() > numeric_limits<uint16_t>::max())
+            return false;
+
+        const auto  skipName  { [&wire](size_t idx) -> size_t {
+                                    while(idx < wire.size()){
+                                        if((wire[idx] & 0xc0) == 0xc0)
+                                            return idx + 2;
+                                        if(wire[idx] == 0)
+                                            return idx + 1;
+                                        idx  +=  wire[idx] + 1u;
+                                    }
+                                    return 0;
+                                } };
+
+        const size_t  questions  { readWire<uint16_t>(wire, DNS_WIRE_QDCOUNT_IDX) },
+                      records    { static_cast<size_t>(readWire<uint16_t>(wire, DNS_WIRE_QDCOUNT_IDX + 2)) +
+                                   readWire<uint16_t>(wire, DNS_WIRE_QDCOUNT_IDX + 4) +
+                                   readWire<uint16_t>(wire, DNS_WIRE_QDCOUNT_IDX + 6) };
+        if(questions != 1)
+            return false;
+
+        size_t  idx  { skipName(DNS_WIRE_HEADER_SIZE) };
+        if(idx == 0 || idx + 4 > wire.size())
+            return false;
+        qtypeOffset  =  static_cast<uint16_t>(idx);
+        idx  +=  4;
+
+        ttlOffsets.clear();
+        for(size_t num { 0 }; num < records; ++num){
+            idx  =  skipName(idx);
+            // type, class, ttl and rdata length
+            if(idx == 0 || idx + 10 > wire.size())
+                return false;
+            if(readWire<uint16_t>(wire, idx) != DNS_WIRE_TYPE_OPT)
+                ttlOffsets.push_back(static_cast<uint16_t>(idx + 4));
+            idx  +=  10u + readWire<uint16_t>(wire, idx + 8);
+            if(idx > wire.size())
+                return false;
+        }
+
+        return true;
+    }
+
+    void  DnsCache::setWireFormat(bool wire) noexcept{
+        wireFormat.store(wire, memory_order_relaxed);
+    }
+
+    bool  DnsCache::isWireFormat(void) const noexcept{
+        return wireFormat.load(memory_order_relaxed);
+    }
+
+    const CacheEntry*  DnsCache::findStale(string_view key, TimePoint now) const noexcept{
+        const CacheEntry*  entry  { locate(key) };
+        if(entry == nullptr)
+            return nullptr;
+
+        const TimePoint    expiry { entry->expiry };
+        return expiry <= now && now < expiry + seconds(staleWindow.load(memory_order_relaxed)) ? entry : nullptr;
+    }
+
+    void  DnsCache::insert(string_view key, EntryPtr&& entry) anyexcept{
+        const size_t        needed   { entryBytes(key, *entry) };
+        if(needed > shardBytes)
+            return;
+
+        CacheShard&         shard    { shardOf(key) };
+        auto&               slot     { bucketOf(key) };
+        lock_guard<mutex>   lock     { shard.writeMtx };
+
+        const CacheEntry*   old      { locate(key) };
+        if(old != nullptr && old->trust > entry->trust && old->expiry > entry->stored)
+            return;
+
+        // The sweep may replace this bucket as well: it is copied once the room is made.
+        const size_t        oldBytes { old != nullptr ? entryBytes(key, *old) : 0 },
+                            oldNo    { old != nullptr ? 1u : 0u };
+        size_t              used     { shard.bytes.load(memory_order_relaxed) - oldBytes },
+                            count    { shard.count.load(memory_order_relaxed) - oldNo };
+        evict(shard, used, count, needed, entry->stored, key);
+
+        const CacheBucket*  current  { slot.load(memory_order_relaxed) };
+        std::unique_ptr<CacheBucket>  next;
+        try{
+            next  =  std::make_unique<CacheBucket>();
+            next->reserve((current != nullptr ? current->size() : 0) + 1);
+            if(current != nullptr)
+                std::copy_if(current->begin(), current->end(), std::back_inserter(*next),
+                             [key](const CacheNode& node){ return node.key != key; });
+            next->push_back({ string(key), std::move(entry) });
+        }catch(...){
+            // What the sweep freed is gone anyway, the entry replaced is still there.
+            shard.bytes.store(used + oldBytes, memory_order_relaxed);
+            shard.count.store(count + oldNo, memory_order_relaxed);
+            throw;
+        }
+
+        shard.bytes.store(used + needed, memory_order_relaxed);
+        shard.count.store(count + 1, memory_order_relaxed);
+        slot.store(next.release(), memory_order_seq_cst);
+        if(current != nullptr)
+            EpochDomain::getInstance().retire(current);
+    }
+
+    void  DnsCache::evict(CacheShard& shard, size_t& used, size_t& count, size_t needed, TimePoint now,
+                          string_view replaced) const noexcept{
+        const seconds  stale    { staleWindow.load(memory_order_relaxed) };
+
+        // Two turns of the hand clear every reference bit, so the loop always ends. Only the
+        // buckets losing an entry are copied, without it; the entry being replaced is already
+        // counted out.
+        for(size_t turn { 0 }; turn < 2 * shard.bucketsNo && count > 0; ++turn){
+            size_t          left     { used },
+                            kept     { count };
+            uint64_t        expired  { 0 },
+                            evicted  { 0 };
+            const auto      full     { [&]{ return left + needed > shardBytes || kept >= shardEntries; } };
+            if(!full())
+                return;
+
+            auto&               slot     { shard.buckets[shard.clockHand++ % shard.bucketsNo] };
+            const CacheBucket*  current  { slot.load(memory_order_relaxed) };
+            if(current == nullptr)
+                continue;
+
+            std::unique_ptr<CacheBucket>  next;
+            try{
+                for(auto node { current->begin() }; node != current->end(); ++node){
+                    const bool  late  { node->entry->expiry + stale <= now };
+                    if(node->key == replaced || !full() ||
+                       (!late && node->entry->referenced.exchange(false, memory_order_relaxed))){
+                        if(next)
+                            next->push_back(*node);
+                        continue;
+                    }
+
+                    if(!next)
+                        next  =  std::make_unique<CacheBucket>(current->begin(), node);
+                    ++(late ? expired : evicted);
+                    left  -=  entryBytes(node->key, *node->entry);
+                    --kept;
+                }
+            }catch(...){
+                // Without memory for the copy the bucket stays as it is.
+                continue;
+            }
+            if(!next)
+                continue;
+
+            shard.expirations.fetch_add(expired, memory_order_relaxed);
+            shard.evictions.fetch_add(evicted, memory_order_relaxed);
+            used   =  left;
+            count  =  kept;
+            slot.store(next->empty() ? nullptr : next.release(), memory_order_seq_cst);
+            EpochDomain::getInstance().retire(current);
+        }
+    }
+
+    size_t  DnsCache::entryBytes(string_view key, const CacheEntry& entry) noexcept{
+        constexpr size_t  SSO_CAPACITY  { string().capacity() };
+        const auto        heap          { [](const string& text){ return text.capacity() > SSO_CAPACITY ? text.capacity() + 1 : 0; } };
+
+        // Bucket node, key, and the entry sharing a block with its counters.
+        size_t  bytes  { sizeof(CacheNode) +
+                         (key.size() > SSO_CAPACITY ? key.size() + 1 : 0) +
+                         sizeof(CacheEntry) + 2 * sizeof(long) +
+                         heap(entry.queryTxt) + entry.records.capacity() * sizeof(CachedRecord) +
+                         entry.wire.capacity() + entry.ttlOffsets.capacity() * sizeof(uint16_t) };
+        for(const auto& rec : entry.records)
+            bytes  +=  heap(rec.name) + heap(rec.data);
+        return bytes;
+    }
+
+    FlightPtr  DnsCache::joinFlight(const CacheKey& key, bool& leader) anyexcept{
+        CacheShard&         shard  { shardOf(key.view()) };
+        lock_guard<mutex>   lock   { shard.writeMtx };
+
+        if(const auto flight { shard.flights.find(key.view()) }; flight != shard.flights.end()){
+            leader  =  false;
+            return flight->second;
+        }
+
+        auto  flight  { std::make_shared<Flight>() };
+        shard.flights.emplace(string(key.view()), flight);
+        leader  =  true;
+        return flight;
+    }
+
+    void  DnsCache::leaveFlight(const CacheKey& key) noexcept{
+        CacheShard&         shard  { shardOf(key.view()) };
+        lock_guard<mutex>   lock   { shard.writeMtx };
+
+        if(const auto flight { shard.flights.find(key.view()) }; flight != shard.flights.end())
+            shard.flights.erase(flight);
+    }
+
+    void  DnsCache::setMaxTtl(uint32_t ttl) noexcept{
+        maxTtl.store(ttl, memory_order_relaxed);
+    }
+
+    void  DnsCache::setMaxNegativeTtl(uint32_t ttl) noexcept{
+        maxNegTtl.store(ttl, memory_order_relaxed);
+    }
+
+    void  DnsCache::setStaleWindow(uint32_t secs) noexcept{
+        staleWindow.store(min(secs, DNS_CACHE_MAX_STALE), memory_order_relaxed);
+    }
+
+    void  DnsCache::checkPrefetch(string_view key, const CacheEntry& entry, TimePoint now) noexcept{
+        if(!prefetchOn.load(memory_order_acquire) || entry.negative || entry.refreshing.load(memory_order_relaxed))
+            return;
+
+        // Only the hits close to expiry count, so that cold entries aren't touched at all.
+        const auto  lifetime  { entry.expiry - entry.stored };
+        if((entry.expiry - now) > lifetime * prefetchFraction.load(memory_order_relaxed))
+            return;
+        if(entry.hits.fetch_add(1, memory_order_relaxed) + 1 < prefetchHits.load(memory_order_relaxed))
+            return;
+
+        scheduleRefresh(key, key, entry);
+    }
+
+    void  DnsCache::scheduleRefresh(string_view question, string_view key, const CacheEntry& entry,
+                                    string_view server) noexcept{
+        // A stale entry is renewed whether prefetch is enabled or not.
+        if(server.empty() && !prefetchOn.load(memory_order_acquire))
+            return;
+
+        bool  expected  { false };
+        if(!entry.refreshing.compare_exchange_strong(expected, true))
+            return;
+
+        lock_guard<mutex>   lock { prefetchMtx };
+        try{
+            startPrefetchThread();
+            prefetchQueue.push_back({ string(question), string(key), string(server) });
+            prefetchCv.notify_one();
+        }catch(...){
+            // Without room for the job, or a thread to run it, the entry simply expires.
+            entry.refreshing.store(false, memory_order_relaxed);
+        }
+    }
+
+    void  DnsCache::enablePrefetch(const string& server, double fraction, uint32_t minHits, time_t timeout) anyexcept{
+        lock_guard<mutex>   lock { prefetchMtx };
+        prefetchServer    =  server;
+        prefetchTimeout   =  timeout;
+        prefetchFraction.store(fraction, memory_order_relaxed);
+        prefetchHits.store(minHits, memory_order_relaxed);
+        startPrefetchThread();
+        prefetchOn.store(true, memory_order_release);
+    }
+
+    void  DnsCache::disablePrefetch(void) noexcept{
+        // The thread stays, for the stale entries; it ends with the cache.
+        prefetchOn.store(false, memory_order_release);
+    }
+
+    void  DnsCache::startPrefetchThread(void) anyexcept{
+        // Called with prefetchMtx held.
+        if(prefetchThread.joinable())
+            return;
+
+        try{
+            prefetchThread  =  thread(&DnsCache::prefetchLoop, this);
+        }catch(const std::system_error& err){
+            throw string("DnsCache::startPrefetchThread: can't start the prefetch thread: ").append(err.what());
+        }
+    }
+
+    void  DnsCache::stopPrefetchThread(void) noexcept{
+        prefetchOn.store(false, memory_order_release);
+        {
+            lock_guard<mutex>   lock { prefetchMtx };
+            prefetchStop  =  true;
+            prefetchQueue.clear();
+        }
+        prefetchCv.notify_all();
+        if(prefetchThread.joinable())
+            prefetchThread.join();
+    }
+
+    void  DnsCache::prefetchLoop(void) noexcept{
+        unique_lock<mutex>  lock { prefetchMtx };
+        while(true){
+            prefetchCv.wait(lock, [this]{ return prefetchStop || !prefetchQueue.empty(); });
+            if(prefetchStop)
+                return;
+
+            PrefetchJob   job      { std::move(prefetchQueue.front()) };
+            prefetchQueue.pop_front();
+            const time_t  timeout  { prefetchTimeout };
+            try{
+                if(job.server.empty())
+                    job.server  =  prefetchServer;
+            }catch(...){
+                // Left without a server, the refresh fails.
+            }
+
+            lock.unlock();
+            refresh(job.question, job.server, timeout);
+            {
+                // On failure the old entry stays until it expires, or until its stale window ends.
+                const TimePoint     now    { Clock::now() };
+                const EpochGuard    guard;
+                const CacheEntry*   entry  { find(job.entry, now) };
+                if(entry == nullptr)
+                    entry  =  findStale(job.entry, now);
+                if(entry != nullptr)
+                    entry->refreshing.store(false, memory_order_relaxed);
+            }
+            lock.lock();
+        }
+    }
+
+    void  DnsCache::refresh(string_view key, const string& server, time_t timeout) noexcept{
+        const size_t    nameLen  { key.size() - 2 * sizeof(uint16_t) };
+        const auto      qtype    { static_cast<uint16_t>(static_cast<uint8_t>(key[nameLen])     << 8 | static_cast<uint8_t>(key[nameLen + 1])) },
+                        qclass   { static_cast<uint16_t>(static_cast<uint8_t>(key[nameLen + 2]) << 8 | static_cast<uint8_t>(key[nameLen + 3])) };
+        try{
+            const string           name    { key.substr(0, nameLen) };
+            dnsclient::DnsClient   client  { server, name };
+            client.setTimeoutSecs(timeout);
+            client.setQueryRR(qtype, qclass);
+
+            // Stored as the client stores its own answers: denials too, a SERVFAIL not.
+            const dnsclient::QueryResult  result  { client.trySendQuery() };
+            if(result || (result.error().status == dnsclient::QUERY_STATUS::QUERY_RCODE &&
+                          client.getReturnCode() != dnsclient::DNS_RCODE_SERVFAIL))
+                store(CacheKey{ name, qtype, qclass }, client.getParsedResponse(), string(client.getQueryTxtFromResp()),
+                      client.getReturnCode(), client.getAnswersNo(), client.getRawResponse());
+        }catch(...){
+            // A failed refresh is just a missed prefetch.
+        }
+    }
+
+    EntryPtr  DnsCache::restore(string_view key) anyexcept{
+        const CacheSnapshot*  current  { snapshot.load(memory_order_seq_cst) };
+        if(current == nullptr)
+            return nullptr;
+
+        // Once everything in it has expired the mapping is let go.
+        if(current->getExpiry() <= std::chrono::duration_cast<seconds>(std::chrono::system_clock::now().time_since_epoch()).count()){
+            if(snapshot.compare_exchange_strong(current, nullptr))
+                EpochDomain::getInstance().retire(current);
+            return nullptr;
+        }
+
+        EntryPtr  entry  { current->restore(key) };
+        if(entry)
+            insert(key, EntryPtr{ entry });
+        return entry;
+    }
+
+    size_t  DnsCache::loadSnapshot(const string& path) anyexcept{
+        auto          loaded  { std::make_unique<CacheSnapshot>(path) };
+        const size_t  count   { loaded->size() };
+
+        if(const CacheSnapshot* previous { snapshot.exchange(loaded.release(), memory_order_seq_cst) }; previous != nullptr)
+            EpochDomain::getInstance().retire(previous);
+        return count;
+    }
+
+    void  DnsCache::saveSnapshot(const string& path) const anyexcept{
+        const TimePoint         now    { Clock::now() };
+        const EpochGuard        guard;
+        SnapshotEntries         live;
+        std::unordered_set<string_view>  saved;
+
+        for(const auto& shard : shards)
+            for(size_t idx { 0 }; idx < shard.bucketsNo; ++idx)
+                if(const CacheBucket* bucket { shard.buckets[idx].load(memory_order_seq_cst) }; bucket != nullptr)
+                    for(const auto& [key, entry] : *bucket)
+                        if(entry->expiry > now){
+                            live.emplace_back(key, entry);
+                            saved.insert(key);
+                        }
+
+        // Entries of the loaded snapshot nobody asked for yet are still worth keeping.
+        if(const CacheSnapshot* current { snapshot.load(memory_order_seq_cst) }; current != nullptr)
+            for(const auto& item : current->getIndex())
+                if(!saved.contains(item.first))
+                    if(EntryPtr entry { current->restore(item.first) }; entry)
+                        live.emplace_back(item.first, std::move(entry));
+
+        CacheSnapshot::save(path, live);
+    }
+
+    void  DnsCache::enableSnapshots(const string& path, seconds interval) anyexcept{
+        disableSnapshots();
+
+        lock_guard<mutex>   lock { snapshotMtx };
+        snapshotPath      =  path;
+        snapshotInterval  =  interval;
+        snapshotStop      =  false;
+        try{
+            snapshotThread  =  thread(&DnsCache::snapshotLoop, this);
+        }catch(const std::system_error& err){
+            throw string("DnsCache::enableSnapshots: can't start the snapshot thread: ").append(err.what());
+        }
+    }
+
+    void  DnsCache::disableSnapshots(void) noexcept{
+        {
+            lock_guard<mutex>   lock { snapshotMtx };
+            snapshotStop  =  true;
+        }
+        snapshotCv.notify_all();
+        if(snapshotThread.joinable())
+            snapshotThread.join();
+    }
+
+    void  DnsCache::snapshotLoop(void) noexcept{
+        unique_lock<mutex>  lock { snapshotMtx };
+        bool                stop { false };
+        while(!stop){
+            stop  =  snapshotCv.wait_for(lock, snapshotInterval, [this]{ return snapshotStop; });
+
+            // A last one on the way out, so that a clean shutdown loses nothing.
+            lock.unlock();
+            try{
+                saveSnapshot(snapshotPath);
+            }catch(...){
+                // The previous snapshot, if any, is left in place.
+            }
+            lock.lock();
+        }
+    }
+
+    void  DnsCache::clear(void) noexcept{
+        for(auto& shard : shards){
+            lock_guard<mutex>  lock   { shard.writeMtx };
+            for(size_t idx { 0 }; idx < shard.bucketsNo; ++idx)
+                if(const CacheBucket* bucket { shard.buckets[idx].exchange(nullptr, memory_order_seq_cst) }; bucket != nullptr)
+                    EpochDomain::getInstance().retire(bucket);
+            shard.count.store(0, memory_order_relaxed);
+            shard.bytes.store(0, memory_order_relaxed);
+        }
+    }
+
+    size_t  DnsCache::size(void) const noexcept{
+        size_t              total  { 0 };
+        for(const auto& shard : shards)
+            total  +=  shard.count.load(memory_order_relaxed);
+        return total;
+    }
+
+    CacheStats  DnsCache::getStats(void) const noexcept{
+        CacheStats          stats  { 0, 0, 0, 0, 0, 0 };
+        for(const auto& shard : shards){
+            stats.entries      +=  shard.count.load(memory_order_relaxed);
+            stats.bytes        +=  shard.bytes.load(memory_order_relaxed);
+            stats.hits         +=  shard.hits.load(memory_order_relaxed);
+            stats.misses       +=  shard.misses.load(memory_order_relaxed);
+            stats.evictions    +=  shard.evictions.load(memory_order_relaxed);
+            stats.expirations  +=  shard.expirations.load(memory_order_relaxed);
+        }
+        return stats;
+    }
+
+} // End Namespace
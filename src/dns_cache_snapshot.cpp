@@ -0,0 +1,318 @@
+// -----------------------------------------------------------------
+// libdnsquery - a library to interrogate DNSs and more.
+// Copyright (C) 2018-2023  Gabriele Bonacini
+//
+// This program is free software for no profit use; you can redistribute 
+// it and/or modify it under the terms of the GNU General Public License 
+// as published by the Free Software Foundation; either version 2 of 
+// the License, or (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// A commercial license is also available for a lucrative use.
+// -----------------------------------------------------------------
+
+#include <dns_cache_snapshot.hpp>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+namespace dnscache{
+
+    using std::string,
+          std::string_view,
+          std::make_shared,
+          std::chrono::seconds,
+          std::chrono::system_clock,
+          std::chrono::duration_cast;
+
+    namespace {
+
+        int64_t  toWallTime(TimePoint point, TimePoint now, int64_t wallNow) noexcept{
+            return wallNow + duration_cast<seconds>(point - now).count();
+        }
+
+        TimePoint  fromWallTime(int64_t wall, TimePoint now, int64_t wallNow) noexcept{
+            return now + seconds(wall - wallNow);
+        }
+
+        int64_t  wallClock(void) noexcept{
+            return duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+        }
+
+        template<typename T>
+        void  appendValue(string& buffer, T value) anyexcept{
+            buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        template<typename L>
+        void  appendText(string& buffer, string_view text) anyexcept{
+            appendValue(buffer, static_cast<L>(text.size()));
+            buffer.append(text);
+        }
+
+        // Bounds checked cursor over the mapped file: a short or corrupted file stops
+        // the decoding, it can't make it read past the mapping.
+        class SnapshotReader{
+            public:
+                              SnapshotReader(const char* data, size_t len, size_t pos)  noexcept
+                                  : start{data}, end{len}, offset{pos}
+                              {}
+
+               template<typename T>
+               bool           read(T& value)                                            noexcept{
+                                  if(end - offset < sizeof(T))
+                                      return false;
+                                  std::memcpy(&value, start + offset, sizeof(T));
+                                  offset  +=  sizeof(T);
+                                  return true;
+                              }
+
+               template<typename L>
+               bool           readText(string_view& text)                               noexcept{
+                                  L  len  { 0 };
+                                  if(!read(len) || end - offset < len)
+                                      return false;
+                                  text     =  string_view(start + offset, len);
+                                  offset  +=  len;
+                                  return true;
+                              }
+
+               bool           skip(size_t len)                                          noexcept{
+                                  if(end - offset < len)
+                                      return false;
+                                  offset  +=  len;
+                                  return true;
+                              }
+
+               size_t         position(void)                                   const    noexcept{
+                                  return offset;
+                              }
+
+            private:
+               const char*    start;
+               size_t         end,
+                              offset;
+        };
+
+    } // End Anonymous Namespace
+
+    CacheSnapshot::CacheSnapshot(const string& path) anyexcept
+        :  base{nullptr},
+           length{0},
+           index{},
+           lastExpiry{0},
+           version{0}
+    {
+        const int  fd  { open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+        if(fd == -1)
+            throw string("CacheSnapshot: can't open: ").append(path).append(" - ").append(strerror(errno));
+
+        struct stat  info {};
+        if(fstat(fd, &info) == -1 || info.st_size <= 0){
+            close(fd);
+            throw string("CacheSnapshot: empty or unreadable file: ").append(path);
+        }
+
+        length  =  static_cast<size_t>(info.st_size);
+        void*  addr  { mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) };
+        close(fd);
+        if(addr == MAP_FAILED)
+            throw string("CacheSnapshot: can't map: ").append(path).append(" - ").append(strerror(errno));
+        base  =  static_cast<const char*>(addr);
+
+        try{
+            SnapshotReader  reader  { base, length, 0 };
+            uint32_t        bom     { 0 },
+                            count   { 0 };
+            if(!reader.skip(sizeof(DNS_SNAPSHOT_MAGIC) - 1) || std::memcmp(base, DNS_SNAPSHOT_MAGIC, sizeof(DNS_SNAPSHOT_MAGIC) - 1) != 0 ||
+               !reader.read(version) || !reader.read(bom) || !reader.read(count))
+                throw string("CacheSnapshot: not a snapshot file: ").append(path);
+            if(version == 0 || version > DNS_SNAPSHOT_VERSION || bom != DNS_SNAPSHOT_BOM)
+                throw string("CacheSnapshot: unsupported snapshot version or byte order: ").append(path);
+
+            const int64_t   now     { wallClock() };
+            index.reserve(count);
+            for(uint32_t i { 0 }; i < count; ++i){
+                string_view  key;
+                int64_t      expiry   { 0 };
+                uint32_t     bodyLen  { 0 };
+                if(!reader.readText<uint16_t>(key) || !reader.read(expiry) || !reader.read(bodyLen))
+                    break;
+
+                const size_t  body  { reader.position() };
+                if(!reader.skip(bodyLen))
+                    break;
+                if(expiry <= now)
+                    continue;
+
+                index.insert_or_assign(key, body);
+                lastExpiry  =  std::max(lastExpiry, expiry);
+            }
+        }catch(...){
+            munmap(const_cast<char*>(base), length);
+            throw;
+        }
+    }
+
+    CacheSnapshot::~CacheSnapshot(void){
+        munmap(const_cast<char*>(base), length);
+    }
+
+    EntryPtr  CacheSnapshot::restore(string_view key) const anyexcept{
+        const auto  found  { index.find(key) };
+        if(found == index.end())
+            return nullptr;
+
+        // The expiry precedes the body length, just before the body itself.
+        SnapshotReader  reader    { base, length, found->second - sizeof(uint32_t) - sizeof(int64_t) };
+        int64_t         expiry    { 0 },
+                        stored    { 0 };
+        uint32_t        bodyLen   { 0 };
+        uint8_t         negative  { 0 };
+        uint16_t        records   { 0 };
+        string_view     queryTxt;
+        auto            entry     { make_shared<CacheEntry>() };
+        if(!reader.read(expiry) || !reader.read(bodyLen) || !reader.read(stored) || !reader.read(entry->rcode) ||
+           !reader.read(negative) || !reader.readText<uint32_t>(queryTxt) || !reader.read(records))
+            return nullptr;
+
+        const TimePoint  now      { Clock::now() };
+        const int64_t    wallNow  { wallClock() };
+        if(expiry <= wallNow)
+            return nullptr;
+
+        entry->stored    =  fromWallTime(stored, now, wallNow);
+        entry->expiry    =  fromWallTime(expiry, now, wallNow);
+        entry->negative  =  negative != 0;
+        entry->queryTxt.assign(queryTxt);
+        entry->records.reserve(records);
+        for(uint16_t i { 0 }; i < records; ++i){
+            CachedRecord  rec  {};
+            string_view   name,
+                          data;
+            if(!reader.readText<uint16_t>(name) || !reader.read(rec.type) || !reader.read(rec.classid) ||
+               !reader.read(rec.ttl) || !reader.read(rec.len) || !reader.readText<uint32_t>(data))
+                return nullptr;
+            rec.name.assign(name);
+            rec.data.assign(data);
+            entry->records.push_back(std::move(rec));
+        }
+
+        if(version < 2)
+            return entry;
+
+        string_view  wire;
+        uint16_t     offsets  { 0 };
+        if(!reader.readText<uint32_t>(wire) || !reader.read(offsets))
+            return nullptr;
+        entry->ttlOffsets.resize(offsets);
+        for(auto& offset : entry->ttlOffsets)
+            if(!reader.read(offset) || offset + sizeof(uint32_t) > wire.size())
+                return nullptr;
+        if(!reader.read(entry->qtypeOffset) || (!wire.empty() && entry->qtypeOffset + sizeof(uint16_t) > wire.size()))
+            return nullptr;
+        entry->wire.assign(wire.begin(), wire.end());
+
+        if(version < 3)
+            return entry;
+
+        uint8_t  trust  { 0 };
+        if(!reader.read(trust) || trust > static_cast<uint8_t>(CacheTrust::AUTH_ANSWER))
+            return nullptr;
+        entry->trust  =  static_cast<CacheTrust>(trust);
+
+        return entry;
+    }
+
+    size_t  CacheSnapshot::size(void) const noexcept{
+        return index.size();
+    }
+
+    int64_t  CacheSnapshot::getExpiry(void) const noexcept{
+        return lastExpiry;
+    }
+
+    const SnapshotIndex&  CacheSnapshot::getIndex(void) const noexcept{
+        return index;
+    }
+
+    void  CacheSnapshot::save(const string& path, const SnapshotEntries& entries) anyexcept{
+        const TimePoint  now      { Clock::now() };
+        const int64_t    wallNow  { wallClock() };
+        string           buffer,
+                         body;
+
+        buffer.append(DNS_SNAPSHOT_MAGIC, sizeof(DNS_SNAPSHOT_MAGIC) - 1);
+        appendValue(buffer, DNS_SNAPSHOT_VERSION);
+        appendValue(buffer, DNS_SNAPSHOT_BOM);
+        appendValue(buffer, static_cast<uint32_t>(entries.size()));
+
+        for(const auto& [key, entry] : entries){
+            body.clear();
+            appendValue(body, toWallTime(entry->stored, now, wallNow));
+            appendValue(body, entry->rcode);
+            appendValue(body, static_cast<uint8_t>(entry->negative));
+            appendText<uint32_t>(body, entry->queryTxt);
+            appendValue(body, static_cast<uint16_t>(entry->records.size()));
+            for(const auto& rec : entry->records){
+                appendText<uint16_t>(body, rec.name);
+                appendValue(body, rec.type);
+                appendValue(body, rec.classid);
+                appendValue(body, rec.ttl);
+                appendValue(body, rec.len);
+                appendText<uint32_t>(body, rec.data);
+            }
+            appendText<uint32_t>(body, string_view(reinterpret_cast<const char*>(entry->wire.data()), entry->wire.size()));
+            appendValue(body, static_cast<uint16_t>(entry->ttlOffsets.size()));
+            for(const uint16_t offset : entry->ttlOffsets)
+                appendValue(body, offset);
+            appendValue(body, entry->qtypeOffset);
+            appendValue(body, static_cast<uint8_t>(entry->trust));
+
+            appendText<uint16_t>(buffer, key);
+            appendValue(buffer, toWallTime(entry->expiry, now, wallNow));
+            appendText<uint32_t>(buffer, body);
+        }
+
+        // Written aside and renamed: a reader never maps a half written file.
+        const string  temp  { string(path).append(".tmp") };
+        const int     fd    { open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) };
+        if(fd == -1)
+            throw string("CacheSnapshot: can't create: ").append(temp).append(" - ").append(strerror(errno));
+
+        size_t  written  { 0 };
+        while(written < buffer.size()){
+            const ssize_t  ret  { write(fd, buffer.data() + written, buffer.size() - written) };
+            if(ret == -1 && errno == EINTR)
+                continue;
+            if(ret <= 0){
+                const string  err  { strerror(errno) };
+                close(fd);
+                unlink(temp.c_str());
+                throw string("CacheSnapshot: can't write: ").append(temp).append(" - ").append(err);
+            }
+            written  +=  static_cast<size_t>(ret);
+        }
+
+        const bool  synced  { fsync(fd) == 0 };
+        if(close(fd) == -1 || !synced || rename(temp.c_str(), path.c_str()) == -1){
+            const string  err  { strerror(errno) };
+            unlink(temp.c_str());
+            throw string("CacheSnapshot: can't store: ").append(path).append(" - ").append(err);
+        }
+    }
+
+} // End Namespace
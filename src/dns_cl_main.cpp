@@ -24,9 +24,12 @@ using namespace parcmdline;
 
 int main(int argc, char** argv){
 
-    constexpr char         flags[]    { "ie:a:u:Ad:s:S:T:lfht:VrX" };
+    constexpr char         flags[]    { "ie:a:u:Ad:s:S:T:lfht:q:VrXb:c:R:n:" };
     constexpr time_t       DEF_TIMEO  { 3   },
                            MAX_TIMEO  { 120 };
+    constexpr long         DEF_WINDW  { 256    },
+                           MAX_WINDW  { 65'536 };
+    constexpr size_t       MAX_TRIES  { 10  };
     int                    ret        { 0   };
 
     try{
@@ -48,6 +51,8 @@ int main(int argc, char** argv){
         if(!pcl.isSet('d') && !pcl.isSet('s') && !pcl.isSet('t') && 
            !pcl.isSet('f') && !pcl.isSet('l') && !pcl.isSet('A') && 
            !pcl.isSet('a') && !pcl.isSet('u') && !pcl.isSet('T') && 
+           !pcl.isSet('q') && !pcl.isSet('b') && !pcl.isSet('c') &&
+           !pcl.isSet('R') && !pcl.isSet('n') &&
            #ifdef OFFENSIVE_REL
                !pcl.isSet('e') && !pcl.isSet('r') && !pcl.isSet('S') &&
                !pcl.isSet('i') && 
@@ -60,7 +65,8 @@ int main(int argc, char** argv){
                 pcl.isSet('t') || pcl.isSet('f')  || pcl.isSet('S') ||
                 pcl.isSet('l') || pcl.isSet('A')  || pcl.isSet('a') ||
                 pcl.isSet('u') || pcl.isSet('T')  || pcl.isSet('r') ||
-                pcl.isSet('h') || pcl.isSet('V')) || pcl.isSet('X'))
+                pcl.isSet('b') || pcl.isSet('c')  || pcl.isSet('R') ||
+                pcl.isSet('n') || pcl.isSet('h')  || pcl.isSet('V')) || pcl.isSet('X'))
                   paramError(argv[1], "-i (interactive node) doesn't require other parameters.");
         #endif
 
@@ -82,7 +88,9 @@ int main(int argc, char** argv){
             pcl.isSet('f')  || pcl.isSet('S') || pcl.isSet('l') || 
             pcl.isSet('A')  || pcl.isSet('a') || pcl.isSet('u') || 
             pcl.isSet('T')  || pcl.isSet('r') || pcl.isSet('h') || 
-            pcl.isSet('i')  || pcl.isSet('V')) )
+            pcl.isSet('i')  || pcl.isSet('V') || pcl.isSet('q') ||
+            pcl.isSet('b')  || pcl.isSet('c') || pcl.isSet('R') ||
+            pcl.isSet('n')) )
               paramError(argv[0], "-X  requires only -d and -s.");
 
         if(pcl.isSet('X') ){
@@ -115,6 +123,17 @@ int main(int argc, char** argv){
         if(!pcl.isSet('d'))
             paramError(argv[0], "You must specify -d with an address of a DNS.");
 
+        if((pcl.isSet('c') || pcl.isSet('R')) && !pcl.isSet('b'))
+            paramError(argv[0], "-c and -R require -b.");
+
+        if(pcl.isSet('b') && ( pcl.isSet('s')    ||  pcl.isSet('t') || pcl.isSet('f') ||
+                               filterNoOut != 0  ||  pcl.isSet('l')
+                               #ifdef OFFENSIVE_REL
+                               || pcl.isSet('S') ||  pcl.isSet('e') || pcl.isSet('r')
+                               #endif
+                             ) )
+            paramError(argv[0], "-b is only compatible with -d, -q, -c, -R, -n and -T.");
+
         #ifdef OFFENSIVE_REL
             if(pcl.isSet('s') && pcl.isSet('e'))
                 paramError(argv[0], "-s and -e are mutually exclusive.");
@@ -139,8 +158,49 @@ int main(int argc, char** argv){
                                  : DEF_TIMEO )
                              : DEF_TIMEO};
 
-        DnsClient   dnscl(dns);
+        // The -T timeout bounds all the attempts. Unless given, an attempt lasts a share of
+        // it; in bulk mode, as long as an answer of the DNS is expected to take.
+        dnsclient::RetryPolicy  retry;
+        if(pcl.isSet('n')){
+            const string  tries  { pcl.getValue('n') };
+            const size_t  sep    { tries.find(':') };
+            retry.attempts    =  stoul(tries.substr(0, sep));
+            if(retry.attempts == 0 || retry.attempts > MAX_TRIES)
+                paramError(argv[0], "-n requires from 1 to 10 attempts.");
+            if(sep != string::npos){
+                retry.timeoutMs  =  static_cast<uint32_t>(stoul(tries.substr(sep + 1)));
+                if(retry.timeoutMs == 0)
+                    paramError(argv[0], "-n requires a timeout greater than zero.");
+            }else if(!pcl.isSet('b')){
+                retry.timeoutMs  =  static_cast<uint32_t>(timeo * 1000 / static_cast<time_t>(retry.attempts));
+            }
+            retry.deadlineMs  =  static_cast<uint32_t>(timeo * 1000);
+        }
+
+        if(pcl.isSet('b')){
+            const size_t  window { static_cast<size_t>(
+                                     pcl.isSet('c')
+                                       ? ( stol(pcl.getValue('c')) <= MAX_WINDW && stol(pcl.getValue('c')) > 0
+                                           ? stol(pcl.getValue('c'))
+                                           : DEF_WINDW )
+                                       : DEF_WINDW ) };
+            dnsengine::RateLimit  limit;
+            if(pcl.isSet('R')){
+                const string  rate  { pcl.getValue('R') };
+                const size_t  sep   { rate.find(':') };
+                limit.qps    =  stod(rate.substr(0, sep));
+                limit.burst  =  sep == string::npos ? 0 : stoul(rate.substr(sep + 1));
+                if(limit.qps <= 0)
+                    paramError(argv[0], "-R requires a rate greater than zero.");
+            }
+            return bulkResolve(pcl.getValue('b'), dns, pcl.getValueUpper('q'), window, timeo, limit, retry);
+        }
+
+        // With more -d addresses, the retries go to the next one.
+        DnsClient   dnscl;
+        dnscl.setDNSservers(splitDnsList(dns));
         dnscl.setTimeoutSecs(timeo);
+        dnscl.setRetryPolicy(retry);
 
         #ifdef OFFENSIVE_REL
             if(pcl.isSet('S')){
@@ -165,6 +225,9 @@ int main(int argc, char** argv){
                  paramError(argv[0], "Invalid query type.");
         }
 
+        if(pcl.isSet('q') && !dnscl.setQueryRR(pcl.getValueUpper('q')))
+             paramError(argv[0], "Invalid RR type.");
+
         dnscl.setForceTcp(pcl.isSet('f'));
         dnscl.setSite(site);
         #ifdef OFFENSIVE_REL
@@ -232,18 +295,26 @@ void paramError(const char* progname, const char* err) noexcept{
         << "Syntax:                                                                       \n"                                                                    
         #ifdef OFFENSIVE_REL
         << "       "  << progname << " [ -d dns_address ] [-s site_name | -e ranges]      \n"
-                                  << " [-t qtype] [-f] [-S fake_sender]                   \n"
+                                  << " [-t qtype] [-q rrtype] [-f] [-S fake_sender]       \n"
+                                  << " [-n attempts[:msecs]]                              \n"
                                   << " [-l] [-A | -a type | -u type] [-T secs] [-r] [-X]  \n"     
                                   << " | [-i]                                             \n"     
+        << "       "  << progname << " [ -d dns_address[,dns_address...] ] [-b file]     \n"
+                                  << " [-c window] [-R qps[:burst]] [-q rrtype] [-T secs] \n"
+                                  << " [-n attempts[:msecs]]                              \n"
         #else
         << "       "  << progname << " [ -d dns_address ] [-s site_name ]                 \n"
-                                  << " [-t qtype] [-f]                                    \n"
+                                  << " [-t qtype] [-q rrtype] [-f] [-n attempts[:msecs]]  \n"
                                   << " [-l] [-A | -a type | -u type] [-T secs] [-X]       \n"     
+        << "       "  << progname << " [ -d dns_address[,dns_address...] ] [-b file]     \n"
+                                  << " [-c window] [-R qps[:burst]] [-q rrtype] [-T secs] \n"
+                                  << " [-n attempts[:msecs]]                              \n"
         #endif
         << "       "              << " | [-h] | [-V]                                      \n\n"   
         << "       "  << "-t query type.                                                  \n" 
         << "       "  << "   Supported types: standard(default), dump, ping, info         \n" 
         << "       "  << "                    mail, locate                                \n" 
+        << "       "  << "-q RR type. Ask for a specific RR type (i.e. aaaa, srv, ptr).   \n" 
         << "       "  << "-A Print all responses.                                         \n" 
         << "       "  << "-a response type. Print all responses of a given type.          \n" 
         << "       "  << "    Supported types: a, aaaa, ns, cname, soa, wks, ptr          \n" 
@@ -251,12 +322,24 @@ void paramError(const char* progname, const char* err) noexcept{
         << "       "  << "-u response type. Print a single response of a given type:      \n" 
         << "       "  << "    Supported types: see -a.                                    \n" 
         << "       "  << "-T secs. Set timeout to <secs> seconds.                         \n" 
+        << "       "  << "-n attempts[:msecs]. Send a query lost or refused up to        \n"
+        << "       "  << "   <attempts> times, waiting <msecs> each (default: -T split    \n"
+        << "       "  << "   among them), all within -T. Retries go to the next -d DNS.   \n"
         << "       "  << "-X set trace mode: all the hops will be printed to verify       \n" 
         << "       "  << "   the responder.                                               \n" 
         << "       "  << "-l print response length.                                       \n"                                     
         << "       "  << "-f force tcp query.                                             \n"                                          
-        << "       "  << "-d an address of a DNS.                                         \n"                                       
+        << "       "  << "-d an address of a DNS; more, comma separated, for -n and -b.   \n"                                       
         << "       "  << "-s a name of a site (i.e. www.wikipedia.org)                    \n"                  
+        << "       "  << "-b file. Bulk mode: resolve the names listed in <file>, one per \n"
+        << "       "  << "   line, optionally followed by a RR type; /dev/stdin for pipes.\n"
+        << "       "  << "   Results are printed as they complete, one line per name:     \n"
+        << "       "  << "   name, type, status and the records, separated by tabs.       \n"
+        << "       "  << "   With more -d addresses, each name goes to the fastest one;   \n"
+        << "       "  << "   a DNS not answering is left aside until it answers again.    \n"
+        << "       "  << "-c window. Bulk mode: queries in flight at once (default 256).  \n"
+        << "       "  << "-R qps[:burst]. Bulk mode: queries per second to each DNS, with \n"
+        << "       "  << "   up to <burst> of them sent back to back.                     \n"
         #ifdef OFFENSIVE_REL
         << "       "  << "-i interactive / batch mode                                     \n" 
         << "       "  << "-S fake address. This option permits to spoof a sender address. \n"
@@ -315,3 +398,138 @@ const dnsclient::EnumerationRanges createEnumerationList(string& epar) anyexcept
    }
 
 }
+
+vector<string> splitDnsList(const string& dnsList) anyexcept{
+   vector<string>  servers;
+   for(size_t start { 0 }, end { 0 }; start <= dnsList.size(); start = end + 1){
+       end  =  min(dnsList.find(',', start), dnsList.size());
+       if(end > start)
+           servers.push_back(dnsList.substr(start, end - start));
+   }
+   if(servers.empty())
+       throw string("No DNS address given.");
+
+   return servers;
+}
+
+int bulkResolve(const string& source, const string& dnsList, const string& defType,
+                size_t window, time_t timeo, dnsengine::RateLimit limit,
+                dnsclient::RetryPolicy retry) anyexcept{
+   using dnsengine::ResolverEngine,
+         dnsengine::EngineRing,
+         dnsengine::EngineAnswer,
+         dnsengine::EngineQuery,
+         dnsengine::RingRequest,
+         dnsengine::RingCompletion;
+
+   constexpr size_t  REAP_BATCH   { 256 };
+   constexpr int     REAP_WAIT_MS { 50  };
+
+   // Values can't start with '-': the standard input is read as /dev/stdin.
+   ifstream  input { source };
+   if(!input)
+       throw string("Bulk mode: can't open: ").append(source);
+
+   const DnsClient  names;
+   const size_t     defCode  { defType.empty() ? static_cast<size_t>(RR_TYPES_A) : names.rrStringToCode(defType) };
+   if(defCode == 0)
+       throw string("Bulk mode: invalid RR type: ").append(defType);
+
+   // One engine for all the upstreams: each name goes to the best one at hand.
+   ResolverEngine          engine    { splitDnsList(dnsList), 0, nullptr, timeo, limit, {}, retry };
+   EngineRing              ring      { engine, window };
+   vector<RingRequest>     batch;
+   vector<RingCompletion>  done(REAP_BATCH);
+   size_t                  inflight  { 0 },
+                           lineNo    { 0 };
+   bool                    eof       { false };
+   int                     ret       { 0 };
+   string                  line,
+                           out;
+
+   const auto  print { [&](size_t reaped){
+       for(size_t idx { 0 }; idx < reaped; ++idx){
+           const EngineAnswer&  answer  { done[idx].answer };
+           string               status;
+           switch(answer.error.status){
+               case QUERY_STATUS::QUERY_OK:
+               case QUERY_STATUS::QUERY_RCODE:
+                   status  =  names.getDnsErrorTxt(answer.error.rcode);
+                   status.resize(min(status.find(':'), status.size()));
+               break;
+               case QUERY_STATUS::QUERY_TIMEOUT:
+                   status  =  "Timeout";
+               break;
+               default:
+                   status  =  string("Error: ").append(answer.lastError);
+           }
+           if(!answer.ok)
+               ret  =  1;
+
+           out.append(answer.query.name).append(1, '\t')
+              .append(names.rrTypeToString(answer.query.qtype)).append(1, '\t')
+              .append(status);
+           for(const auto& rec : answer.records)
+               if(rec.type == answer.query.qtype)
+                   out.append(1, '\t').append(rec.data);
+           out.append(1, '\n');
+       }
+       inflight  -=  reaped;
+       cout << out;
+       out.clear();
+   } };
+
+   while(!eof || inflight > 0){
+       // Topped up to the window: names and types are read only as slots free up.
+       while(!eof && inflight + batch.size() < window){
+           if(!getline(input, line)){
+               eof  =  true;
+               break;
+           }
+           ++lineNo;
+
+           const size_t  nameStart { line.find_first_not_of(" \t\r") };
+           if(nameStart == string::npos || line[nameStart] == '#')
+               continue;
+           const size_t  nameEnd   { min(line.find_first_of(" \t\r", nameStart), line.size()) },
+                         typeStart { min(line.find_first_not_of(" \t\r", nameEnd), line.size()) },
+                         typeEnd   { min(line.find_first_of(" \t\r", typeStart), line.size()) };
+
+           EngineQuery  query { line.substr(nameStart, nameEnd - nameStart), static_cast<uint16_t>(defCode),
+                                CLASS_IN, {}, {} };
+           if(query.name.find_first_not_of("0123456789.") == string::npos && isAnAddr(query.name)){
+               query.name   =  DnsClient::reverseQueryHostString(query.name);
+               query.qtype  =  RR_TYPES_PTR;
+           }
+           if(typeStart < typeEnd){
+               string  rrtype { line.substr(typeStart, typeEnd - typeStart) };
+               transform(rrtype.begin(), rrtype.end(), rrtype.begin(), ::toupper);
+               const size_t  code  { names.rrStringToCode(rrtype) };
+               if(code == 0){
+                   ret  =  1;
+                   cerr << "Bulk mode: line " << lineNo << ": invalid RR type: " << rrtype << '\n';
+                   continue;
+               }
+               query.qtype  =  static_cast<uint16_t>(code);
+           }
+
+           batch.push_back(RingRequest{ std::move(query), lineNo });
+       }
+
+       const size_t  submitted  { ring.submit(batch) };
+       batch.erase(batch.begin(), batch.begin() + static_cast<ptrdiff_t>(submitted));
+       inflight  +=  submitted;
+
+       const size_t  reaped  { ring.reap(done) };
+       print(reaped);
+
+       // Nothing to read nor to reap: waits for the next answer.
+       if(reaped == 0 && inflight > 0 && (eof || inflight + batch.size() >= window)){
+           cout.flush();
+           print(ring.reap(done, 1, REAP_WAIT_MS));
+       }
+   }
+
+   cout.flush();
+   return ret;
+}
@@ -17,12 +17,16 @@
 // -----------------------------------------------------------------
 
 #include <dns_client.hpp>
+#include <dns_cache.hpp>
 
 #include <iostream>
 #include <iomanip>
 #include <utility>
 #include <algorithm>
 #include <iterator>
+#include <charconv>
+#include <random>
+#include <thread>
 
 #include <Types.hpp>
 
@@ -38,12 +42,18 @@ namespace dnsclient{
           std::string,
           std::to_string,
           std::stringstream,
+          std::string_view,
+          std::span,
+          std::to_chars,
           std::cerr,
           std::cout,
           std::getline,
           std::chrono::time_point,
           std::chrono::system_clock,
           std::chrono::duration,
+          std::chrono::steady_clock,
+          std::chrono::milliseconds,
+          std::chrono::duration_cast,
           std::out_of_range,
           std::function,
           std::get,
@@ -99,32 +109,60 @@ namespace dnsclient{
           return mask & orig ;
     }
 
-    DnsBase::DnsBase(void)
-        :    queryTypeDescrToClass{ make_pair("std",          QUERY_TYPE::STD_QUERY),
-                                    make_pair("dump",         QUERY_TYPE::DUMP_QUERY),
-                                    make_pair("ping",         QUERY_TYPE::PING_QUERY),
-                                    make_pair("mail",         QUERY_TYPE::MAIL_QUERY),
-                                    make_pair("locate",       QUERY_TYPE::LOC_QUERY),
-                                    #ifdef OFFENSIVE_REL
-                                    make_pair("std-spoofed",  QUERY_TYPE::STD_QUERY_SP),
-                                    make_pair("info-spoofed", QUERY_TYPE::INFO_QUERY_SP),
-                                    make_pair("mail-spoofed", QUERY_TYPE::MAIL_QUERY_SP),
-                                    #endif
-                                    make_pair("info",         QUERY_TYPE::INFO_QUERY)
-             },
-             queryTypeToDescription{ make_pair(QUERY_TYPE::STD_QUERY,      "std"),
-                                     make_pair(QUERY_TYPE::DUMP_QUERY,     "dump"),
-                                     make_pair(QUERY_TYPE::PING_QUERY,     "ping"),
-                                     make_pair(QUERY_TYPE::MAIL_QUERY,     "mail"),
-                                     make_pair(QUERY_TYPE::LOC_QUERY,      "locate"),
-                                     #ifdef OFFENSIVE_REL
-                                     make_pair(QUERY_TYPE::STD_QUERY_SP,   "std-spoofed"),
-                                     make_pair(QUERY_TYPE::INFO_QUERY_SP,  "info-spoofed"),
-                                     make_pair(QUERY_TYPE::MAIL_QUERY_SP,  "mail-spoofed"),
-                                     #endif
-                                     make_pair(QUERY_TYPE::INFO_QUERY,     "info")
-             },
-             queryHeaderConst{
+    constexpr auto  QUERY_TYPE_DESCRS  {  []{
+        std::array  table  {  QTypeDescr{"std",          QUERY_TYPE::STD_QUERY},
+                              QTypeDescr{"dump",         QUERY_TYPE::DUMP_QUERY},
+                              QTypeDescr{"ping",         QUERY_TYPE::PING_QUERY},
+                              QTypeDescr{"mail",         QUERY_TYPE::MAIL_QUERY},
+                              QTypeDescr{"locate",       QUERY_TYPE::LOC_QUERY},
+                              #ifdef OFFENSIVE_REL
+                              QTypeDescr{"std-spoofed",  QUERY_TYPE::STD_QUERY_SP},
+                              QTypeDescr{"info-spoofed", QUERY_TYPE::INFO_QUERY_SP},
+                              QTypeDescr{"mail-spoofed", QUERY_TYPE::MAIL_QUERY_SP},
+                              #endif
+                              QTypeDescr{"info",         QUERY_TYPE::INFO_QUERY}   };
+        std::sort(table.begin(), table.end(), [](const auto& lhs, const auto& rhs){ return lhs.first < rhs.first; });
+        return table;
+    }() };
+
+    constexpr std::array  RR_NAMES_BY_CODE  {  RRName{"A",      RR_TYPES_A},
+                                               RRName{"NS",     RR_TYPES_NS},
+                                               RRName{"CNAME",  RR_TYPES_CNAME},
+                                               RRName{"SOA",    RR_TYPES_SOA},
+                                               RRName{"WKS",    RR_TYPES_WKS},
+                                               RRName{"PTR",    RR_TYPES_PTR},
+                                               RRName{"MX",     RR_TYPES_MX},
+                                               RRName{"TXT",    RR_TYPES_TXT},
+                                               RRName{"AAAA",   RR_TYPES_AAAA},
+                                               RRName{"LOC",    RR_TYPES_LOC},
+                                               RRName{"SRV",    RR_TYPES_SRV},
+                                               RRName{"NAPTR",  RR_TYPES_NAPTR},
+                                               RRName{"SVCB",   RR_TYPES_SVCB},
+                                               RRName{"HTTPS",  RR_TYPES_HTTPS},
+                                               RRName{"ANY",    RR_TYPES_ANY},
+                                               RRName{"CAA",    RR_TYPES_CAA}    };
+
+    static_assert(std::is_sorted(RR_NAMES_BY_CODE.begin(), RR_NAMES_BY_CODE.end(),
+                                 [](const auto& lhs, const auto& rhs){ return lhs.second < rhs.second; }),
+                  "RR_NAMES_BY_CODE must be sorted by code.");
+
+    constexpr auto  RR_NAMES_BY_NAME  {  []{
+        auto  table  { RR_NAMES_BY_CODE };
+        std::sort(table.begin(), table.end(), [](const auto& lhs, const auto& rhs){ return lhs.first < rhs.first; });
+        return table;
+    }() };
+
+    constexpr std::string_view  HEX_DIGITS  { "0123456789abcdef" };
+
+    // Formats a number straight into the arena string, no stream or temporary involved.
+    template<typename T>
+    static void  appendNumber(ArenaString& dest, T value, int base=10) anyexcept{
+        std::array<char, std::numeric_limits<T>::digits10 + 2>  digits;
+        const auto  res  { to_chars(digits.data(), digits.data() + digits.size(), value, base) };
+        dest.append(digits.data(), res.ptr);
+    }
+
+    const QueryHeader     DnsBase::queryHeaderConst{{
                             //         BITS 
                             // Bytes   0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
                             //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
@@ -148,86 +186,27 @@ namespace dnsclient{
                             // 11|13   |                                               |
                                       0x00,                    0x00
                             //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-             },
-             queryHeaderLenConst{ 
+             }};
+
+    const QueryHeaderLen  DnsBase::queryHeaderLenConst{{
                             //         BITS 
                             // Bytes   0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
                             //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
                             // 0,  1   |              MESSAGE LEN                      |
                             //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
                                       0x00,                    0x00
-             },
-             queryFooterConst{
-                            //         BITS
-                            // ELEM    0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // 12|14,..|                                               |
-                            // ..      /                     QNAME                     /
-                            // ..      /                                               /
-                                      0x0,
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // ..      |                     QTYPE                     |
-                                      0x00,                    0x01,
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // ..      |                     QCLASS                    |
-                                      0x00,                    0x01 
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-             },
-             queryFooterTxtConst{
-                            //         BITS
-                            // ELEM    0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // 12|14,..|                                               |
-                            // ..      /                     QNAME                     /
-                            // ..      /                                               /
-                                      0x0,
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // ..      |                     QTYPE                     |
-                                      0x00,                    0x10,
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // ..      |                     QCLASS                    |
-                                      0x00,                    0x03 
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-             },
-             queryFooterMailConst{
-                            //         BITS
-                            // ELEM    0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // 12|14,..|                                               |
-                            // ..      /                     QNAME                     /
-                            // ..      /                                               /
-                                      0x0,
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // ..      |                     QTYPE                     |
-                                      0x00,                    0x0f,
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // ..      |                     QCLASS                    |
-                                      0x00,                    0x01 
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-             },
-             queryFooterLocConst{
-                            //         BITS
-                            // ELEM    0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // 12|14,..|                                               |
-                            // ..      /                     QNAME                     /
-                            // ..      /                                               /
-                                      0x0,
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // ..      |                     QTYPE                     |
-                                      0x00,                    0x1d,
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-                            // ..      |                     QCLASS                    |
-                                      0x00,                    0x01 
-                            //         +--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+--+
-             },
-             queryHeader{queryHeaderConst},
+             }};
+
+    DnsBase::DnsBase(void)
+        :    queryHeader{queryHeaderConst},
              queryHeaderLen{queryHeaderLenConst},
-             queryFooter{queryFooterConst},
-             queryFooterTxt{queryFooterTxtConst},
-             queryFooterMail{queryFooterMailConst},
-             queryFooterLoc{queryFooterLocConst},
+             customFooter{StdQuery::footer},
+             queryFooter{&StdQuery::footer},
+             querySegments{},
+             querySegmentsNo{0},
              tcpQuery{false},
+             tcpFallback{true},
+             tcpLeg{false},
              activeType{QUERY_TYPE::STD_QUERY},
              socketptr{nullptr},
              sitename{"null"},
@@ -237,19 +216,38 @@ namespace dnsclient{
              #endif
              queryTxt{"null"},
              timeoutSecs{3},
-             rsp(static_cast<size_t>(networkutils::DNS_RESPONSE_SIZE), 0),
+             rsp{},
              queryTypeIdx{0},
              queryClassIdx{0},
              responseEndIdx{0},
              queryType{0},
-             queryClass{0}
+             queryClass{0},
+             arenaBuffer{},
+             arena{arenaBuffer.data(), arenaBuffer.size()},
+             parsedResponse{&arena},
+             additionalResponse{&arena},
+             responseTypeIdx{&arena},
+             respLen{0},
+             parseOffset{0},
+             lastError{},
+             cache{nullptr},
+             cacheHit{false},
+             staleHit{false},
+             staleTimeoutSecs{1},
+             dnsNames{},
+             dnsIdx{0},
+             retryPolicy{},
+             attemptMs{0},
+             queryDeadline{},
+             respRcode{0},
+             answersNo{0}
     {}
     
     void  DnsBase::setSite(SiteName site) anyexcept{
         if(site.size() > DNS_MAX_DOMAIN_SIZE)
             throw string("DnsBase::setSite: Domain string too long.");
         try{
-            sitename = site;
+            sitename = std::move(site);
         }catch(...){
             throw string("DnsBase::setSite: Can't set site name or address.");
         }
@@ -257,62 +255,66 @@ namespace dnsclient{
 
     void  DnsBase::setDNSserver(DnsName dns) anyexcept{
         try{
-            dnsName = dns;
+            dnsName = std::move(dns);
+            dnsNames.clear();
         }catch(...){
             throw string("DnsBase::setDNSserver: Can't set dns address.");
         }
     }
 
-    bool  DnsBase::isTruncated(void) const noexcept {
-         return BitMaskHdlr::checkMask(DNS_TC, rsp.at(DNS_TC_IDX));
-    }
-
-    void   DnsBase::resetHeader(void)  anyexcept{
+    void  DnsBase::setDNSservers(DnsNames dns) anyexcept{
+        if(dns.empty())
+            throw string("DnsBase::setDNSservers: Empty dns list.");
         try{
-            queryHeader  =  queryHeaderConst;
+            dnsName   =  dns.front();
+            dnsNames  =  std::move(dns);
         }catch(...){
-            throw string("DnsBase::resetHeader: Can't reset the header.");
+            throw string("DnsBase::setDNSservers: Can't set dns addresses.");
         }
     }
 
-    void  DnsBase::setTranId(void) anyexcept{
-        const size_t  begin  { static_cast<size_t>((tcpQuery ? DNS_RESP_DATA_TCP_DELTA  : 0)) };
-        try{
-           RngReaderVectUint8::getInstance().getRndNums(queryAssembl, begin, sizeof(uint16_t));
-        }catch(const string& err){
-           throw string ("DnsBase::setTranId: Can't set transaction id: ").append(err);
-        }
+    void  DnsBase::setRetryPolicy(RetryPolicy policy) noexcept{
+        retryPolicy  =  policy;
     }
 
-    void  DnsBase::resetFooterStd(void) anyexcept {
-        try{
-            queryFooter     =  queryFooterConst;
-        }catch(...){
-            throw string("DnsBase::resetFooterStd: Can't reset the footer.");
-        }
+    const DnsName&  DnsBase::activeServer(void) const noexcept{
+        return dnsNames.empty() ? dnsName : dnsNames[dnsIdx % dnsNames.size()];
+    }
+
+    bool  DnsBase::isTruncated(void) const noexcept {
+         return rsp.size() > DNS_TC_IDX && BitMaskHdlr::checkMask(DNS_TC, rsp[DNS_TC_IDX]);
     }
 
-    void   DnsBase::resetFooterMail(void)  anyexcept{
+    void  DnsBase::prepareResponse(void)  anyexcept{
+        // Allocated on the first query only, so that idle clients are cheap to create.
         try{
-            queryFooterMail  =  queryFooterMailConst;
+            rsp.resize(networkutils::DNS_RESPONSE_SIZE);
         }catch(...){
-            throw string("DnsBase::resetFooterMail: Can't reset the footer.");
+            throw string("DnsBase::prepareResponse: Can't allocate the response buffer.");
         }
     }
 
-    void   DnsBase::resetFooterLoc(void)  anyexcept{
+    void   DnsBase::resetHeader(void)  anyexcept{
         try{
-            queryFooterLoc =  queryFooterLocConst;
+            queryHeader  =  queryHeaderConst;
         }catch(...){
-            throw string("DnsBase::resetFooterLoc: Can't reset the footer.");
+            throw string("DnsBase::resetHeader: Can't reset the header.");
         }
     }
 
-    void DnsBase::resetFooterTxt(void)  anyexcept{
+    void  DnsBase::setTranId(void) anyexcept{
+        // Each thread reads the device once every DNS_TRANID_POOL / 2 queries.
+        thread_local std::array<uint8_t, DNS_TRANID_POOL>  pool;
+        thread_local size_t                                 used  { DNS_TRANID_POOL };
         try{
-            queryFooterTxt  =  queryFooterTxtConst;
-        }catch(...){
-            throw string("DnsBase::resetFooterTxt: Can't reset the footer.");
+           if(used + sizeof(uint16_t) > pool.size()){
+               RngReaderVectUint8::getInstance().getRndNums(pool.data(), pool.size());
+               used  =  0;
+           }
+           std::copy_n(pool.begin() + static_cast<ptrdiff_t>(used), sizeof(uint16_t), queryHeader.begin() + DNS_TRANID_IDX);
+           used  +=  sizeof(uint16_t);
+        }catch(const string& err){
+           throw string ("DnsBase::setTranId: Can't set transaction id: ").append(err);
         }
     }
 
@@ -340,49 +342,69 @@ namespace dnsclient{
          }
     }
 
-    void DnsBase::assembleQuery(bool addLen, QUERY_TYPE qtype) anyexcept{
-        try{
-            queryAssembl.clear();
-            if(addLen)
-                queryAssembl.insert(queryAssembl.end(), queryHeaderLen.begin(), queryHeaderLen.end());
-            queryAssembl.insert(queryAssembl.end(), queryHeader.begin(), queryHeader.end());
-                
-            stringstream     lineStream(sitename);
-            for(string buff; getline(lineStream, buff, STD_SEPARATOR); ) {
-                if(buff.size() > DNS_MAX_LABEL_SIZE)
-                     throw string(" Label too long: ").append(buff);
-                queryAssembl.push_back(static_cast<uint8_t>(buff.size()));
-                queryAssembl.insert(queryAssembl.end(), buff.begin(), buff.end());
-            }
+    const QueryFooter&  DnsBase::getFooter(QUERY_TYPE qtype) noexcept{
+        switch(qtype){
+            case QUERY_TYPE::INFO_QUERY    :
+            #ifdef OFFENSIVE_REL
+            case QUERY_TYPE::INFO_QUERY_SP :
+            #endif
+                return InfoQuery::footer;
+            case QUERY_TYPE::MAIL_QUERY    :
+            #ifdef OFFENSIVE_REL
+            case QUERY_TYPE::MAIL_QUERY_SP :
+            #endif
+                return MailQuery::footer;
+            case QUERY_TYPE::LOC_QUERY     :
+                return LocQuery::footer;
+            case QUERY_TYPE::STD_QUERY     :     
+            case QUERY_TYPE::DUMP_QUERY    :     
+            case QUERY_TYPE::PING_QUERY    :     
+            #ifdef OFFENSIVE_REL
+            case QUERY_TYPE::STD_QUERY_SP  :
+            #endif
+            default:
+                return StdQuery::footer;
+        }
+    }
 
-            switch(qtype){
-                case QUERY_TYPE::INFO_QUERY    :
-                #ifdef OFFENSIVE_REL
-                case QUERY_TYPE::INFO_QUERY_SP :
-                #endif
-                    queryAssembl.insert(queryAssembl.end(), queryFooterTxt.begin(), queryFooterTxt.end());
-                break;
-                case QUERY_TYPE::MAIL_QUERY    :
-                #ifdef OFFENSIVE_REL
-                case QUERY_TYPE::MAIL_QUERY_SP :
-                #endif
-                    queryAssembl.insert(queryAssembl.end(), queryFooterMail.begin(), queryFooterMail.end());
-                break;
-                case QUERY_TYPE::LOC_QUERY     :
-                    queryAssembl.insert(queryAssembl.end(), queryFooterLoc.begin(), queryFooterLoc.end());
-                break;
-                case QUERY_TYPE::STD_QUERY     :     
-                case QUERY_TYPE::DUMP_QUERY    :     
-                case QUERY_TYPE::PING_QUERY    :     
-                #ifdef OFFENSIVE_REL
-                case QUERY_TYPE::STD_QUERY_SP  :
-                #endif
-                    queryAssembl.insert(queryAssembl.end(), queryFooter.begin(), queryFooter.end());
-            }
+    void DnsBase::encodeName(void) anyexcept{
+        queryName.clear();
+        for(string_view rest{sitename}; !rest.empty(); ) {
+            const size_t       sep   { rest.find(STD_SEPARATOR) };
+            const string_view  buff  { rest.substr(0, sep) };
+            if(buff.size() > DNS_MAX_LABEL_SIZE)
+                 throw string(" Label too long: ").append(buff);
+            queryName.push_back(static_cast<uint8_t>(buff.size()));
+            queryName.insert(queryName.end(), buff.begin(), buff.end());
+            rest  =  sep == string_view::npos ? string_view{} : rest.substr(sep + 1);
+        }
+    }
+
+    void DnsBase::buildSegments(bool addLen) noexcept{
+        const QueryFooter&  footer  { *queryFooter };
+
+        // Header, name and footer are sent in place: only the TCP length prefix is computed here.
+        querySegmentsNo  =  0;
+        if(addLen){
+            const size_t  msgLen  { queryHeader.size() + queryName.size() + footer.size() };
+            queryHeaderLen[0]  =  static_cast<uint8_t>(msgLen >> 8);
+            queryHeaderLen[1]  =  static_cast<uint8_t>(msgLen & 0xff);
+            querySegments[querySegmentsNo++]  =  { queryHeaderLen.data(),          queryHeaderLen.size() };
+        }
+        querySegments[querySegmentsNo++]      =  { queryHeader.data(),             queryHeader.size()    };
+        querySegments[querySegmentsNo++]      =  { queryName.data(),               queryName.size()      };
+        querySegments[querySegmentsNo++]      =  { const_cast<uint8_t*>(footer.data()), footer.size()    };
+    }
+
+    void DnsBase::assembleQuery(bool addLen) anyexcept{
+        try{
+            encodeName();
+            buildSegments(addLen);
 
-            if(addLen){
-                uint16_t* tcpSizeHdr  {  reinterpret_cast<uint16_t*>(queryAssembl.data()) };
-                *tcpSizeHdr           =  htons(queryAssembl.size() - queryHeaderLenConst.size());
+            queryAssembl.clear();
+            for(size_t idx{0}; idx < querySegmentsNo; ++idx){
+                const uint8_t*  base  { static_cast<const uint8_t*>(querySegments[idx].iov_base) };
+                queryAssembl.insert(queryAssembl.end(), base, base + querySegments[idx].iov_len);
             }
         }catch(const string& err){
            throw string("DnsBase::assembleQuery: ").append(err);
@@ -392,114 +414,631 @@ namespace dnsclient{
     }
 
     void DnsBase::sendQuery(bool assemble) anyexcept{
-        if(tcpQuery)
-            sendQueryTcp(assemble);
-        else
-            sendQueryUdp(assemble);
+        const QueryResult  result  { trySendQuery(assemble) };
+        if(result)
+            return;
+
+        switch(result.error().status){
+            case QUERY_STATUS::QUERY_TIMEOUT:
+                throw string("Timeout.");
+            case QUERY_STATUS::QUERY_NET_ERROR:
+            case QUERY_STATUS::QUERY_PARSE_ERROR:
+            case QUERY_STATUS::QUERY_INVALID:
+            case QUERY_STATUS::QUERY_CANCELLED:
+                throw string(lastError);
+            case QUERY_STATUS::QUERY_OK:
+            case QUERY_STATUS::QUERY_TRUNCATED:
+            case QUERY_STATUS::QUERY_RCODE:
+            break;
+        }
     }
 
-    void DnsBase::sendQueryTcp(bool assemble) anyexcept{
-        tcpQuery    =   true;
+    QueryResult DnsBase::trySendQuery(bool assemble) noexcept{
+        cacheHit  =  false;
+        staleHit  =  false;
+        if(lookupCache())
+            return respRcode == 0 ? QueryResult{&parsedResponse} : queryFailure(QUERY_STATUS::QUERY_RCODE);
+
+        // Single flight: only the first of the callers missing the same key goes upstream,
+        // unless it gives up for reasons of its own.
+        bool                       leader  { true };
+        const dnscache::FlightPtr  flight  { joinFlight(leader) };
+        if(!flight)
+            return resolve(assemble);
+        if(!leader)
+            return flight->wait().abandoned ? resolve(assemble) : followFlight(*flight);
+
+        const QueryResult  result  { resolve(assemble) };
+        endFlight(*flight, result);
+
+        return result;
+    }
+
+    dnscache::FlightPtr  DnsBase::joinFlight(bool& leader) const noexcept{
+        leader  =  true;
+        if(!isCacheable())
+            return nullptr;
+        try{
+            return cache->joinFlight(cacheKey(), leader);
+        }catch(...){
+            leader  =  true;
+            return nullptr;
+        }
+    }
 
-        if(assemble){
-            try{
-               assembleQuery(true, activeType);
-            }catch(const string& err){
-                throw string("DnsBase::sendQueryTcp: can't assemble query buffer: ").append(err);
+    void  DnsBase::endFlight(dnscache::Flight& flight, const QueryResult& result, bool abandoned) const noexcept{
+        cache->leaveFlight(cacheKey());
+        leadFlight(flight, result, abandoned);
+    }
+
+    bool  DnsBase::hasStale(void) const noexcept{
+        return isCacheable() && cache->hasStale(cacheKey());
+    }
+
+    time_t  DnsBase::getStaleTimeoutSecs(void) const noexcept{
+        return staleTimeoutSecs;
+    }
+
+    void  DnsBase::leadFlight(dnscache::Flight& flight, const QueryResult& result, bool abandoned) const noexcept{
+        dnscache::FlightResult  res  {};
+        res.ok         =  result.has_value();
+        res.abandoned  =  abandoned;
+        res.error      =  res.ok ? QueryError{ QUERY_STATUS::QUERY_OK, respRcode, 0 } : result.error();
+        res.stale      =  staleHit;
+        res.answersNo  =  answersNo;
+        try{
+            res.lastError  =  lastError;
+            res.queryTxt   =  queryTxt;
+            res.records.reserve(parsedResponse.size());
+            for(const auto& rec : parsedResponse)
+                res.records.push_back({ string(get<PARSED_RESP_NAME_IDX>(rec)),  get<PARSED_RESP_TYPE_IDX>(rec),
+                                        get<PARSED_RESP_CLASS_IDX>(rec),         get<PARSED_RESP_TTL_IDX>(rec),
+                                        get<PARSED_RESP_LEN_IDX>(rec),           string(get<PARSED_RESP_DATA_IDX>(rec)) });
+        }catch(...){
+            res  =  dnscache::FlightResult{ {}, {}, "DnsBase::trySendQuery: can't share the response.",
+                                            QueryError{ QUERY_STATUS::QUERY_INVALID, 0, 0 }, false, false, 0, abandoned };
+        }
+        flight.complete(std::move(res));
+    }
+
+    QueryResult DnsBase::followFlight(dnscache::Flight& flight) noexcept{
+        const dnscache::FlightResult&  res  { flight.wait() };
+
+        socketptr.reset(nullptr);
+        resetArena();
+        respRcode  =  res.error.rcode;
+        answersNo  =  res.answersNo;
+        try{
+            lastError  =  res.lastError;
+            queryTxt   =  res.queryTxt;
+            for(const auto& rec : res.records)
+                parsedResponse.emplace_back(string_view(rec.name), rec.type, rec.classid, rec.ttl,
+                                            rec.len, string_view(rec.data));
+            for(size_t idx{0}; idx < parsedResponse.size(); ++idx)
+                responseTypeIdx[get<PARSED_RESP_TYPE_IDX>(parsedResponse[idx])].push_back(idx);
+        }catch(...){
+            resetArena();
+            lastError  =  "DnsBase::trySendQuery: can't copy the shared response.";
+            return queryFailure(QUERY_STATUS::QUERY_INVALID);
+        }
+        const QueryFooter&  footer  { *queryFooter };
+        queryType  =  static_cast<uint16_t>(footer[1] << 8 | footer[2]);
+        queryClass =  static_cast<uint16_t>(footer[3] << 8 | footer[4]);
+        staleHit   =  res.stale;
+
+        return res.ok ? QueryResult{&parsedResponse} : queryFailure(res.error.status, res.error.offset);
+    }
+
+    QueryResult DnsBase::resolve(bool assemble) noexcept{
+        // RFC 8767: with a stale answer at hand the upstream gets only a short deadline.
+        const bool  served  { hasStale() };
+        uint32_t    budget  { retryPolicy.deadlineMs };
+        if(served)
+            budget  =  static_cast<uint32_t>(budget != 0 ? std::min<time_t>(budget, staleTimeoutSecs * 1000)
+                                                         : staleTimeoutSecs * 1000);
+        queryDeadline  =  budget != 0 ? steady_clock::now() + milliseconds(budget) : steady_clock::time_point{};
+
+        QueryResult  result  { queryFailure(QUERY_STATUS::QUERY_TIMEOUT) };
+        for(size_t attempt{0}; attempt < std::max<size_t>(retryPolicy.attempts, 1); ++attempt){
+            if(attempt != 0){
+                if(!isRetriable(result))
+                    break;
+                // A pause running past the deadline would only postpone the failure.
+                const milliseconds  pause  { retryBackoff(retryPolicy, attempt) };
+                if(queryDeadline != steady_clock::time_point{} && steady_clock::now() + pause >= queryDeadline)
+                    break;
+                std::this_thread::sleep_for(pause);
+                if(retryPolicy.rotate)
+                    ++dnsIdx;
             }
-            setTranId();
+            if(!armAttempt(retryPolicy.timeoutMs)){
+                result  =  queryFailure(QUERY_STATUS::QUERY_TIMEOUT);
+                break;
+            }
+            result  =  tcpQuery ? sendQueryTcp(assemble && attempt == 0) : sendQueryUdp(assemble && attempt == 0);
         }
+        dnsIdx         =  0;
+        attemptMs      =  0;
+        queryDeadline  =  steady_clock::time_point{};
+
+        return finishQuery(result, served);
+    }
 
-        #if defined __clang_major__ &&  __clang_major__ >= 4 
-        #pragma clang diagnostic push 
-        #pragma clang diagnostic ignored "-Wswitch-enum"
-        #endif
+    bool  DnsBase::isRetriable(const QueryResult& result) const noexcept{
+        if(result)
+            return false;
 
-        switch(activeType){
-            case QUERY_TYPE::STD_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::TcpSocket);
-            break;
-            case QUERY_TYPE::DUMP_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::TcpSocketVerbose);
-            break;
-            case QUERY_TYPE::INFO_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::TcpSocket);
-            break;
-            case QUERY_TYPE::MAIL_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::TcpSocket);
-            break;
-            case QUERY_TYPE::LOC_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::TcpSocket);
-            break;
-            case QUERY_TYPE::PING_QUERY :
-                 throw string("DnsClient::sendQueryTcp: ping type requires udp.");
-            #ifdef OFFENSIVE_REL
+        switch(result.error().status){
+            case QUERY_STATUS::QUERY_TIMEOUT:
+            case QUERY_STATUS::QUERY_NET_ERROR:
+                return true;
+            case QUERY_STATUS::QUERY_RCODE:
+                // Another server may answer what this one refuses or fails.
+                return retryPolicy.rotate && dnsNames.size() > 1 &&
+                       (respRcode == DNS_RCODE_SERVFAIL || respRcode == DNS_RCODE_REFUSED);
             default:
-                 throw string("DnsClient::sendQueryTcp: unexpected dns query type.");
-            #endif
+                return false;
         }
+    }
 
-        #ifdef __clang__
-        #pragma clang diagnostic pop
-        #endif
+    bool  DnsBase::armAttempt(uint32_t tou) noexcept{
+        attemptMs  =  tou;
+        if(queryDeadline == steady_clock::time_point{})
+            return true;
 
-        socketptr->sendMsg(queryAssembl, rsp);
+        const auto  left  { duration_cast<milliseconds>(queryDeadline - steady_clock::now()).count() };
+        if(left <= 0)
+            return false;
 
-        extractQueryPartFromResponse();
-        extractResponse(getRespIdx());
+        const int64_t  ceiling  { tou != 0 ? int64_t{tou} : static_cast<int64_t>(timeoutSecs) * 1000 };
+        attemptMs  =  static_cast<uint32_t>(std::min<int64_t>(left, ceiling));
+        return true;
     }
 
-    void DnsBase::sendQueryUdp(bool assemble) anyexcept{
+    milliseconds  retryBackoff(const RetryPolicy& policy, size_t retry) noexcept{
+        if(policy.backoffMs == 0 || retry == 0)
+            return milliseconds(0);
 
-        if(assemble){
-            try{
-               assembleQuery(false, activeType);
-            }catch(const string& err){
-                throw string("DnsBase::sendQueryUdp: can't assemble query buffer: ").append(err);
-            }
+        thread_local std::minstd_rand  jitter  { std::random_device{}() };
+        const uint64_t  pause  { std::min<uint64_t>(policy.maxBackoffMs,
+                                                    uint64_t{policy.backoffMs} << std::min<size_t>(retry - 1, 16)) };
+        return milliseconds(pause - pause / 2 + jitter() % (pause / 2 + 1));
+    }
+
+    QueryResult DnsBase::finishQuery(const QueryResult& result, bool staleAtHand) noexcept{
+        if(result || (result.error().status == QUERY_STATUS::QUERY_RCODE && respRcode != DNS_RCODE_SERVFAIL)){
+            storeCache();
+            return result;
+        }
+
+        // A stale answer stands in for a failing upstream, not for a bad or cancelled query.
+        if(staleAtHand && result.error().status != QUERY_STATUS::QUERY_INVALID &&
+           result.error().status != QUERY_STATUS::QUERY_CANCELLED && lookupCache(true))
+            return respRcode == 0 ? QueryResult{&parsedResponse} : queryFailure(QUERY_STATUS::QUERY_RCODE);
+
+        return result;
+    }
+
+    QueryResult DnsBase::beginQuery(bool& pending) noexcept{
+        pending   =  false;
+        tcpLeg    =  false;
+        cacheHit  =  false;
+        staleHit  =  false;
+        lastError.clear();
+        if(lookupCache())
+            return respRcode == 0 ? QueryResult{&parsedResponse} : queryFailure(QUERY_STATUS::QUERY_RCODE);
+
+        try{
+            encodeName();
             setTranId();
+            buildSegments(false);
+            prepareResponse();
+        }catch(const string& err){
+            lastError  =  string("DnsBase::beginQuery: can't assemble query: ").append(err);
+            return queryFailure(QUERY_STATUS::QUERY_INVALID);
+        }catch(...){
+            lastError  =  "DnsBase::beginQuery: unexpected error assembling the query.";
+            return queryFailure(QUERY_STATUS::QUERY_INVALID);
         }
 
-        switch(activeType){
-            case QUERY_TYPE::STD_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::UdpSocket);
-            break;
-            case QUERY_TYPE::DUMP_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::UdpSocketVerbose);
-            break;
-            case QUERY_TYPE::PING_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::UdpSocketPing);
-            break;
-            case QUERY_TYPE::INFO_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::UdpSocket);
-            break;
-            case QUERY_TYPE::MAIL_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::UdpSocket);
-            break;
-            case QUERY_TYPE::LOC_QUERY :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::UdpSocket);
-            break;                        
-            #ifdef OFFENSIVE_REL
-            case QUERY_TYPE::STD_QUERY_SP  :
-                 socketptr = SocketCreator::getInstance(dnsName, spoofing, timeoutSecs).createSocket(SocketTypes::UdpSocketSp);
-            break;
-            case QUERY_TYPE::INFO_QUERY_SP :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::UdpSocketSp);
-            break;
-            case QUERY_TYPE::MAIL_QUERY_SP :
-                 socketptr = SocketCreator::getInstance(dnsName, "", timeoutSecs).createSocket(SocketTypes::UdpSocketSp);
-            break;
+        resetArena();
+        respLen    =  0;
+        respRcode  =  0;
+        answersNo  =  0;
+        pending    =  true;
+        return &parsedResponse;
+    }
+
+    span<const networkutils::Iovec>  DnsBase::getQuerySegments(void) const noexcept{
+        return { querySegments.data(), querySegmentsNo };
+    }
+
+    uint16_t  DnsBase::getTranId(void) const noexcept{
+        return static_cast<uint16_t>(queryHeader[DNS_TRANID_IDX] << 8 | queryHeader[DNS_TRANID_IDX + 1]);
+    }
+
+    QueryResult DnsBase::endQuery(span<const uint8_t> response, bool& pending) noexcept{
+        pending  =  false;
+        try{
+            rsp.assign(response.begin(), response.end());
+        }catch(...){
+            lastError  =  "DnsBase::endQuery: can't copy the response.";
+            return finishQuery(queryFailure(QUERY_STATUS::QUERY_INVALID), false);
+        }
+        respLen    =  rsp.size();
+        respRcode  =  static_cast<uint8_t>(respLen > DNS_RCODE_IDX ? rsp[DNS_RCODE_IDX] & DNS_RET.back() : 0);
+
+        // The truncated udp payload isn't parsed: the query goes again on tcp.
+        if(!tcpLeg && respLen > DNS_TC_IDX && isTruncated() && tcpFallback){
+            tcpLeg   =  true;
+            buildSegments(true);
+            pending  =  true;
+            return queryFailure(QUERY_STATUS::QUERY_TRUNCATED);
+        }
+
+        const QueryResult  parsed  { parseResponse() };
+        return finishQuery(parsed && isTruncated() ? queryFailure(QUERY_STATUS::QUERY_TRUNCATED) : parsed, hasStale());
+    }
+
+    QueryResult DnsBase::abortQuery(QUERY_STATUS status, const string& reason) noexcept{
+        try{
+            lastError  =  reason;
+        }catch(...){
+            lastError.clear();
+        }
+        return finishQuery(queryFailure(status), hasStale());
+    }
+
+    void  DnsBase::setCache(CachePtr sharedCache) noexcept{
+        cache  =  std::move(sharedCache);
+    }
+
+    bool  DnsBase::isFromCache(void) const noexcept{
+        return cacheHit;
+    }
+
+    void  DnsBase::setStaleTimeoutSecs(time_t tou) noexcept{
+        staleTimeoutSecs  =  tou;
+    }
+
+    bool  DnsBase::isStale(void) const noexcept{
+        return staleHit;
+    }
+
+    size_t  DnsBase::getAnswersNo(void) const noexcept{
+        return answersNo;
+    }
+
+    const ParsedResponse&  DnsBase::getParsedResponse(void) const noexcept{
+        return parsedResponse;
+    }
+
+    bool  DnsBase::isCacheable(void) const noexcept{
+        // Dump, ping and spoofed queries are about the exchange itself, not about the answer.
+        return cache != nullptr && ( activeType == QUERY_TYPE::STD_QUERY  || activeType == QUERY_TYPE::INFO_QUERY ||
+                                     activeType == QUERY_TYPE::MAIL_QUERY || activeType == QUERY_TYPE::LOC_QUERY );
+    }
+
+    dnscache::CacheKey  DnsBase::cacheKey(void) const noexcept{
+        const QueryFooter&  footer  { *queryFooter };
+        return { sitename, static_cast<uint16_t>(footer[1] << 8 | footer[2]),
+                           static_cast<uint16_t>(footer[3] << 8 | footer[4]) };
+    }
+
+    bool  DnsBase::lookupCache(bool stale) noexcept{
+        if(!isCacheable())
+            return false;
+
+        const QueryFooter&         footer  { *queryFooter };
+        const dnscache::CacheKey   key     { cacheKey() };
+        if(cache->isWireFormat())
+            return lookupWireCache(key, stale);
+
+        resetArena();
+        try{
+            if(!(stale ? cache->lookupStale(key, parsedResponse, queryTxt, respRcode, activeServer())
+                       : cache->lookup(key, parsedResponse, queryTxt, respRcode)))
+                return false;
+        }catch(...){
+            resetArena();
+            return false;
+        }
+
+        for(size_t idx{0}; idx < parsedResponse.size(); ++idx)
+            responseTypeIdx[get<PARSED_RESP_TYPE_IDX>(parsedResponse[idx])].push_back(idx);
+        queryType  =  static_cast<uint16_t>(footer[1] << 8 | footer[2]);
+        queryClass =  static_cast<uint16_t>(footer[3] << 8 | footer[4]);
+        cacheHit   =  true;
+        staleHit   =  stale;
+
+        return true;
+    }
+
+    bool  DnsBase::lookupWireCache(const dnscache::CacheKey& key, bool stale) noexcept{
+        // The cached response replaces the network one, in a buffer of its size, and goes
+        // through the same parser.
+        try{
+            const uint16_t  tranId  { static_cast<uint16_t>(queryHeader[DNS_TRANID_IDX] << 8 | queryHeader[DNS_TRANID_IDX + 1]) };
+            if(!cache->lookupWire(key, rsp, tranId, stale, activeServer()))
+                return false;
+        }catch(...){
+            return false;
+        }
+
+        resetArena();
+        respLen    =  rsp.size();
+        respRcode  =  static_cast<uint8_t>(rsp[DNS_RCODE_IDX] & DNS_RET.back());
+        answersNo  =  0;
+        if(const QueryResult parsed { parseResponse() }; !parsed && parsed.error().status != QUERY_STATUS::QUERY_RCODE){
+            resetArena();
+            respLen  =  0;
+            return false;
+        }
+
+        cacheHit   =  true;
+        staleHit   =  stale;
+
+        return true;
+    }
+
+    void  DnsBase::storeCache(void) noexcept{
+        if(!isCacheable())
+            return;
+
+        try{
+            const span<const uint8_t>  wire  { rsp.data(), respLen };
+            cache->store(cacheKey(), parsedResponse, queryTxt, respRcode, answersNo, wire);
+            cache->harvest(cacheKey(), parsedResponse, answersNo, additionalResponse, wire);
+        }catch(...){
+            // A full or failing cache never fails the query.
+        }
+    }
+
+    void  DnsBase::setTcpFallback(bool fallback) noexcept{
+        tcpFallback  =  fallback;
+    }
+
+    const string&  DnsBase::getLastError(void) const noexcept{
+        return lastError;
+    }
+
+    void DnsBase::resetArena(void) noexcept{
+        // The containers give their storage back before the arena rewinds to its inline buffer.
+        ParsedResponse{&arena}.swap(parsedResponse);
+        ParsedResponse{&arena}.swap(additionalResponse);
+        ResponseTypeIdx{&arena}.swap(responseTypeIdx);
+        arena.release();
+    }
+
+    QueryResult DnsBase::queryFailure(QUERY_STATUS status, size_t offset) noexcept{
+        return expectedutils::Unexpected<QueryError>{ QueryError{ status, respRcode, offset } };
+    }
+
+    QueryResult DnsBase::sendQueryTcp(bool assemble) noexcept{
+        tcpQuery    =   true;
+
+        try{
+            if(assemble){
+                encodeName();
+                setTranId();
+            }
+            buildSegments(true);
+
+            #if defined __clang_major__ &&  __clang_major__ >= 4 
+            #pragma clang diagnostic push 
+            #pragma clang diagnostic ignored "-Wswitch-enum"
             #endif
+
+            switch(activeType){
+                case QUERY_TYPE::STD_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::TcpSocket, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::DUMP_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::TcpSocketVerbose, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::INFO_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::TcpSocket, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::MAIL_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::TcpSocket, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::LOC_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::TcpSocket, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::PING_QUERY :
+                     lastError  =  "DnsClient::sendQueryTcp: ping type requires udp.";
+                     return queryFailure(QUERY_STATUS::QUERY_INVALID);
+                #ifdef OFFENSIVE_REL
+                default:
+                     lastError  =  "DnsClient::sendQueryTcp: unexpected dns query type.";
+                     return queryFailure(QUERY_STATUS::QUERY_INVALID);
+                #endif
+            }
+
+            #ifdef __clang__
+            #pragma clang diagnostic pop
+            #endif
+
+            prepareResponse();
+        }catch(const string& err){
+            lastError  =  string("DnsBase::sendQueryTcp: can't assemble query: ").append(err);
+            return queryFailure(QUERY_STATUS::QUERY_INVALID);
+        }catch(...){
+            lastError  =  "DnsBase::sendQueryTcp: unexpected error assembling the query.";
+            return queryFailure(QUERY_STATUS::QUERY_INVALID);
         }
-        socketptr->sendMsg(queryAssembl, rsp);
 
-        extractQueryPartFromResponse();
-        extractResponse(getRespIdx());
+        const QueryResult  result  { sendSegments(true) };
+        if(!result)
+            return result;
+
+        return parseResponse();
+    }
+
+    QueryResult DnsBase::sendQueryUdp(bool assemble) noexcept{
+        try{
+            if(assemble){
+                encodeName();
+                setTranId();
+            }
+            buildSegments(false);
 
-        if(isTruncated()){
+            switch(activeType){
+                case QUERY_TYPE::STD_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::UdpSocket, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::DUMP_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::UdpSocketVerbose, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::PING_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::UdpSocketPing, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::INFO_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::UdpSocket, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::MAIL_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::UdpSocket, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::LOC_QUERY :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::UdpSocket, activeServer(), "", timeoutSecs);
+                break;                        
+                #ifdef OFFENSIVE_REL
+                case QUERY_TYPE::STD_QUERY_SP  :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::UdpSocketSp, activeServer(), spoofing, timeoutSecs);
+                break;
+                case QUERY_TYPE::INFO_QUERY_SP :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::UdpSocketSp, activeServer(), "", timeoutSecs);
+                break;
+                case QUERY_TYPE::MAIL_QUERY_SP :
+                     socketptr = SocketCreator::getInstance().createSocket(SocketTypes::UdpSocketSp, activeServer(), "", timeoutSecs);
+                break;
+                #endif
+            }
+            prepareResponse();
+        }catch(const string& err){
+            lastError  =  string("DnsBase::sendQueryUdp: can't assemble query: ").append(err);
+            return queryFailure(QUERY_STATUS::QUERY_INVALID);
+        }catch(...){
+            lastError  =  "DnsBase::sendQueryUdp: unexpected error assembling the query.";
+            return queryFailure(QUERY_STATUS::QUERY_INVALID);
+        }
+
+        const QueryResult  result  { sendSegments(false) };
+        if(!result)
+            return result;
+
+        // The truncated udp payload is not parsed when the query is going to be repeated on tcp,
+        // with what is left of the deadline.
+        if(isTruncated() && tcpFallback){
             socketptr.reset(nullptr);
-            sendQueryTcp(assemble);
+            if(!armAttempt(0))
+                return queryFailure(QUERY_STATUS::QUERY_TIMEOUT);
+            return sendQueryTcp(false);
         }
+
+        const QueryResult  parsed  { parseResponse() };
+        if(parsed && isTruncated())
+            return queryFailure(QUERY_STATUS::QUERY_TRUNCATED);
+
+        return parsed;
+    }
+
+    QueryResult DnsBase::sendSegments(bool tcp) noexcept{
+        resetArena();
+        respLen    =  0;
+        respRcode  =  0;
+        answersNo  =  0;
+
+        if(attemptMs != 0)
+            socketptr->setTimeoutMs(attemptMs);
+
+        switch(socketptr->trySendMsgv(querySegments.data(), querySegmentsNo, rsp)){
+            case networkutils::SOCK_STATUS::SOCK_TIMEOUT:
+                return queryFailure(QUERY_STATUS::QUERY_TIMEOUT);
+            case networkutils::SOCK_STATUS::SOCK_ERROR:
+                lastError  =  string(tcp ? "DnsBase::sendQueryTcp: " : "DnsBase::sendQueryUdp: ")
+                              .append(socketptr->getErrorMsg());
+                return queryFailure(QUERY_STATUS::QUERY_NET_ERROR);
+            case networkutils::SOCK_STATUS::SOCK_OK:
+            break;
+        }
+
+        const ssize_t  recvLen  { socketptr->getRecvLen() };
+        respLen    =  recvLen > 0 ? std::min(static_cast<size_t>(recvLen), rsp.size()) : 0;
+        respRcode  =  static_cast<uint8_t>(respLen > DNS_RCODE_IDX ? rsp[DNS_RCODE_IDX] & DNS_RET.back() : 0);
+
+        return &parsedResponse;
+    }
+
+    size_t DnsBase::skipName(size_t idx) const noexcept{
+        while(idx < respLen){
+            if((rsp[idx] & DNS_PTRS) == DNS_PTRS)
+                return idx + sizeof(uint16_t) <= respLen ? idx + sizeof(uint16_t) : 0;
+            if((rsp[idx] & DNS_PTRS) != 0)
+                return 0;
+            if(rsp[idx] == 0)
+                return idx + 1;
+            idx += rsp[idx] + 1UL;
+        }
+        return 0;
+    }
+
+    bool DnsBase::validateResponse(void) noexcept{
+        auto readU16  { [&](size_t idx) -> size_t { return static_cast<size_t>(rsp[idx] << 8 | rsp[idx + 1]); }};
+
+        parseOffset  =  0;
+        if(respLen < DNS_HEADER_SIZE)
+            return false;
+
+        const size_t  questions  { readU16(DNS_QDCOUNT_IDX) },
+                      records    { readU16(DNS_ANCOUNT_IDX) + readU16(DNS_NSCOUNT_IDX) };
+
+        size_t        idx        { DNS_HEADER_SIZE };
+        for(size_t num{0}; num < questions + records; ++num){
+            parseOffset  =  idx;
+            idx          =  skipName(idx);
+            if(idx == 0)
+                return false;
+
+            const size_t  fixedLen  { num < questions ? 2 * sizeof(uint16_t) 
+                                                      : RSP_START_IDX * sizeof(uint16_t) + sizeof(uint32_t) };
+            if(idx + fixedLen > respLen)
+                return false;
+
+            idx  +=  fixedLen;
+            if(num >= questions)
+                idx  +=  readU16(idx - sizeof(uint16_t));
+            if(idx > respLen)
+                return false;
+        }
+
+        return true;
+    }
+
+    QueryResult DnsBase::parseResponse(void) noexcept{
+        // Malformed responses are detected without unwinding, the extractors still
+        // throw on the corner cases, e.g. out of range compression pointers.
+        if(!validateResponse()){
+            lastError  =  string("DnsBase::parseResponse: malformed response at offset: ").append(to_string(parseOffset));
+            return queryFailure(QUERY_STATUS::QUERY_PARSE_ERROR, parseOffset);
+        }
+
+        try{
+            extractQueryPartFromResponse();
+            extractResponse(getRespIdx());
+            answersNo  =  getResponsesNo();
+        }catch(const string& err){
+            lastError  =  err;
+            return queryFailure(QUERY_STATUS::QUERY_PARSE_ERROR, parseOffset);
+        }catch(...){
+            lastError  =  "DnsBase::parseResponse: unexpected error.";
+            return queryFailure(QUERY_STATUS::QUERY_PARSE_ERROR, parseOffset);
+        }
+
+        if(respRcode != 0)
+            return queryFailure(QUERY_STATUS::QUERY_RCODE);
+
+        return &parsedResponse;
     }
 
     void  DnsBase::extractQueryPartFromResponse(void) anyexcept{
@@ -512,35 +1051,37 @@ namespace dnsclient{
        }};
 
        try{
-           stringstream     sstr;
            const size_t     queryStart   { static_cast<size_t>(DNS_RESP_DATA_IDX) };
-           string           name;
+           ArenaString      name         { &arena };
+           parseOffset      =  queryStart;
            queryTypeIdx     =  extractTextFromResponse(queryStart, name);
-           sstr << name;
     
            queryClassIdx    =  queryTypeIdx  +  sizeof(uint16_t);
-            if((queryClassIdx + 1) >= safeSizeT(socketptr->getRecvLen()))
+            if((queryClassIdx + 1) >= respLen)
                 throw  string("DnsClient::extractQueryPartFromResponse: Invalid Index: ").append(to_string(queryClassIdx + 1));
 
            queryType        =  ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + queryTypeIdx)));
            queryClass       =  ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + queryClassIdx)));
-           queryTxt         =  sstr.str();
+           queryTxt.assign(name);
        }catch(const string& err){
            throw  string("DnsClient::extractQueryPartFromResponse: ").append(err);
        }catch(const out_of_range& err){
            resetOnErr();
            throw  string("DnsClient::extractQueryPartFromResponse: Index Error parsing query section in response, rsp len: ")\
-                        .append(to_string(socketptr->getRecvLen()))\
+                        .append(to_string(respLen))\
                         .append(" - ").append(err.what());
        }catch(TypesUtilsException& ex){
            throw  string("DnsClient::extractQueryPartFromResponse: attempt to convert wrong data").append(ex.what());
        }catch(...){
            resetOnErr();
-           throw  string("DnsClient::extractQueryPartFromResponse: Unexpected Error parsing query section in response, rsp len: ").append(to_string(socketptr->getRecvLen()));
+           throw  string("DnsClient::extractQueryPartFromResponse: Unexpected Error parsing query section in response, rsp len: ").append(to_string(respLen));
        }
     }
 
     void  DnsBase::extractResponse(size_t mainIdx) anyexcept{
+        parsedResponse.clear();
+        additionalResponse.clear();
+        responseTypeIdx.clear();
         try{
             size_t  respNum  { 1 },
                     respsTot { getResponsesNo() + getRRAuthNo() },
@@ -548,84 +1089,28 @@ namespace dnsclient{
 
             if( respsTot == 0){
                 if( respAdd > 0){
-                    const string nullrsp { "Only additional RR provided" };
-                    parsedResponse.push_back(make_tuple(string("rr_add_only"), RR_TYPES_NULL, 0, 0, nullrsp.size(), nullrsp));
+                    const string_view nullrsp { "Only additional RR provided" };
+                    parsedResponse.emplace_back(string_view("rr_add_only"), RR_TYPES_NULL, 0, 0, nullrsp.size(), nullrsp);
                 }else{
-                    const string nullrsp { "No RR provided" };
-                    parsedResponse.push_back(make_tuple(string("no_rr"), RR_TYPES_NULL, 0, 0, nullrsp.size(), nullrsp));
+                    const string_view nullrsp { "No RR provided" };
+                    parsedResponse.emplace_back(string_view("no_rr"), RR_TYPES_NULL, 0, 0, nullrsp.size(), nullrsp);
                 }
-                responseTypeIdx.emplace(RR_TYPES_NULL, vector<size_t>{parsedResponse.size()-1});
+                responseTypeIdx[RR_TYPES_NULL].push_back(parsedResponse.size()-1);
             }
 
-            for(size_t blkIdx{mainIdx}; 
-                blkIdx < safeSizeT(socketptr->getRecvLen()) && respNum <= respsTot; 
-                ++respNum)
-            {
-               string  name;
-               blkIdx  =  extractTextFromResponse(blkIdx, name);
-
-               if((blkIdx + RSP_START_IDX * sizeof(uint16_t) +  sizeof(uint32_t)) >= safeSizeT(socketptr->getRecvLen()))
-                   throw  string("Invalid Index: ")\
-                                 .append(to_string(blkIdx + RSP_START_IDX * sizeof(uint16_t) +  sizeof(uint32_t)));
+            size_t  blkIdx  { mainIdx };
+            for(; blkIdx < respLen && respNum <= respsTot; ++respNum){
+               blkIdx          =  extractRecord(blkIdx, parsedResponse);
+               responseEndIdx  =  blkIdx;
+               responseTypeIdx[get<PARSED_RESP_TYPE_IDX>(parsedResponse.back())].push_back(parsedResponse.size()-1);
+            }
 
-               uint16_t  type    {  ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + blkIdx))) };
-    
-               blkIdx += sizeof(uint16_t);
-               uint16_t  classid {  ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + blkIdx))) };
-     
-               blkIdx += sizeof(uint16_t);
-               uint32_t  ttl     {  ntohl(*(reinterpret_cast<const uint32_t*>(rsp.data() + blkIdx))) };
-    
-               blkIdx += sizeof(uint32_t);
-               uint16_t  datalen {  ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + blkIdx))) };
-
-               blkIdx += sizeof(uint16_t);
-               string  datastr;
-               switch(type){
-                   case RR_TYPES_CNAME:
-                       extractTextFromResponse(blkIdx, datastr);
-                   break;
-                   case RR_TYPES_A:
-                       extractAddrFromResponse(blkIdx, datastr);
-                   break;
-                   case RR_TYPES_NS:
-                       extractTextFromResponse(blkIdx, datastr);
-                   break;
-                   case RR_TYPES_AAAA:
-                       extractAddr6FromResponse(blkIdx, datastr);
-                   break;
-                   case RR_TYPES_SOA:
-                       extractSoaTextFromResponse(blkIdx, datastr);
-                   break;
-                   case RR_TYPES_TXT:
-                       extractInfoTextFromResponse(blkIdx, datastr);
-                   break;
-                   case RR_TYPES_MX:
-                       extractMxFromResponse(blkIdx, datastr);
-                   break;
-                   case RR_TYPES_LOC:
-                       extractLocFromResponse(blkIdx, datastr);
-                   break;
-                   case RR_TYPES_WKS:
-                   case RR_TYPES_PTR:
-                   case RR_TYPES_SRV:
-                   default:
-                        datastr = "Error";
-                        throw string(" Unsupported RR type: ").append(to_string(type));
-               }
-
-               blkIdx          +=  datalen;
-               responseEndIdx  =   blkIdx;
-
-               parsedResponse.push_back(make_tuple(name, type, classid, ttl, datalen, datastr));
-               if(responseTypeIdx.find(type) != responseTypeIdx.end())
-                   responseTypeIdx[type].push_back(parsedResponse.size()-1);
-               else
-                   responseTypeIdx.emplace(type, vector<size_t>{parsedResponse.size()-1});
-        }
+            // Only the cache has a use for the additional records.
+            if(cache != nullptr && !cache->isWireFormat())
+                extractAdditional(blkIdx);
        }catch(const out_of_range& err){
            throw  string("DnsBase::extractResponse: Index Error in extractResponse.")\
-                        .append(to_string(socketptr->getRecvLen()))\
+                        .append(to_string(respLen))\
                         .append(" - ").append(err.what());
        }catch(const string& err){
            throw  string("DnsBase::extractResponse: ").append(err);
@@ -636,48 +1121,128 @@ namespace dnsclient{
        }
     }
 
-    void DnsBase::extractLocFromResponse(size_t idx, string& result) anyexcept{
+    size_t  DnsBase::extractRecord(size_t blkIdx, ParsedResponse& dest) anyexcept{
+        ArenaString  name  { &arena };
+        parseOffset  =  blkIdx;
+        blkIdx       =  extractTextFromResponse(blkIdx, name);
+
+        if((blkIdx + RSP_START_IDX * sizeof(uint16_t) +  sizeof(uint32_t)) >= respLen)
+            throw  string("Invalid Index: ")\
+                          .append(to_string(blkIdx + RSP_START_IDX * sizeof(uint16_t) +  sizeof(uint32_t)));
+
+        uint16_t  type    {  ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + blkIdx))) };
+    
+        blkIdx += sizeof(uint16_t);
+        uint16_t  classid {  ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + blkIdx))) };
+     
+        blkIdx += sizeof(uint16_t);
+        uint32_t  ttl     {  ntohl(*(reinterpret_cast<const uint32_t*>(rsp.data() + blkIdx))) };
+    
+        blkIdx += sizeof(uint32_t);
+        uint16_t  datalen {  ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + blkIdx))) };
+
+        blkIdx += sizeof(uint16_t);
+        ArenaString  datastr  { &arena };
+        switch(type){
+            case RR_TYPES_CNAME:
+                extractTextFromResponse(blkIdx, datastr);
+            break;
+            case RR_TYPES_A:
+                extractAddrFromResponse(blkIdx, datastr);
+            break;
+            case RR_TYPES_NS:
+                extractTextFromResponse(blkIdx, datastr);
+            break;
+            case RR_TYPES_AAAA:
+                extractAddr6FromResponse(blkIdx, datastr);
+            break;
+            case RR_TYPES_SOA:
+                extractSoaTextFromResponse(blkIdx, datastr);
+            break;
+            case RR_TYPES_TXT:
+                extractInfoTextFromResponse(blkIdx, datastr);
+            break;
+            case RR_TYPES_MX:
+                extractMxFromResponse(blkIdx, datastr);
+            break;
+            case RR_TYPES_LOC:
+                extractLocFromResponse(blkIdx, datastr);
+            break;
+            case RR_TYPES_PTR:
+                extractTextFromResponse(blkIdx, datastr);
+            break;
+            case RR_TYPES_SRV:
+                extractSrvFromResponse(blkIdx, datastr);
+            break;
+            case RR_TYPES_WKS:
+            default:
+                extractGenericFromResponse(blkIdx, datalen, datastr);
+        }
+
+        blkIdx += datalen;
+
+        dest.emplace_back(std::move(name), type, classid, ttl, datalen, std::move(datastr));
+        return blkIdx;
+    }
+
+    void  DnsBase::extractAdditional(size_t blkIdx) noexcept{
+        // The additional section isn't validated: whatever follows a malformed record is dropped.
+        try{
+            const size_t  respAdd  { getRRAddNo() };
+            for(size_t respNum{0}; blkIdx < respLen && respNum < respAdd; ++respNum)
+                blkIdx  =  extractRecord(blkIdx, additionalResponse);
+        }catch(...){
+            // The records parsed so far are complete.
+        }
+    }
+
+    void DnsBase::extractLocFromResponse(size_t idx, ArenaString& result) anyexcept{
         try{
             size_t expectedSize  =  idx + (4 * sizeof(uint8_t)) + ( 2 * sizeof(uint32_t));
             if(rsp.size() < expectedSize - 1)
                 throw string("DnsBase::extractLocFromResponse: invalid response format/size.");
-            stringstream  sstr;
-            sstr << "Ver;" << static_cast<int>(rsp.at(idx));
+            result.append("Ver;");
+            appendNumber(result, rsp.at(idx));
             idx++;
-            sstr << ";Sz;" << static_cast<int>(rsp.at(idx));
+            result.append(";Sz;");
+            appendNumber(result, rsp.at(idx));
             idx++;
-            sstr << ";Hp;" << static_cast<int>(rsp.at(idx));
+            result.append(";Hp;");
+            appendNumber(result, rsp.at(idx));
             idx++;
-            sstr << ";Vp;" << static_cast<int>(rsp.at(idx));
+            result.append(";Vp;");
+            appendNumber(result, rsp.at(idx));
             idx++; 
-            sstr << ";La;" << ntohl(*(reinterpret_cast<const uint32_t*>(rsp.data() + idx )));
+            result.append(";La;");
+            appendNumber(result, ntohl(*(reinterpret_cast<const uint32_t*>(rsp.data() + idx ))));
             idx += sizeof(uint32_t);
-            sstr << ";Lo;" << ntohl(*(reinterpret_cast<const uint32_t*>(rsp.data() + idx )));
+            result.append(";Lo;");
+            appendNumber(result, ntohl(*(reinterpret_cast<const uint32_t*>(rsp.data() + idx ))));
             idx += sizeof(uint32_t);
-            sstr << ";Al;" << ntohl(*(reinterpret_cast<const uint32_t*>(rsp.data() + idx ))) << ";";
-
-            result = sstr.str();
+            result.append(";Al;");
+            appendNumber(result, ntohl(*(reinterpret_cast<const uint32_t*>(rsp.data() + idx ))));
+            result.push_back(';');
         }catch(const out_of_range& err){
            throw  string("DnsClient::extractAddrFromResponse: Index Error.")\
-                        .append(to_string(socketptr->getRecvLen()))\
+                        .append(to_string(respLen))\
                         .append(" - ").append(err.what());
         }catch(...){
            throw  string("DnsClient::extractAddrFromResponse: Unexpected Error.");
         }
     }
 
-    void DnsBase::extractAddrFromResponse(size_t ipIdx, string& result) anyexcept{
+    void DnsBase::extractAddrFromResponse(size_t ipIdx, ArenaString& result) anyexcept{
         try{
-            stringstream  sstr;
-            if( (ipIdx + RSP_ADDR_IDX) >= safeSizeT(socketptr->getRecvLen()))
+            if( (ipIdx + RSP_ADDR_IDX) >= respLen)
                 throw  string("DnsBase::extractAddrFromResponse: Invalid Index: ").append(to_string(ipIdx));
-            sstr << static_cast<int>(rsp.at(ipIdx))   << "." << static_cast<int>(rsp.at(ipIdx + (RSP_ADDR_IDX -2))) << "." 
-                 << static_cast<int>(rsp.at(ipIdx + (RSP_ADDR_IDX -1))) << "." << static_cast<int>(rsp.at(ipIdx + RSP_ADDR_IDX));
-
-            result = sstr.str();
+            for(size_t octet{0}; octet <= RSP_ADDR_IDX; ++octet){
+                if(octet != 0)
+                    result.push_back(STD_SEPARATOR);
+                appendNumber(result, rsp.at(ipIdx + octet));
+            }
         }catch(const out_of_range& err){
            throw  string("DnsClient::extractAddrFromResponse: Index Error.")\
-                        .append(to_string(socketptr->getRecvLen()))\
+                        .append(to_string(respLen))\
                         .append(" - ").append(err.what());
         }catch(TypesUtilsException& ex){
            throw  string("DnsClient::extractAddrFromResponse: attempt to convert wrong data").append(ex.what());
@@ -686,21 +1251,18 @@ namespace dnsclient{
         }
     }
 
-    void DnsBase::extractMxFromResponse(size_t ipIdx, string& result) anyexcept{
+    void DnsBase::extractMxFromResponse(size_t ipIdx, ArenaString& result) anyexcept{
         try{
-            if((ipIdx + sizeof(uint16_t)) >= safeSizeT(socketptr->getRecvLen()))
+            if((ipIdx + sizeof(uint16_t)) >= respLen)
                 throw  string("DnsClient::extractMxFromResponse: Invalid Index: ").append(to_string(ipIdx));
 
-            stringstream  sstr;
-            sstr << dec << ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + ipIdx )))  << ";";
+            appendNumber(result, ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + ipIdx ))));
+            result.push_back(';');
 
-            string mailserver;
-            extractTextFromResponse(ipIdx + sizeof(uint16_t), mailserver);
-            sstr << mailserver;
-            result = sstr.str();
+            extractTextFromResponse(ipIdx + sizeof(uint16_t), result);
         }catch(const out_of_range& err){
            throw  string("DnsClient::extractMxFromResponse: Index Error.")\
-                        .append(to_string(socketptr->getRecvLen()))\
+                        .append(to_string(respLen))\
                         .append(" - ").append(err.what());
         }catch(const string& err){
            throw string("DnsClient::extractMxFromResponse: ").append(err);
@@ -711,20 +1273,69 @@ namespace dnsclient{
         }
     }
 
-    void DnsBase::extractAddr6FromResponse(size_t ipIdx, string& result) anyexcept{
+    void DnsBase::extractSrvFromResponse(size_t idx, ArenaString& result) anyexcept{
         try{
-            stringstream  sstr;
-            if( (ipIdx + RSP_ADDR6_IDX) >= safeSizeT(socketptr->getRecvLen()))
-                throw  string("extractAddr6FromResponse: Invalid Index: ").append(to_string(ipIdx));
+            if((idx + 3 * sizeof(uint16_t)) >= respLen)
+                throw  string("DnsClient::extractSrvFromResponse: Invalid Index: ").append(to_string(idx));
 
-            for(size_t inc{0}; inc < (RSP_ADDR6_IDX + 1); ++inc)
-                sstr << hex << ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + ipIdx + inc * sizeof(uint16_t))))  << ":";
+            for(size_t field{0}; field < 3; ++field, idx += sizeof(uint16_t)){
+                appendNumber(result, ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + idx))));
+                result.push_back(';');
+            }
+
+            extractTextFromResponse(idx, result);
+        }catch(const out_of_range& err){
+           throw  string("DnsClient::extractSrvFromResponse: Index Error.")\
+                        .append(to_string(respLen))\
+                        .append(" - ").append(err.what());
+        }catch(const string& err){
+           throw string("DnsClient::extractSrvFromResponse: ").append(err);
+        }catch(TypesUtilsException& ex){
+           throw  string("DnsClient::extractSrvFromResponse: attempt to convert wrong data").append(ex.what());
+        }catch(...){
+           throw  string("DnsClient::extractSrvFromResponse: Unexpected Error.");
+        }
+    }
 
-            result = sstr.str();
-            result.pop_back();
+    void DnsBase::extractGenericFromResponse(size_t idx, uint16_t len, ArenaString& result) anyexcept{
+        // RFC 3597 presentation format for types without a specific parser.
+        try{
+            if((idx + len) > respLen)
+                throw  string("DnsClient::extractGenericFromResponse: Invalid Index: ").append(to_string(idx + len));
+
+            result.append("\\# ");
+            appendNumber(result, len);
+            result.push_back(' ');
+            for(size_t pos{idx}; pos < idx + len; ++pos){
+                result.push_back(HEX_DIGITS[rsp.at(pos) >> 4]);
+                result.push_back(HEX_DIGITS[rsp.at(pos) & 0x0f]);
+            }
+        }catch(const out_of_range& err){
+           throw  string("DnsClient::extractGenericFromResponse: Index Error.")\
+                        .append(to_string(respLen))\
+                        .append(" - ").append(err.what());
+        }catch(const string& err){
+           throw string("DnsClient::extractGenericFromResponse: ").append(err);
+        }catch(TypesUtilsException& ex){
+           throw  string("DnsClient::extractGenericFromResponse: attempt to convert wrong data").append(ex.what());
+        }catch(...){
+           throw  string("DnsClient::extractGenericFromResponse: Unexpected Error.");
+        }
+    }
+
+    void DnsBase::extractAddr6FromResponse(size_t ipIdx, ArenaString& result) anyexcept{
+        try{
+            if( (ipIdx + RSP_ADDR6_IDX) >= respLen)
+                throw  string("extractAddr6FromResponse: Invalid Index: ").append(to_string(ipIdx));
+
+            for(size_t inc{0}; inc < (RSP_ADDR6_IDX + 1); ++inc){
+                if(inc != 0)
+                    result.push_back(':');
+                appendNumber(result, ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + ipIdx + inc * sizeof(uint16_t)))), 16);
+            }
         }catch(const out_of_range& err){
            throw  string("DnsClient::extractAddr6FromResponse: Index Error.")\
-                        .append(to_string(socketptr->getRecvLen()))\
+                        .append(to_string(respLen))\
                         .append(" - ").append(err.what());
         }catch(TypesUtilsException& ex){
            throw  string("DnsClient::extractAddr6FromResponse: attempt to convert wrong data").append(ex.what());
@@ -733,37 +1344,32 @@ namespace dnsclient{
         }
     }
 
-    void  DnsBase::extractInfoTextFromResponse(size_t txtIdx, string& result)  anyexcept{
+    void  DnsBase::extractInfoTextFromResponse(size_t txtIdx, ArenaString& result)  anyexcept{
        try{
-           stringstream  sstr;
            size_t        len  { rsp.at(txtIdx) };
 
            for(size_t idx { txtIdx + 1 }; idx < txtIdx + 1 + len; ++idx)
-                  sstr << rsp.at(idx);
-
-           result = sstr.str();
+                  result.push_back(static_cast<char>(rsp.at(idx)));
 
        }catch(const out_of_range& err){
            throw string("DnsClient::extractInfoTextFromResponse: Index Error parsing resp section in response, rsp len: ")\
-                        .append(to_string(socketptr->getRecvLen()))\
+                        .append(to_string(respLen))\
                         .append(" - ").append(err.what());
        }catch(const string& err){
            throw string("DnsClient::extractInfoTextFromResponse :").append(err);
        }catch(...){
-           throw string("DnsClient::extractInfoTextFromResponse: Unexpected Error parsing resp section in response, rsp len: ").append(to_string(socketptr->getRecvLen()));
+           throw string("DnsClient::extractInfoTextFromResponse: Unexpected Error parsing resp section in response, rsp len: ").append(to_string(respLen));
        }
     }
 
-    void  DnsBase::extractSoaTextFromResponse(size_t blkIdx, string& result)  anyexcept{
+    void  DnsBase::extractSoaTextFromResponse(size_t blkIdx, ArenaString& result)  anyexcept{
        try{
-           stringstream  sstr;
-           string        soaLookup,
-                         mailRef;
+           blkIdx = extractTextFromResponse(blkIdx, result);
+           result.push_back(';');
+           blkIdx = extractTextFromResponse(blkIdx, result);
+           result.push_back(';');
 
-           blkIdx = extractTextFromResponse(blkIdx, soaLookup);
-           blkIdx = extractTextFromResponse(blkIdx, mailRef);
-
-           if((blkIdx + ( 5 * sizeof(uint32_t)) -1 ) >= safeSizeT(socketptr->getRecvLen()))
+           if((blkIdx + ( 5 * sizeof(uint32_t)) -1 ) >= respLen)
                throw  string("DnsClient::extractSoaTextFromResponse: Invalid Index: ").append(to_string(blkIdx + 1));
 
            uint32_t  serial  {  ntohl(*(reinterpret_cast<const uint32_t*>(rsp.data() + blkIdx))) };
@@ -777,28 +1383,27 @@ namespace dnsclient{
            uint32_t  minimum  {  ntohl(*(reinterpret_cast<const uint32_t*>(rsp.data() + blkIdx))) };
            blkIdx += sizeof(uint32_t);
 
-           sstr << soaLookup << ";" << mailRef << ";" << serial  << ";" 
-                << refresh   << ";" << retry   << ";" << expire  << ";"
-                << minimum   << ";";
-
-           result = sstr.str();
+           for(const uint32_t field : { serial, refresh, retry, expire, minimum }){
+               appendNumber(result, field);
+               result.push_back(';');
+           }
        }catch(const out_of_range& err){
            throw string("DnsClient::extractSoaTextFromResponse: Index Error parsing resp section in response, rsp len: ")\
-                        .append(to_string(socketptr->getRecvLen()))\
+                        .append(to_string(respLen))\
                         .append(" - ").append(err.what());
        }catch(const string& err){
            throw string("DnsClient::extractSoaTextFromResponse: ").append(err);
         }catch(TypesUtilsException& ex){
            throw  string("DnsClient::extractSoaTextFromResponse: attempt to convert wrong data").append(ex.what());
        }catch(...){
-           throw string("DnsClient::extractInfoTextFromResponse: Unexpected Error parsing resp section in response, rsp len: ").append(to_string(socketptr->getRecvLen()));
+           throw string("DnsClient::extractInfoTextFromResponse: Unexpected Error parsing resp section in response, rsp len: ").append(to_string(respLen));
        }
     }
 
-    size_t  DnsBase::extractTextFromResponse(size_t txtIdx, string& result)  anyexcept{
+    size_t  DnsBase::extractTextFromResponse(size_t txtIdx, ArenaString& result)  anyexcept{
        try{
            if(rsp.at(txtIdx) == 0){
-               result = "<ROOT>";
+               result.append("<ROOT>");
                return (txtIdx + sizeof(uint8_t));
            }
 
@@ -809,18 +1414,17 @@ namespace dnsclient{
            size_t        last      { isPtr  ? ptr + 1 + rsp.at(ptr)     : txtIdx + 1 + rsp.at(txtIdx)},
                          idx       { isPtr  ? ptr + 1                   : txtIdx + 1 },
                          next      { isPtr  ? txtIdx + sizeof(uint16_t) : txtIdx + 1 + rsp.at(txtIdx) };
-           stringstream  sstr;
 
            while(true){
 
                 for(;idx < last; ++idx)
-                    sstr << rsp.at(idx);
+                    result.push_back(static_cast<char>(rsp.at(idx)));
 
                 if(rsp.at( idx) == 0){
                     if(localIdx) next++;
                     break;
                 } 
-                sstr << "." ;
+                result.push_back(STD_SEPARATOR);
                 isPtr     =  checkPtr(idx, ptr);
                 last      =  isPtr  ? ptr + 1 + rsp.at(ptr) : idx + 1 + rsp.at(idx);
                 if(localIdx){
@@ -829,16 +1433,15 @@ namespace dnsclient{
                 }
                 idx       =  isPtr  ? ptr + 1               : idx + 1;
            }
-           result = sstr.str();
            return next;
        }catch(const out_of_range& err){
            throw string("DnsClient::extractTextFromResponse: Index Error parsing resp section in response, rsp len: ")\
-                        .append(to_string(socketptr->getRecvLen()))\
+                        .append(to_string(respLen))\
                         .append(" - ").append(err.what());
        }catch(const string& err){
            throw string("DnsClient::extractTextFromResponse: ").append(err);
        }catch(...){
-           throw string("DnsClient::extractTextFromResponse: Unexpected Error parsing resp section in response, rsp len: ").append(to_string(socketptr->getRecvLen()));
+           throw string("DnsClient::extractTextFromResponse: Unexpected Error parsing resp section in response, rsp len: ").append(to_string(respLen));
        }
     } 
 
@@ -852,11 +1455,11 @@ namespace dnsclient{
 
     size_t  DnsBase::getQuerysNo(void)  anyexcept{
         try{
-            const size_t idx   { static_cast<size_t>(DNS_QDCOUNT_IDX + (tcpQuery ? DNS_RESP_DATA_TCP_DELTA : 0))};
+            const size_t idx   { static_cast<size_t>(DNS_QDCOUNT_IDX) };
 
-            if( (idx + 1) >= safeSizeT(socketptr->getRecvLen()))
+            if( (idx + 1) >= respLen)
                  throw  string("DnsClient::getQuerysNo: Index Error, rsp len: ")\
-                              .append(to_string(socketptr->getRecvLen()))\
+                              .append(to_string(respLen))\
                               .append(" - idx: ").append(to_string(idx + 1));
             return ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + idx )));
         }catch(TypesUtilsException& ex){
@@ -866,11 +1469,11 @@ namespace dnsclient{
 
     size_t  DnsBase::getResponsesNo(void)  anyexcept{
         try{
-           const size_t idx   { static_cast<size_t>(DNS_ANCOUNT_IDX + (tcpQuery ? DNS_RESP_DATA_TCP_DELTA : 0)) };
+           const size_t idx   { static_cast<size_t>(DNS_ANCOUNT_IDX) };
 
-           if( (idx + 1) >= safeSizeT(socketptr->getRecvLen()))
+           if( (idx + 1) >= respLen)
                throw  string("DnsClient::getResponsesNo: Index Error, rsp len: ")\
-                            .append(to_string(socketptr->getRecvLen()))\
+                            .append(to_string(respLen))\
                             .append(" - idx: ").append(to_string(idx + 1));
 
            return ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + idx)));
@@ -881,11 +1484,11 @@ namespace dnsclient{
 
     size_t  DnsBase::getRRAuthNo(void) anyexcept{
         try{
-            const size_t idx   { static_cast<size_t>(DNS_NSCOUNT_IDX + (tcpQuery ? DNS_RESP_DATA_TCP_DELTA : 0)) };
+            const size_t idx   { static_cast<size_t>(DNS_NSCOUNT_IDX) };
 
-            if( (idx + 1) >= safeSizeT(socketptr->getRecvLen()))
+            if( (idx + 1) >= respLen)
                throw  string("DnsClient::getRRAuthNo: Index Error, rsp len: ")\
-                            .append(to_string(socketptr->getRecvLen()))\
+                            .append(to_string(respLen))\
                             .append(" - idx: ").append(to_string(idx + 1));
     
             return ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + idx)));
@@ -896,11 +1499,11 @@ namespace dnsclient{
 
     size_t  DnsBase::getRRAddNo(void)  anyexcept{
         try{
-            const size_t idx   { static_cast<size_t>(DNS_ARCOUNT_IDX + (tcpQuery ? DNS_RESP_DATA_TCP_DELTA : 0)) };
+            const size_t idx   { static_cast<size_t>(DNS_ARCOUNT_IDX) };
 
-            if( (idx + 1) >= safeSizeT(socketptr->getRecvLen()))
+            if( (idx + 1) >= respLen)
                throw  string("DnsClient::getRRAddNo: Index Error, rsp len: ")\
-                            .append(to_string(socketptr->getRecvLen()))\
+                            .append(to_string(respLen))\
                             .append(" - idx: ").append(to_string(idx + 1));
     
             return ntohs(*(reinterpret_cast<const uint16_t*>(rsp.data() + idx)));
@@ -912,46 +1515,25 @@ namespace dnsclient{
     DnsClient::DnsClient(string dns, string site)
         :     DnsClient()
     {
-        setSite(site);
-        setDNSserver(dns);
+        setSite(std::move(site));
+        setDNSserver(std::move(dns));
     }
 
     DnsClient::DnsClient(void)
            : bindVersion{"VERSION.BIND"},
-             emptyResponse{"empty response"},
-             rRToStringpMap{ make_pair(RR_TYPES_A,      "A"),
-                             make_pair(RR_TYPES_NS,     "NS"),
-                             make_pair(RR_TYPES_CNAME,  "CNAME"),
-                             make_pair(RR_TYPES_SOA,    "SOA"),
-                             make_pair(RR_TYPES_WKS,    "WKS"),
-                             make_pair(RR_TYPES_PTR,    "PTR"),
-                             make_pair(RR_TYPES_MX,     "MX"),
-                             make_pair(RR_TYPES_TXT,    "TXT"),
-                             make_pair(RR_TYPES_AAAA,   "AAAA"),
-                             make_pair(RR_TYPES_LOC,    "LOC"),
-                             make_pair(RR_TYPES_SRV,    "SRV")
-             },
-             stringToRRMap{ make_pair("A",       RR_TYPES_A),
-                            make_pair("NS",      RR_TYPES_NS),
-                            make_pair("CNAME",   RR_TYPES_CNAME),
-                            make_pair("SOA",     RR_TYPES_SOA),
-                            make_pair("WKS",     RR_TYPES_WKS),
-                            make_pair("PTR",     RR_TYPES_PTR),
-                            make_pair("TXT",     RR_TYPES_TXT),
-                            make_pair("AAAA",    RR_TYPES_AAAA),
-                            make_pair("LOC",     RR_TYPES_LOC),
-                            make_pair("SRV",     RR_TYPES_SRV)
-             } 
+             emptyResponse{"empty response"}
     {}
 
     const string  DnsClient::rrTypeToString(size_t rrcode) const noexcept{
-          auto entry { rRToStringpMap.find(rrcode) };
-          return entry != rRToStringpMap.end() ?  entry->second : to_string(rrcode);
+          auto entry { std::lower_bound(RR_NAMES_BY_CODE.begin(), RR_NAMES_BY_CODE.end(), rrcode,
+                                        [](const RRName& lhs, size_t code){ return lhs.second < code; }) };
+          return entry != RR_NAMES_BY_CODE.end() && entry->second == rrcode ?  string(entry->first) : to_string(rrcode);
     }
 
     size_t  DnsClient::rrStringToCode(const string& rrstring) const noexcept{
-          auto entry { stringToRRMap.find(rrstring) };
-          return entry != stringToRRMap.end() ?  entry->second : 0;
+          auto entry { std::lower_bound(RR_NAMES_BY_NAME.begin(), RR_NAMES_BY_NAME.end(), rrstring,
+                                        [](const RRName& lhs, const string& name){ return lhs.first < name; }) };
+          return entry != RR_NAMES_BY_NAME.end() && entry->first == rrstring ?  entry->second : 0;
     }
 
     #ifdef OFFENSIVE_REL
@@ -959,15 +1541,31 @@ namespace dnsclient{
     #endif
 
     void  DnsClient::setQueryType(QUERY_TYPE type) noexcept{
-         activeType  =  type;
+         activeType   =  type;
+         queryFooter  =  &getFooter(type);
     }
 
     bool  DnsClient::setQueryType(const string& descr)  noexcept{
-         auto  found  { queryTypeDescrToClass.find(descr) };
-         if(found == queryTypeDescrToClass.end())
+         auto  found  { std::lower_bound(QUERY_TYPE_DESCRS.begin(), QUERY_TYPE_DESCRS.end(), descr,
+                                         [](const QTypeDescr& lhs, const string& name){ return lhs.first < name; }) };
+         if(found == QUERY_TYPE_DESCRS.end() || found->first != descr)
             return false;
 
-         activeType  =  found->second;
+         setQueryType(found->second);
+         return true;
+    }
+
+    void  DnsClient::setQueryRR(uint16_t qtype, uint16_t qclass) noexcept{
+         customFooter  =  makeQueryFooter(qtype, qclass);
+         queryFooter   =  &customFooter;
+    }
+
+    bool  DnsClient::setQueryRR(const string& rrtype, uint16_t qclass) noexcept{
+         size_t  code  { rrStringToCode(rrtype) };
+         if(code == 0)
+            return false;
+
+         setQueryRR(static_cast<uint16_t>(code), qclass);
          return true;
     }
 
@@ -1021,7 +1619,7 @@ namespace dnsclient{
     }
 
     bool  DnsClient::isTimeout(void) const noexcept{
-        return socketptr->isTimeout();
+        return !cacheHit && socketptr != nullptr && socketptr->isTimeout();
     }
 
     const string&  DnsClient::getWarning(void) const noexcept{
@@ -1029,18 +1627,18 @@ namespace dnsclient{
     }
 
     uint8_t DnsClient::getReturnCode(void)  const noexcept{
-        return BitMaskHdlr::getMaskValue(DNS_RET.back(), rsp[DNS_RCODE_IDX]);
+        return respRcode;
     }
 
     double  DnsClient::getElapsedTime(void) const noexcept{
-        return socketptr->getElapsedTime();
+        return socketptr != nullptr ? socketptr->getElapsedTime() : 0.0;
     }
 
     const string&  DnsClient::getQueryTxtFromResp(void)  const noexcept{
         return queryTxt;
     }
 
-    const string&  DnsClient::getLastTxtFromResp(void)  const noexcept{
+    string_view  DnsClient::getLastTxtFromResp(void)  const noexcept{
         if(parsedResponse.size() != 0)
             return get<PARSED_RESP_DATA_IDX>(parsedResponse.back());
         else
@@ -1079,20 +1677,24 @@ namespace dnsclient{
         auto         entry  { responseTypeIdx.find(rrStringToCode(type)) };
 
         if(entry != responseTypeIdx.end())
-            return get<PARSED_RESP_DATA_IDX>(parsedResponse[entry->second.back()]);
+            return string(get<PARSED_RESP_DATA_IDX>(parsedResponse[entry->second.back()]));
 
         return emptyResponse;
     }
 
     ssize_t DnsClient::getRespLength(void) const noexcept{
-        return socketptr->getRecvLen();
+        return socketptr != nullptr ? socketptr->getRecvLen() : 0;
+    }
+
+    span<const uint8_t> DnsClient::getRawResponse(void) const noexcept{
+        return { rsp.data(), respLen };
     }
 
-    void DnsClient::assembleQuery(bool addLen, QUERY_TYPE qtype) anyexcept{
-         if(qtype == QUERY_TYPE::INFO_QUERY)
+    void DnsClient::assembleQuery(bool addLen) anyexcept{
+         if(activeType == QUERY_TYPE::INFO_QUERY)
              sitename = bindVersion;
          try{
-            DnsBase::assembleQuery(addLen, qtype);
+            DnsBase::assembleQuery(addLen);
          }catch(const string& err){
             throw string("DnsBase::assembleQuery: sitename: ").append(sitename)\
                          .append(": ").append(err);
@@ -1149,12 +1751,12 @@ namespace dnsclient{
     {}
 
     void DnsTraceroute::loop(void) anyexcept  {
+        setTranId();
         try{
-            assembleQuery(false, activeType);
+            assembleQuery();
         }catch(const string& err){
             throw string("DnsTraceroute::loop: can't assemble query buffer: ").append(err);
         }
-        setTranId();
 
         socketUdpTraceroute.sendMsg(queryAssembl, rsp);
     }
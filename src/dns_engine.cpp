@@ -0,0 +1,1485 @@
+// -----------------------------------------------------------------
+// libdnsquery - a library to interrogate DNSs and more.
+// Copyright (C) 2018-2023  Gabriele Bonacini
+//
+// This program is free software for no profit use; you can redistribute 
+// it and/or modify it under the terms of the GNU General Public License 
+// as published by the Free Software Foundation; either version 2 of 
+// the License, or (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// A commercial license is also available for a lucrative use.
+// -----------------------------------------------------------------
+
+#include <dns_engine.hpp>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef LINUX_OS
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace dnsengine{
+
+    using std::string,
+          std::span,
+          std::lock_guard,
+          std::mutex,
+          std::thread,
+          std::min,
+          std::make_unique,
+          std::memory_order_relaxed,
+          std::chrono::seconds,
+          std::chrono::milliseconds,
+          std::chrono::duration_cast,
+          dnsclient::DnsClient,
+          dnsclient::QueryResult,
+          dnsclient::QueryError,
+          dnsclient::QUERY_STATUS,
+          dnsclient::PARSED_RESP_NAME_IDX,
+          dnsclient::PARSED_RESP_TYPE_IDX,
+          dnsclient::PARSED_RESP_CLASS_IDX,
+          dnsclient::PARSED_RESP_TTL_IDX,
+          dnsclient::PARSED_RESP_LEN_IDX,
+          dnsclient::PARSED_RESP_DATA_IDX,
+          networkutils::Iovec,
+          networkutils::SocketUdpAsync,
+          networkutils::SocketTcpAsync,
+          networkutils::SOCK_STATUS;
+
+    namespace {
+
+        // The worker running on this thread, if any: its callbacks submit to it.
+        thread_local const ResolverEngine*  currentEngine  { nullptr };
+        thread_local size_t                 currentWorker  { 0 };
+
+        // RFC 5452 par. 9.1: a response is accepted only for the question it was asked.
+        bool  sameQuestion(span<const Iovec> segments, span<const uint8_t> response) noexcept{
+            using dnsclient::DNS_HEADER_SIZE;
+            if(segments.size() != 3 || response.size() < DNS_HEADER_SIZE ||
+               (response[dnsclient::DNS_QR_IDX] & 0x80) == 0 ||
+               response[dnsclient::DNS_QDCOUNT_IDX] != 0 || response[dnsclient::DNS_QDCOUNT_IDX + 1] != 1)
+                return false;
+
+            size_t  idx  { DNS_HEADER_SIZE };
+            for(const Iovec& segment : segments.subspan(1)){
+                const auto*  bytes  { static_cast<const uint8_t*>(segment.iov_base) };
+                if(idx + segment.iov_len > response.size())
+                    return false;
+                for(size_t pos { 0 }; pos < segment.iov_len; ++pos, ++idx)
+                    if(std::tolower(bytes[pos]) != std::tolower(response[idx]))
+                        return false;
+            }
+            return true;
+        }
+
+        size_t  workersFor(size_t requested) noexcept{
+            return requested != 0 ? requested : std::max(1u, thread::hardware_concurrency());
+        }
+
+        int64_t  toNanos(TimePoint point) noexcept{
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(point.time_since_epoch()).count();
+        }
+
+        // Timeouts, SERVFAIL and REFUSED are how an overloaded path or upstream shows.
+        WindowSignal  windowSignal(QUERY_STATUS status, uint8_t rcode) noexcept{
+            switch(status){
+                case QUERY_STATUS::QUERY_OK:
+                case QUERY_STATUS::QUERY_RCODE:
+                    return rcode == dnsclient::DNS_RCODE_SERVFAIL || rcode == dnsclient::DNS_RCODE_REFUSED
+                             ? WindowSignal::CONGESTED : WindowSignal::HEALTHY;
+                case QUERY_STATUS::QUERY_TIMEOUT:
+                    return WindowSignal::CONGESTED;
+                default:
+                    return WindowSignal::NEUTRAL;
+            }
+        }
+
+        void  deliver(EngineJob& job, EngineAnswer&& answer) noexcept{
+            try{
+                if(job.ring)
+                    job.ring->complete(job.tag, std::move(answer));
+                else if(job.done)
+                    job.done(std::move(answer));
+            }catch(...){
+                // A failing callback doesn't take the worker down.
+            }
+        }
+
+    } // End Anonymous Namespace
+
+    EngineWorker::EngineWorker(ResolverEngine& owner, size_t id) anyexcept
+        :  engine{owner},
+           workerId{id},
+           queueMtx{},
+           queue{},
+           queueLen{0},
+           sleeping{false},
+           stopping{false},
+           landed{false},
+           wakePipe{{ -1, -1 }},
+           sockets{},
+           fds{},
+           stalled(owner.getUpstreamsNo(), false),
+           order{},
+           slots{},
+           freeSlots{},
+           tcpSlots{},
+           inflight{},
+           parked{},
+           unsent{0},
+           sends{0},
+           throttledUntil{},
+           buffer{},
+           thread{}
+    {
+        sockets.reserve(owner.getUpstreamsNo());
+        for(const auto& upstream : owner.upstreams)
+            sockets.push_back(make_unique<SocketUdpAsync>(upstream->getServer()));
+        order.reserve(owner.getUpstreamsNo());
+
+        if(pipe(wakePipe.data()) == -1)
+            throw string("EngineWorker: can't create the wake up pipe: ").append(strerror(errno));
+        for(const int fd : wakePipe)
+            if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, nullptr) | O_NONBLOCK) == -1 ||
+               fcntl(fd, F_SETFD, FD_CLOEXEC) == -1){
+                const int  err  { errno };
+                close(wakePipe[0]);
+                close(wakePipe[1]);
+                throw string("EngineWorker: can't configure the wake up pipe: ").append(strerror(err));
+            }
+
+        fds.reserve(1 + sockets.size() + ENGINE_MAX_INFLIGHT);
+        fds.push_back({ wakePipe[0], POLLIN, 0 });
+        for(const auto& sock : sockets)
+            fds.push_back({ sock->getFd(), POLLIN, 0 });
+        slots.reserve(ENGINE_MAX_INFLIGHT);
+        freeSlots.reserve(ENGINE_MAX_INFLIGHT);
+        tcpSlots.reserve(ENGINE_MAX_INFLIGHT);
+        inflight.reserve(ENGINE_MAX_INFLIGHT);
+    }
+
+    EngineWorker::~EngineWorker(void){
+        stop();
+        close(wakePipe[0]);
+        close(wakePipe[1]);
+    }
+
+    void  EngineWorker::start(void) anyexcept{
+        try{
+            thread  =  std::thread(&EngineWorker::loop, this);
+        }catch(...){
+            throw string("EngineWorker::start: can't create the worker thread.");
+        }
+
+        #ifdef LINUX_OS
+        // Best effort: without the pinning the worker still runs, only less cache friendly.
+        const unsigned int  cores  { std::max(1u, thread::hardware_concurrency()) };
+        cpu_set_t           cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(workerId % cores, &cpus);
+        static_cast<void>(pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus));
+        #endif
+    }
+
+    void  EngineWorker::stop(void) noexcept{
+        stopping.store(true);
+        wake();
+        if(thread.joinable())
+            thread.join();
+    }
+
+    void  EngineWorker::push(EngineJob&& job) anyexcept{
+        if(stopping.load()){
+            reject(std::move(job), QUERY_STATUS::QUERY_INVALID, "ResolverEngine: stopped.");
+            return;
+        }
+
+        size_t  len  { 0 };
+        {
+            lock_guard<mutex>  lock  { queueMtx };
+            queue.push_back(std::move(job));
+            len  =  queue.size();
+            queueLen.store(len);
+        }
+
+        // A backlog on a busy worker is an occasion for an idle one to steal.
+        if(isSleeping())
+            wake();
+        else if(len > 1)
+            engine.balance(workerId);
+    }
+
+    size_t  EngineWorker::steal(JobQueue& dest) noexcept{
+        lock_guard<mutex>  lock  { queueMtx };
+        const size_t  taken  { (queue.size() + 1) / 2 };
+        for(size_t num { 0 }; num < taken; ++num){
+            dest.push_back(std::move(queue.back()));
+            queue.pop_back();
+        }
+        queueLen.store(queue.size());
+        return taken;
+    }
+
+    size_t  EngineWorker::queued(void) const noexcept{
+        return queueLen.load(memory_order_relaxed);
+    }
+
+    bool  EngineWorker::isSleeping(void) const noexcept{
+        return sleeping.load();
+    }
+
+    void  EngineWorker::wake(void) noexcept{
+        const uint8_t  byte  { 1 };
+        if(write(wakePipe[1], &byte, sizeof(byte)) == -1){
+            // A full pipe already holds a wake up.
+        }
+    }
+
+    void  EngineWorker::loop(void) noexcept{
+        currentEngine  =  &engine;
+        currentWorker  =  workerId;
+
+        while(!stopping.load()){
+            fill(Clock::now());
+            flush(Clock::now());
+
+            // The queue is checked again once the sleep is announced: a job pushed
+            // meanwhile either sees the flag and wakes the loop, or is seen here.
+            sleeping.store(true);
+            int  timeout  { pollTimeout(Clock::now()) };
+            // The same for the windows: an answer to a peer may have reopened one meanwhile.
+            if(((queueLen.load() > 0 || engine.hasRingWork()) && (!freeSlots.empty() || slots.size() < ENGINE_MAX_INFLIGHT)) ||
+               canSend(Clock::now()) || stopping.load())
+                timeout  =  0;
+
+            // A throttled worker waits for its next token or a place in a window, not for
+            // the sockets to be writable: only those found full are polled for that.
+            const bool  sending  { unsent > 0 && Clock::now() >= throttledUntil };
+            for(size_t up { 0 }; up < sockets.size(); ++up)
+                fds[up + 1].events  =  static_cast<short>(sending && stalled[up] ? POLLIN | POLLOUT : POLLIN);
+            // The tcp fallbacks follow the udp sockets, as many as are going on.
+            fds.resize(1 + sockets.size());
+            tcpSlots.clear();
+            for(size_t idx { 0 }; idx < slots.size(); ++idx)
+                if(slots[idx].busy && slots[idx].tcp){
+                    fds.push_back({ slots[idx].tcp->getFd(), static_cast<short>(slots[idx].tcp->wantsWrite() ? POLLOUT : POLLIN), 0 });
+                    tcpSlots.push_back(idx);
+                }
+            const int   ready    { poll(fds.data(), fds.size(), timeout) };
+            sleeping.store(false);
+
+            if(ready > 0 && (fds[0].revents & POLLIN) != 0){
+                uint8_t  drain[64];
+                while(read(wakePipe[0], drain, sizeof(drain)) > 0){}
+            }
+            for(size_t up { 0 }; ready > 0 && up < sockets.size(); ++up){
+                if((fds[up + 1].revents & POLLOUT) != 0)
+                    stalled[up]  =  false;
+                if((fds[up + 1].revents & (POLLIN | POLLERR)) != 0)
+                    receive(up);
+            }
+            for(size_t pos { 0 }; ready > 0 && pos < tcpSlots.size(); ++pos)
+                if(fds[1 + sockets.size() + pos].revents != 0)
+                    transfer(tcpSlots[pos]);
+            expire(Clock::now());
+            land(Clock::now());
+        }
+
+        shutdown();
+        currentEngine  =  nullptr;
+    }
+
+    void  EngineWorker::fill(TimePoint now) noexcept{
+        while(!freeSlots.empty() || slots.size() < ENGINE_MAX_INFLIGHT){
+            EngineJob  job;
+            bool       taken  { false };
+            {
+                lock_guard<mutex>  lock  { queueMtx };
+                if(!queue.empty()){
+                    job    =  std::move(queue.front());
+                    queue.pop_front();
+                    queueLen.store(queue.size());
+                    taken  =  true;
+                }
+            }
+
+            if(!taken){
+                // Nothing left here: half the backlog of the busiest worker moves over, the
+                // batches submitted to the rings come after the single queries. The own lock
+                // isn't held meanwhile, two workers may steal from each other.
+                JobQueue  stolen;
+                if(!engine.stealFor(workerId, stolen) &&
+                   engine.pullRings(freeSlots.size() + ENGINE_MAX_INFLIGHT - slots.size(), stolen) == 0)
+                    return;
+                lock_guard<mutex>  lock  { queueMtx };
+                std::move(stolen.begin(), stolen.end(), std::back_inserter(queue));
+                queueLen.store(queue.size());
+                continue;
+            }
+            dispatch(std::move(job), now);
+        }
+    }
+
+    void  EngineWorker::dispatch(EngineJob&& job, TimePoint now) noexcept{
+        // Abandoned while queued: answered without a slot, nor a packet.
+        if(job.query.cancel.stop_requested()){
+            reject(std::move(job), QUERY_STATUS::QUERY_CANCELLED, "ResolverEngine: cancelled.");
+            return;
+        }
+        if(job.query.deadline != TimePoint{} && job.query.deadline <= now){
+            reject(std::move(job), QUERY_STATUS::QUERY_TIMEOUT, "ResolverEngine: deadline exceeded.");
+            return;
+        }
+
+        size_t  idx  { 0 };
+        try{
+            if(freeSlots.empty()){
+                EngineSlot  slot;
+                slot.client  =  make_unique<DnsClient>();
+                slot.client->setDNSserver(engine.upstreams.front()->getServer());
+                slot.client->setTimeoutSecs(engine.getTimeoutSecs());
+                slot.client->setCache(engine.getCache());
+                slots.push_back(std::move(slot));
+                freeSlots.push_back(slots.size() - 1);
+            }
+        }catch(const string& err){
+            reject(std::move(job), QUERY_STATUS::QUERY_INVALID, err);
+            return;
+        }catch(...){
+            reject(std::move(job), QUERY_STATUS::QUERY_INVALID, "EngineWorker::dispatch: can't create the client.");
+            return;
+        }
+
+        idx  =  freeSlots.back();
+        freeSlots.pop_back();
+
+        EngineSlot&  slot    { slots[idx] };
+        DnsClient&   client  { *slot.client };
+        slot.job   =  std::move(job);
+        slot.busy  =  true;
+        slot.sent  =  false;
+        // A health probe must reach the upstream, not the cache.
+        if(const bool probe { slot.job.upstream != ENGINE_ANY_UPSTREAM }; probe != slot.uncached){
+            client.setCache(probe ? nullptr : engine.getCache());
+            slot.uncached  =  probe;
+        }
+        try{
+            client.setSite(slot.job.query.name);
+        }catch(const string& err){
+            complete(idx, client.abortQuery(QUERY_STATUS::QUERY_INVALID, err));
+            return;
+        }
+        client.setQueryRR(slot.job.query.qtype, slot.job.query.qclass);
+
+        // Transaction ids are unique among the queries on the wire: a clash draws another one.
+        bool         pending  { false };
+        QueryResult  result   { client.beginQuery(pending) };
+        for(size_t draws { 0 }; pending && inflight.contains(client.getTranId()) && draws < 8; ++draws)
+            result  =  client.beginQuery(pending);
+        if(!pending){
+            complete(idx, result);
+            return;
+        }
+        if(inflight.contains(client.getTranId())){
+            complete(idx, client.abortQuery(QUERY_STATUS::QUERY_INVALID, "EngineWorker::dispatch: no free transaction id."));
+            return;
+        }
+
+        // The engine timeout runs from the send: waiting for a token only counts against
+        // the caller's deadline. RFC 8767: with a stale answer at hand, the stale timeout.
+        slot.deadline  =  slot.job.query.deadline != TimePoint{} ? slot.job.query.deadline : TimePoint::max();
+        if(client.hasStale())
+            slot.deadline  =  min(slot.deadline, now + seconds(client.getStaleTimeoutSecs()));
+
+        // Single flight: a question already on the wire waits for that answer instead.
+        bool                 leader  { true };
+        dnscache::FlightPtr  flight  { client.joinFlight(leader) };
+        if(!leader){
+            park(idx, std::move(flight));
+            return;
+        }
+        slot.flight  =  std::move(flight);
+        inflight.emplace(client.getTranId(), idx);
+        if(slot.job.query.cancel.stop_possible()){
+            try{
+                slot.onCancel  =  make_unique<CancelCallback>(slot.job.query.cancel, CancelWaker{ this });
+            }catch(...){
+                // Still cancelled, once the loop comes around on its own.
+            }
+        }
+        ++unsent;
+    }
+
+    void  EngineWorker::flush(TimePoint now) noexcept{
+        if(now < throttledUntil)
+            return;
+
+        engine.rank(order);
+        TimePoint  retryAt  { TimePoint::max() };
+        bool       full     { false };
+        // The retries first, as they are late already: the slots are gone through twice.
+        for(size_t pos { 0 }; unsent > 0 && pos < 2 * slots.size(); ++pos){
+            const size_t  idx   { pos % slots.size() };
+            EngineSlot&   slot  { slots[idx] };
+            if(!slot.busy || slot.sent || slot.backingOff || slot.tcp || (slot.attempt > 0) != (pos < slots.size()))
+                continue;
+
+            // The best upstream with a token and room in its window, or another one first for
+            // a query in ENGINE_EXPLORE_EVERY; a retry tries the upstream that failed it last.
+            // With none left, the rest waits for an answer or a token, whichever worker gets
+            // it; the probes go where they are bound.
+            const bool    probe   { slot.job.upstream != ENGINE_ANY_UPSTREAM };
+            const size_t  failed  { slot.attempt > 0 && engine.retryPolicy.rotate ? slot.upstream : ENGINE_ANY_UPSTREAM };
+            size_t        target  { ENGINE_ANY_UPSTREAM };
+            if(probe){
+                if(reserve(slot.job.upstream, now, retryAt))
+                    target  =  slot.job.upstream;
+            }else if(!full){
+                if(order.size() > 1 && slot.attempt == 0 && sends % ENGINE_EXPLORE_EVERY == ENGINE_EXPLORE_EVERY - 1){
+                    const size_t  other  { order[1 + sends / ENGINE_EXPLORE_EVERY % (order.size() - 1)] };
+                    if(reserve(other, now, retryAt))
+                        target  =  other;
+                }
+                for(size_t pos { 0 }; target == ENGINE_ANY_UPSTREAM && pos < order.size(); ++pos)
+                    if(order[pos] != failed && reserve(order[pos], now, retryAt))
+                        target  =  order[pos];
+                if(target == ENGINE_ANY_UPSTREAM && failed != ENGINE_ANY_UPSTREAM && reserve(failed, now, retryAt))
+                    target  =  failed;
+                full  =  target == ENGINE_ANY_UPSTREAM;
+            }
+            if(target == ENGINE_ANY_UPSTREAM)
+                continue;
+
+            Upstream&   upstream  { *engine.upstreams[target] };
+            const auto  segments  { slot.client->getQuerySegments() };
+            switch(sockets[target]->trySend(segments.data(), segments.size())){
+                case SOCK_STATUS::SOCK_OK:
+                    slot.sent      =  true;
+                    slot.upstream  =  target;
+                    slot.sentAt    =  now;
+                    if(slot.attempt == 0)
+                        slot.deadline  =  min(slot.deadline, now + engine.queryBudget());
+                    slot.attemptEnd  =  slot.deadline;
+                    if(engine.retryPolicy.attempts > 1)
+                        slot.attemptEnd  =  min(slot.deadline, now + engine.attemptTimeout(upstream));
+                    --unsent;
+                    ++sends;
+                    upstream.sent();
+                    // Its stale answers are refreshed from the same upstream.
+                    if(slot.server != target){
+                        try{
+                            slot.client->setDNSserver(upstream.getServer());
+                            slot.server  =  target;
+                        }catch(...){
+                            // Only the refreshes go to the former one; tried again next time.
+                        }
+                    }
+                break;
+                case SOCK_STATUS::SOCK_TIMEOUT:
+                    // The socket buffer is full: it waits for POLLOUT, the query for any upstream.
+                    upstream.getLimiter().giveBack();
+                    upstream.getWindow().release(WindowSignal::NEUTRAL, now, now);
+                    stalled[target]  =  true;
+                break;
+                case SOCK_STATUS::SOCK_ERROR:
+                    upstream.getWindow().release(WindowSignal::NEUTRAL, now, now);
+                    upstream.record(QUERY_STATUS::QUERY_NET_ERROR, 0);
+                    --unsent;
+                    inflight.erase(slot.client->getTranId());
+                    complete(idx, slot.client->abortQuery(QUERY_STATUS::QUERY_NET_ERROR, sockets[target]->getErrorMsg()));
+                break;
+            }
+        }
+
+        // Left behind for a token: the worker sleeps until the first one is due.
+        if(unsent > 0 && retryAt != TimePoint::max())
+            throttledUntil  =  retryAt;
+    }
+
+    bool  EngineWorker::reserve(size_t up, TimePoint now, TimePoint& retryAt) noexcept{
+        Upstream&  upstream  { *engine.upstreams[up] };
+        if(stalled[up] || !upstream.getWindow().tryAcquire())
+            return false;
+
+        TimePoint  tokenAt  {};
+        if(!upstream.getLimiter().tryTake(now, tokenAt)){
+            upstream.getWindow().release(WindowSignal::NEUTRAL, now, now);
+            retryAt  =  min(retryAt, tokenAt);
+            return false;
+        }
+        return true;
+    }
+
+    bool  EngineWorker::canSend(TimePoint now) const noexcept{
+        if(unsent == 0 || now < throttledUntil)
+            return false;
+        return std::any_of(order.begin(), order.end(), [this](size_t up){
+            return !stalled[up] && engine.upstreams[up]->getWindow().hasRoom();
+        });
+    }
+
+    void  EngineWorker::receive(size_t up) noexcept{
+        // Bounded, so that a flood of junk can't starve the rest of the loop.
+        for(size_t reads { 0 }; reads < 2 * ENGINE_MAX_INFLIGHT; ++reads){
+            const ssize_t  len  { sockets[up]->tryRecv(buffer.data(), buffer.size()) };
+            if(len == 0)
+                return;
+            if(len < static_cast<ssize_t>(dnsclient::DNS_HEADER_SIZE))
+                continue;
+
+            const span<const uint8_t>  response  { buffer.data(), static_cast<size_t>(len) };
+            const uint16_t             id        { static_cast<uint16_t>(buffer[0] << 8 | buffer[1]) };
+            const auto                 found     { inflight.find(id) };
+            // Late, duplicated or forged: dropped, the query keeps waiting. A late answer to
+            // the attempt before a retry is still good while the retry isn't sent.
+            if(found == inflight.end() || slots[found->second].upstream != up ||
+               !(slots[found->second].sent || slots[found->second].backingOff) ||
+               !sameQuestion(slots[found->second].client->getQuerySegments(), response))
+                continue;
+
+            // Abandoned: expire() releases it in this same round, without a tcp fallback.
+            const size_t   idx    { found->second };
+            if(slots[idx].job.query.cancel.stop_requested())
+                continue;
+            const uint8_t  rcode  { static_cast<uint8_t>(buffer[dnsclient::DNS_RCODE_IDX] & 0x0f) };
+            if(slots[idx].sent && (rcode == dnsclient::DNS_RCODE_SERVFAIL || rcode == dnsclient::DNS_RCODE_REFUSED) &&
+               canRetry(slots[idx], true)){
+                retry(slots[idx], QUERY_STATUS::QUERY_RCODE, rcode, Clock::now());
+                continue;
+            }
+            inflight.erase(found);
+            settle(slots[idx], rcode == 0 ? QUERY_STATUS::QUERY_OK : QUERY_STATUS::QUERY_RCODE, rcode, Clock::now());
+
+            bool               pending  { false };
+            const QueryResult  result   { slots[idx].client->endQuery(response, pending) };
+            if(!pending){
+                complete(idx, result);
+                continue;
+            }
+
+            // The tcp fallback of a truncated answer goes to the same upstream, polled by the
+            // loop until the deadline of the whole query.
+            EngineSlot&  slot  { slots[idx] };
+            try{
+                const auto  segments  { slot.client->getQuerySegments() };
+                slot.tcp   =  make_unique<SocketTcpAsync>(engine.upstreams[up]->getServer(), segments.data(), segments.size());
+                slot.sent  =  false;
+            }catch(const string& err){
+                complete(idx, slot.client->abortQuery(QUERY_STATUS::QUERY_NET_ERROR, err));
+            }catch(...){
+                complete(idx, slot.client->abortQuery(QUERY_STATUS::QUERY_NET_ERROR, "EngineWorker::receive: can't open the tcp fallback."));
+            }
+        }
+    }
+
+    void  EngineWorker::transfer(size_t idx) noexcept{
+        EngineSlot&  slot  { slots[idx] };
+        // Abandoned: expire() releases it in this same round.
+        if(slot.job.query.cancel.stop_requested())
+            return;
+
+        switch(slot.tcp->advance()){
+            case SOCK_STATUS::SOCK_TIMEOUT:
+                return;
+            case SOCK_STATUS::SOCK_ERROR:
+                complete(idx, slot.client->abortQuery(QUERY_STATUS::QUERY_NET_ERROR, slot.tcp->getErrorMsg()));
+                return;
+            case SOCK_STATUS::SOCK_OK:
+            break;
+        }
+
+        bool  pending  { false };
+        complete(idx, slot.client->endQuery(slot.tcp->getResponse(), pending));
+    }
+
+    void  EngineWorker::expire(TimePoint now) noexcept{
+        const seconds  timeout  { engine.getTimeoutSecs() };
+        for(size_t idx { 0 }; idx < slots.size(); ++idx){
+            EngineSlot&  slot       { slots[idx] };
+            if(!slot.busy)
+                continue;
+
+            // A presumed loss is charged to the upstream and frees its place in the window at
+            // once, but keeps waiting for a late answer.
+            if(Upstream& upstream { *engine.upstreams[slot.upstream] };
+               slot.sent && !slot.lost && now - slot.sentAt >= upstream.getWindow().lossTimeout(timeout)){
+                slot.lost  =  true;
+                upstream.record(QUERY_STATUS::QUERY_TIMEOUT, 0);
+                if(upstream.getWindow().release(WindowSignal::CONGESTED, slot.sentAt, now))
+                    engine.wakeIdle();
+            }
+
+            const bool   cancelled  { slot.job.query.cancel.stop_requested() };
+            if(!cancelled && slot.deadline > now){
+                if(slot.sent && now >= slot.attemptEnd && canRetry(slot, false))
+                    retry(slot, QUERY_STATUS::QUERY_TIMEOUT, 0, now);
+                if(slot.backingOff && now >= slot.resendAt){
+                    slot.backingOff  =  false;
+                    ++unsent;
+                }
+                continue;
+            }
+
+            // On tcp, the transaction id went back with the truncated answer.
+            if(!slot.tcp){
+                if(!slot.sent && !slot.backingOff)
+                    --unsent;
+                inflight.erase(slot.client->getTranId());
+            }
+            settle(slot, cancelled ? QUERY_STATUS::QUERY_CANCELLED : QUERY_STATUS::QUERY_TIMEOUT, 0, now);
+            complete(idx, cancelled ? slot.client->abortQuery(QUERY_STATUS::QUERY_CANCELLED, "ResolverEngine: cancelled.")
+                                    : slot.client->abortQuery(QUERY_STATUS::QUERY_TIMEOUT, "ResolverEngine: timeout."));
+        }
+    }
+
+    // Probes are bound to their upstream, and a refusal is retried only where another may answer.
+    bool  EngineWorker::canRetry(const EngineSlot& slot, bool refused) const noexcept{
+        return slot.attempt + 1 < engine.retryPolicy.attempts && slot.job.upstream == ENGINE_ANY_UPSTREAM &&
+               (!refused || (engine.retryPolicy.rotate && engine.upstreams.size() > 1));
+    }
+
+    // The same query, transaction id included, goes again once the backoff is over; the
+    // attempt given up is charged to its upstream as a query finished.
+    void  EngineWorker::retry(EngineSlot& slot, QUERY_STATUS status, uint8_t rcode, TimePoint now) noexcept{
+        settle(slot, status, rcode, now);
+        slot.sent        =  false;
+        slot.lost        =  false;
+        slot.backingOff  =  true;
+        slot.resendAt    =  now + dnsclient::retryBackoff(engine.retryPolicy, ++slot.attempt);
+    }
+
+    int  EngineWorker::pollTimeout(TimePoint now) const noexcept{
+        const seconds  timeout  { engine.getTimeoutSecs() };
+        TimePoint      wakeAt   { now + milliseconds(ENGINE_IDLE_POLL_MS) };
+        for(const auto& item : parked)
+            if(item.job.query.deadline != TimePoint{})
+                wakeAt  =  min(wakeAt, item.job.query.deadline);
+        for(const auto& slot : slots){
+            if(!slot.busy)
+                continue;
+            wakeAt  =  min(wakeAt, slot.deadline);
+            if(slot.sent && !slot.lost)
+                wakeAt  =  min(wakeAt, slot.sentAt + engine.upstreams[slot.upstream]->getWindow().lossTimeout(timeout));
+            if(slot.sent && canRetry(slot, false))
+                wakeAt  =  min(wakeAt, slot.attemptEnd);
+            if(slot.backingOff)
+                wakeAt  =  min(wakeAt, slot.resendAt);
+        }
+        if(unsent > 0)
+            wakeAt  =  min(wakeAt, std::max(now, throttledUntil));
+
+        // Rounded up, not to spin on the last millisecond.
+        const auto  left  { duration_cast<milliseconds>(wakeAt - now + milliseconds(1) - Clock::duration(1)) };
+        return static_cast<int>(std::max<milliseconds::rep>(0, left.count()));
+    }
+
+    void  EngineWorker::complete(size_t idx, const QueryResult& result) noexcept{
+        EngineSlot&       slot    { slots[idx] };
+        const DnsClient&  client  { *slot.client };
+
+        // The followers ask again themselves when the leader gives up for reasons of its own.
+        if(slot.flight){
+            const bool  abandoned  { stopping.load() ||
+                                     (!result && (result.error().status == QUERY_STATUS::QUERY_CANCELLED ||
+                                                  (result.error().status == QUERY_STATUS::QUERY_TIMEOUT &&
+                                                   slot.deadline == slot.job.query.deadline))) };
+            client.endFlight(*slot.flight, result, abandoned);
+            slot.flight.reset();
+        }
+
+        EngineJob         job     { std::move(slot.job) };
+        EngineAnswer      answer  {};
+
+        answer.ok         =  result.has_value();
+        answer.error      =  answer.ok ? QueryError{ QUERY_STATUS::QUERY_OK, client.getReturnCode(), 0 } : result.error();
+        answer.cached     =  client.isFromCache();
+        answer.stale      =  client.isStale();
+        answer.answersNo  =  client.getAnswersNo();
+        try{
+            answer.query      =  std::move(job.query);
+            answer.lastError  =  answer.ok ? string() : client.getLastError();
+            answer.queryTxt   =  client.getQueryTxtFromResp();
+            answer.records.reserve(client.getParsedResponse().size());
+            for(const auto& rec : client.getParsedResponse())
+                answer.records.push_back({ string(std::get<PARSED_RESP_NAME_IDX>(rec)),  std::get<PARSED_RESP_TYPE_IDX>(rec),
+                                           std::get<PARSED_RESP_CLASS_IDX>(rec),         std::get<PARSED_RESP_TTL_IDX>(rec),
+                                           std::get<PARSED_RESP_LEN_IDX>(rec),           string(std::get<PARSED_RESP_DATA_IDX>(rec)) });
+        }catch(...){
+            answer.records.clear();
+            answer.ok         =  false;
+            answer.error      =  QueryError{ QUERY_STATUS::QUERY_INVALID, 0, 0 };
+            answer.lastError  =  "EngineWorker::complete: can't copy the response.";
+        }
+
+        // The slot is free before the callback runs, which may submit the next query.
+        slot.sent        =  false;
+        slot.lost        =  false;
+        slot.backingOff  =  false;
+        slot.attempt     =  0;
+        slot.onCancel.reset();
+        slot.tcp.reset();
+        slot.busy  =  false;
+        freeSlots.push_back(idx);
+
+        deliver(job, std::move(answer));
+    }
+
+    // The slot goes back at once: the query waits for the answer of the flight it follows.
+    void  EngineWorker::park(size_t idx, dnscache::FlightPtr&& flight) noexcept{
+        EngineSlot&  slot  { slots[idx] };
+        ParkedJob    item  { std::move(slot.job), std::move(flight), nullptr };
+        slot.busy  =  false;
+        freeSlots.push_back(idx);
+
+        bool  waiting  { false };
+        try{
+            parked.reserve(parked.size() + 1);
+            waiting  =  item.flight->park({ this, [this]{ landed.store(true); wake(); } });
+        }catch(...){
+            reject(std::move(item.job), QUERY_STATUS::QUERY_INVALID, "EngineWorker::park: can't wait for the flight.");
+            return;
+        }
+        if(!waiting){
+            follow(std::move(item.job), item.flight->wait());
+            return;
+        }
+
+        if(item.job.query.cancel.stop_possible()){
+            try{
+                item.onCancel  =  make_unique<CancelCallback>(item.job.query.cancel, CancelWaker{ this });
+            }catch(...){
+                // Still cancelled, once the loop comes around on its own.
+            }
+        }
+        parked.push_back(std::move(item));
+    }
+
+    // The parked queries whose flight landed, or that were cancelled or ran out of time meanwhile.
+    void  EngineWorker::land(TimePoint now) noexcept{
+        const bool  told  { landed.exchange(false) };
+        for(size_t pos { 0 }; pos < parked.size();){
+            const EngineQuery&  query      { parked[pos].job.query };
+            const bool          cancelled  { query.cancel.stop_requested() },
+                                expired    { query.deadline != TimePoint{} && query.deadline <= now };
+            if(!cancelled && !expired && !(told && parked[pos].flight->isDone())){
+                ++pos;
+                continue;
+            }
+
+            ParkedJob  item  { std::move(parked[pos]) };
+            if(pos + 1 != parked.size())
+                parked[pos]  =  std::move(parked.back());
+            parked.pop_back();
+            if(!cancelled && !expired){
+                follow(std::move(item.job), item.flight->wait());
+                continue;
+            }
+            item.flight->unpark(this);
+            reject(std::move(item.job), cancelled ? QUERY_STATUS::QUERY_CANCELLED : QUERY_STATUS::QUERY_TIMEOUT,
+                   cancelled ? "ResolverEngine: cancelled." : "ResolverEngine: deadline exceeded.");
+        }
+    }
+
+    // The answer of the leader, or the query goes back in the queue if it was abandoned.
+    void  EngineWorker::follow(EngineJob&& job, const dnscache::FlightResult& res) noexcept{
+        if(res.abandoned){
+            try{
+                push(std::move(job));
+            }catch(...){
+                reject(std::move(job), QUERY_STATUS::QUERY_INVALID, "EngineWorker::follow: can't queue the query again.");
+            }
+            return;
+        }
+
+        EngineAnswer  answer  {};
+        answer.ok         =  res.ok;
+        answer.error      =  res.error;
+        answer.stale      =  res.stale;
+        answer.answersNo  =  res.answersNo;
+        try{
+            answer.query      =  std::move(job.query);
+            answer.lastError  =  res.ok ? string() : res.lastError;
+            answer.queryTxt   =  res.queryTxt;
+            answer.records    =  res.records;
+        }catch(...){
+            answer.records.clear();
+            answer.ok         =  false;
+            answer.error      =  QueryError{ QUERY_STATUS::QUERY_INVALID, 0, 0 };
+            answer.lastError  =  "EngineWorker::follow: can't copy the response.";
+        }
+        deliver(job, std::move(answer));
+    }
+
+    // The upstream is charged with what came on the wire, before the cache may stand in for
+    // a lost answer. Only what was sent holds a place in the window, unless presumed lost:
+    // that one gave it back, and was charged with its timeout, already.
+    void  EngineWorker::settle(EngineSlot& slot, QUERY_STATUS status, uint8_t rcode, TimePoint now) noexcept{
+        if(!slot.sent)
+            return;
+
+        Upstream&  upstream  { *engine.upstreams[slot.upstream] };
+        if(!slot.lost && upstream.getWindow().release(windowSignal(status, rcode), slot.sentAt, now))
+            engine.wakeIdle();
+        if(!slot.lost || status != QUERY_STATUS::QUERY_TIMEOUT)
+            upstream.record(status, rcode);
+    }
+
+    void  EngineWorker::reject(EngineJob&& job, QUERY_STATUS status, const string& reason) noexcept{
+        EngineAnswer  answer  {};
+        answer.error  =  QueryError{ status, 0, 0 };
+        try{
+            answer.query      =  std::move(job.query);
+            answer.lastError  =  reason;
+        }catch(...){
+            // The answer goes anyway, without the reason.
+        }
+        deliver(job, std::move(answer));
+    }
+
+    void  EngineWorker::shutdown(void) noexcept{
+        // Nobody is left waiting: what is on the wire and what is queued fails at once.
+        for(size_t idx { 0 }; idx < slots.size(); ++idx)
+            if(slots[idx].busy){
+                settle(slots[idx], QUERY_STATUS::QUERY_INVALID, 0, Clock::now());
+                complete(idx, slots[idx].client->abortQuery(QUERY_STATUS::QUERY_INVALID, "ResolverEngine: stopped."));
+            }
+        inflight.clear();
+        unsent  =  0;
+        for(auto& item : parked){
+            item.flight->unpark(this);
+            reject(std::move(item.job), QUERY_STATUS::QUERY_INVALID, "ResolverEngine: stopped.");
+        }
+        parked.clear();
+
+        JobQueue  left;
+        {
+            lock_guard<mutex>  lock  { queueMtx };
+            left.swap(queue);
+            queueLen.store(0);
+        }
+        for(auto& job : left)
+            reject(std::move(job), QUERY_STATUS::QUERY_INVALID, "ResolverEngine: stopped.");
+    }
+
+    ResolverEngine::ResolverEngine(UpstreamList servers, size_t workersNo, dnsclient::CachePtr sharedCache, time_t tou,
+                                   RateLimit rateLimit, WindowLimit windowLimit, dnsclient::RetryPolicy retry) anyexcept
+        :  upstreams{},
+           cache{std::move(sharedCache)},
+           timeoutSecs{tou},
+           retryPolicy{retry},
+           workers{},
+           nextWorker{0},
+           prober{},
+           probeMtx{},
+           probeCv{},
+           probeStop{false},
+           ringsMtx{},
+           rings{},
+           ringsNo{0},
+           nextRing{0}
+    {
+        if(servers.empty())
+            throw string("ResolverEngine: no upstream given.");
+        workersNo  =  workersFor(workersNo);
+
+        try{
+            // The token bucket and the window of each upstream are shared by all the workers.
+            upstreams.reserve(servers.size());
+            for(auto& server : servers)
+                upstreams.push_back(make_unique<Upstream>(std::move(server), rateLimit, windowLimit,
+                                                          workersNo * ENGINE_MAX_INFLIGHT));
+            workers.reserve(workersNo);
+            for(size_t id { 0 }; id < workersNo; ++id)
+                workers.push_back(make_unique<EngineWorker>(*this, id));
+        }catch(const string& err){
+            throw string("ResolverEngine: ").append(err);
+        }catch(...){
+            throw string("ResolverEngine: can't create the workers.");
+        }
+        // Started once all exist: a worker steals from the others from its first loop.
+        for(auto& worker : workers)
+            worker->start();
+
+        // With a single upstream, there is no other to turn to: it is never out of rotation.
+        if(upstreams.size() > 1){
+            try{
+                prober  =  std::thread(&ResolverEngine::probe, this);
+            }catch(...){
+                for(auto& worker : workers)
+                    worker->stop();
+                throw string("ResolverEngine: can't create the health probe thread.");
+            }
+        }
+    }
+
+    ResolverEngine::ResolverEngine(string server, size_t workersNo, dnsclient::CachePtr sharedCache, time_t tou,
+                                   RateLimit rateLimit, WindowLimit windowLimit, dnsclient::RetryPolicy retry) anyexcept
+        :  ResolverEngine{UpstreamList{ std::move(server) }, workersNo, std::move(sharedCache), tou, rateLimit, windowLimit, retry}
+    {}
+
+    ResolverEngine::~ResolverEngine(void){
+        if(prober.joinable()){
+            {
+                lock_guard<mutex>  lock  { probeMtx };
+                probeStop  =  true;
+            }
+            probeCv.notify_all();
+            prober.join();
+        }
+        for(auto& worker : workers)
+            worker->stop();
+    }
+
+    void  ResolverEngine::submit(EngineQuery query, EngineCallback done) anyexcept{
+        const size_t  target  { currentEngine == this ? currentWorker
+                                                      : nextWorker.fetch_add(1, memory_order_relaxed) % workers.size() };
+        try{
+            workers[target]->push(EngineJob{ std::move(query), std::move(done), nullptr, 0, ENGINE_ANY_UPSTREAM });
+        }catch(...){
+            throw string("ResolverEngine::submit: can't queue the query.");
+        }
+    }
+
+    QueryAwaiter  ResolverEngine::query(string name, uint16_t qtype, uint16_t qclass) noexcept{
+        return QueryAwaiter{ *this, EngineQuery{ std::move(name), qtype, qclass, {}, {} } };
+    }
+
+    QueryAwaiter  ResolverEngine::query(EngineQuery qry) noexcept{
+        return QueryAwaiter{ *this, std::move(qry) };
+    }
+
+    bool  ResolverEngine::stealFor(size_t thief, JobQueue& dest) noexcept{
+        size_t  victim  { thief },
+                most    { 0 };
+        for(size_t id { 0 }; id < workers.size(); ++id)
+            if(const size_t len { workers[id]->queued() }; id != thief && len > most){
+                most    =  len;
+                victim  =  id;
+            }
+
+        return most > 0 && workers[victim]->steal(dest) > 0;
+    }
+
+    void  ResolverEngine::balance(size_t loaded) noexcept{
+        for(size_t id { 0 }; id < workers.size(); ++id)
+            if(id != loaded && workers[id]->isSleeping()){
+                workers[id]->wake();
+                return;
+            }
+    }
+
+    void  ResolverEngine::attach(const RingStatePtr& ring) anyexcept{
+        std::unique_lock  lock  { ringsMtx };
+        rings.push_back(ring);
+        ringsNo.store(rings.size());
+    }
+
+    void  ResolverEngine::detach(const RingStatePtr& ring) noexcept{
+        // Exclusive: once back, no worker is pulling from the ring.
+        std::unique_lock  lock  { ringsMtx };
+        std::erase(rings, ring);
+        ringsNo.store(rings.size());
+    }
+
+    size_t  ResolverEngine::pullRings(size_t max, JobQueue& dest) noexcept{
+        if(ringsNo.load() == 0)
+            return 0;
+
+        std::shared_lock  lock   { ringsMtx };
+        const size_t      first  { nextRing.fetch_add(1, memory_order_relaxed) };
+        size_t            taken  { 0 };
+        for(size_t num { 0 }; num < rings.size() && taken < max; ++num){
+            const RingStatePtr&  ring  { rings[(first + num) % rings.size()] };
+            RingRequest          request;
+            while(taken < max && ring->pull(request)){
+                try{
+                    dest.push_back(EngineJob{ std::move(request.query), {}, ring, request.tag, ENGINE_ANY_UPSTREAM });
+                }catch(...){
+                    EngineAnswer  answer  {};
+                    answer.error  =  QueryError{ QUERY_STATUS::QUERY_INVALID, 0, 0 };
+                    ring->complete(request.tag, std::move(answer));
+                }
+                ++taken;
+            }
+        }
+        return taken;
+    }
+
+    bool  ResolverEngine::hasRingWork(void) noexcept{
+        if(ringsNo.load() == 0)
+            return false;
+
+        std::shared_lock  lock  { ringsMtx };
+        return std::any_of(rings.begin(), rings.end(), [](const RingStatePtr& ring){ return ring->queued.load() > 0; });
+    }
+
+    void  ResolverEngine::wakeIdle(void) noexcept{
+        for(auto& worker : workers)
+            if(worker->isSleeping())
+                worker->wake();
+    }
+
+    void  ResolverEngine::rank(UpstreamOrder& order) const noexcept{
+        // No allocation: the order has room for all the upstreams.
+        order.clear();
+        for(size_t idx { 0 }; idx < upstreams.size(); ++idx)
+            if(upstreams[idx]->isAlive())
+                order.push_back(idx);
+        // All out of rotation: the least bad of them rather than none.
+        if(order.empty())
+            for(size_t idx { 0 }; idx < upstreams.size(); ++idx)
+                order.push_back(idx);
+
+        if(order.size() > 1){
+            const seconds  timeout  { timeoutSecs };
+            std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs){
+                return upstreams[lhs]->cost(timeout) < upstreams[rhs]->cost(timeout);
+            });
+        }
+    }
+
+    void  ResolverEngine::probe(void) noexcept{
+        std::unique_lock  lock  { probeMtx };
+        while(!probeCv.wait_for(lock, milliseconds(ENGINE_PROBE_MS), [this](){ return probeStop; })){
+            for(size_t idx { 0 }; idx < upstreams.size(); ++idx){
+                // One probe at a time: a dead upstream may take the whole timeout to fail it.
+                Upstream&  upstream  { *upstreams[idx] };
+                if(upstream.isAlive() || !upstream.startProbe())
+                    continue;
+                try{
+                    const size_t  target  { nextWorker.fetch_add(1, memory_order_relaxed) % workers.size() };
+                    workers[target]->push(EngineJob{ EngineQuery{ ENGINE_PROBE_NAME, dnsclient::RR_TYPES_A, dnsclient::CLASS_IN, {}, {} },
+                                                     [&upstream](EngineAnswer&&){ upstream.endProbe(); }, nullptr, 0, idx });
+                }catch(...){
+                    upstream.endProbe();
+                }
+            }
+        }
+    }
+
+    size_t  ResolverEngine::getWorkersNo(void) const noexcept{
+        return workers.size();
+    }
+
+    const string&  ResolverEngine::getServer(void) const noexcept{
+        return upstreams.front()->getServer();
+    }
+
+    size_t  ResolverEngine::getUpstreamsNo(void) const noexcept{
+        return upstreams.size();
+    }
+
+    UpstreamStatsList  ResolverEngine::getStats(void) const anyexcept{
+        UpstreamStatsList  stats;
+        stats.reserve(upstreams.size());
+        for(const auto& upstream : upstreams)
+            stats.push_back(upstream->getStats());
+        return stats;
+    }
+
+    time_t  ResolverEngine::getTimeoutSecs(void) const noexcept{
+        return timeoutSecs;
+    }
+
+    const dnsclient::RetryPolicy&  ResolverEngine::getRetryPolicy(void) const noexcept{
+        return retryPolicy;
+    }
+
+    Clock::duration  ResolverEngine::queryBudget(void) const noexcept{
+        return retryPolicy.deadlineMs != 0 ? Clock::duration(milliseconds(retryPolicy.deadlineMs)) : Clock::duration(seconds(timeoutSecs));
+    }
+
+    Clock::duration  ResolverEngine::attemptTimeout(const Upstream& upstream) const noexcept{
+        if(retryPolicy.timeoutMs != 0)
+            return milliseconds(retryPolicy.timeoutMs);
+        if(upstream.getWindow().smoothedRtt() == Clock::duration::zero())
+            return min<Clock::duration>(milliseconds(ENGINE_RETRY_RTO_MS), queryBudget());
+        return upstream.getWindow().lossTimeout(queryBudget());
+    }
+
+    const dnsclient::CachePtr&  ResolverEngine::getCache(void) const noexcept{
+        return cache;
+    }
+
+    double  ResolverEngine::getWindow(size_t upstream) const noexcept{
+        return upstream < upstreams.size() ? upstreams[upstream]->getWindow().getWindow() : 0;
+    }
+
+    TokenBucket::TokenBucket(RateLimit limit) noexcept
+        :  interval{0},
+           tolerance{0},
+           arrival{0}
+    {
+        if(limit.qps <= 0)
+            return;
+
+        constexpr double  NANOS  { 1'000'000'000.0 };
+        interval   =  std::max<int64_t>(1, static_cast<int64_t>(NANOS / limit.qps));
+        // One more than the queries in a millisecond: the sleep of a worker, rounded up to
+        // the millisecond, would otherwise lose the difference on every token.
+        const size_t  burst  { limit.burst > 0 ? limit.burst : 2 + static_cast<size_t>(limit.qps / 1'000) };
+        tolerance  =  static_cast<int64_t>(burst - 1) * interval;
+    }
+
+    bool  TokenBucket::tryTake(TimePoint now, TimePoint& retryAt) noexcept{
+        if(interval == 0)
+            return true;
+
+        const int64_t  nowNs    { std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count() };
+        int64_t        current  { arrival.load(memory_order_relaxed) };
+        for(;;){
+            // Behind schedule after a pause: the credit is capped by the tolerance, the burst.
+            const int64_t  due  { std::max(current, nowNs) };
+            if(due - nowNs > tolerance){
+                retryAt  =  TimePoint(std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(due - tolerance)));
+                return false;
+            }
+            if(arrival.compare_exchange_weak(current, due + interval, memory_order_relaxed))
+                return true;
+        }
+    }
+
+    void  TokenBucket::giveBack(void) noexcept{
+        if(interval != 0)
+            arrival.fetch_sub(interval, memory_order_relaxed);
+    }
+
+    bool  TokenBucket::isLimited(void) const noexcept{
+        return interval != 0;
+    }
+
+    CongestionWindow::CongestionWindow(WindowLimit limit, size_t slots) noexcept
+        :  minWindow{static_cast<double>(std::clamp<size_t>(limit.min, 1, slots))},
+           maxWindow{static_cast<double>(limit.max != 0 ? std::clamp<size_t>(limit.max, 1, slots) : slots)},
+           window{0},
+           inflight{0},
+           blocked{false},
+           fastestNs{INT64_MAX},
+           decreasedNs{INT64_MIN},
+           srttNs{0},
+           rttvarNs{0}
+    {
+        maxWindow  =  std::max(minWindow, maxWindow);
+        window.store(std::clamp(static_cast<double>(limit.initial), minWindow, maxWindow));
+    }
+
+    bool  CongestionWindow::tryAcquire(void) noexcept{
+        size_t  current  { inflight.load() };
+        do{
+            if(static_cast<double>(current) >= window.load(memory_order_relaxed)){
+                blocked.store(true);
+                return false;
+            }
+        }while(!inflight.compare_exchange_weak(current, current + 1));
+        return true;
+    }
+
+    bool  CongestionWindow::release(WindowSignal signal, TimePoint sentAt, TimePoint now) noexcept{
+        inflight.fetch_sub(1);
+
+        const int64_t  sentNs  { toNanos(sentAt) },
+                       rttNs   { toNanos(now) - sentNs };
+        double         current { window.load(memory_order_relaxed) };
+        switch(signal){
+            case WindowSignal::HEALTHY:{
+                int64_t  fastest  { fastestNs.load(memory_order_relaxed) };
+                while(rttNs < fastest && !fastestNs.compare_exchange_weak(fastest, rttNs, memory_order_relaxed)){}
+
+                // RFC 6298 estimators; updates racing between workers only add some noise.
+                const int64_t  srtt  { srttNs.load(memory_order_relaxed) };
+                if(srtt == 0){
+                    srttNs.store(rttNs, memory_order_relaxed);
+                    rttvarNs.store(rttNs / 2, memory_order_relaxed);
+                }else{
+                    rttvarNs.store((3 * rttvarNs.load(memory_order_relaxed) + std::abs(srtt - rttNs)) / 4, memory_order_relaxed);
+                    srttNs.store((7 * srtt + rttNs) / 8, memory_order_relaxed);
+                }
+
+                if(static_cast<double>(rttNs) > ENGINE_WINDOW_LATENCY * static_cast<double>(std::min(fastest, rttNs)))
+                    break;
+                while(current < maxWindow &&
+                      !window.compare_exchange_weak(current, std::min(maxWindow, current + 1.0 / current), memory_order_relaxed)){}
+            }
+            break;
+            case WindowSignal::CONGESTED:{
+                int64_t  decreased  { decreasedNs.load(memory_order_relaxed) };
+                if(sentNs < decreased || !decreasedNs.compare_exchange_strong(decreased, toNanos(now), memory_order_relaxed))
+                    break;
+                while(!window.compare_exchange_weak(current, std::max(minWindow, current / 2), memory_order_relaxed)){}
+            }
+            break;
+            case WindowSignal::NEUTRAL:
+            break;
+        }
+
+        // A worker found the window full: it has room again.
+        return blocked.load(memory_order_relaxed) && blocked.exchange(false);
+    }
+
+    Clock::duration  CongestionWindow::lossTimeout(Clock::duration ceiling) const noexcept{
+        // Without a sample there is no estimate: only the engine timeout applies.
+        const int64_t  srtt  { srttNs.load(memory_order_relaxed) };
+        if(srtt == 0)
+            return ceiling;
+
+        const auto  rto  { std::chrono::nanoseconds(srtt + 4 * rttvarNs.load(memory_order_relaxed)) };
+        return std::clamp<Clock::duration>(std::chrono::duration_cast<Clock::duration>(rto),
+                                           milliseconds(ENGINE_WINDOW_RTO_MS), std::max<Clock::duration>(ceiling, milliseconds(ENGINE_WINDOW_RTO_MS)));
+    }
+
+    Clock::duration  CongestionWindow::smoothedRtt(void) const noexcept{
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::nanoseconds(srttNs.load(memory_order_relaxed)));
+    }
+
+    bool  CongestionWindow::hasRoom(void) const noexcept{
+        return static_cast<double>(inflight.load()) < window.load(memory_order_relaxed);
+    }
+
+    double  CongestionWindow::getWindow(void) const noexcept{
+        return window.load(memory_order_relaxed);
+    }
+
+    size_t  CongestionWindow::getInflight(void) const noexcept{
+        return inflight.load(memory_order_relaxed);
+    }
+
+    Upstream::Upstream(string srv, RateLimit rateLimit, WindowLimit windowLimit, size_t slots) anyexcept
+        :  server{std::move(srv)},
+           limiter{rateLimit},
+           window{windowLimit, slots},
+           timeoutRate{0},
+           failures{0},
+           alive{true},
+           probing{false},
+           queries{0},
+           timeouts{0},
+           rcodes{}
+    {}
+
+    void  Upstream::sent(void) noexcept{
+        queries.fetch_add(1, memory_order_relaxed);
+    }
+
+    void  Upstream::record(QUERY_STATUS status, uint8_t rcode) noexcept{
+        bool  failed  { true };
+        switch(status){
+            case QUERY_STATUS::QUERY_OK:
+            case QUERY_STATUS::QUERY_RCODE:
+                rcodes[rcode & 0x0f].fetch_add(1, memory_order_relaxed);
+                failed  =  rcode == dnsclient::DNS_RCODE_REFUSED;
+            break;
+            case QUERY_STATUS::QUERY_TIMEOUT:
+                timeouts.fetch_add(1, memory_order_relaxed);
+            break;
+            case QUERY_STATUS::QUERY_NET_ERROR:
+            break;
+            default:
+                // Cancelled or stopped: nothing learnt about the upstream.
+                return;
+        }
+
+        // EWMA with a weight of 1/16 per query: a few dozens of them move it.
+        const double  sample  { status == QUERY_STATUS::QUERY_TIMEOUT ? 1.0 : 0.0 };
+        double        rate    { timeoutRate.load(memory_order_relaxed) };
+        while(!timeoutRate.compare_exchange_weak(rate, rate + (sample - rate) / 16, memory_order_relaxed)){}
+
+        if(failed){
+            if(failures.fetch_add(1, memory_order_relaxed) + 1 >= ENGINE_DEAD_FAILURES)
+                alive.store(false);
+            return;
+        }
+        failures.store(0, memory_order_relaxed);
+        // Back in rotation with a clean slate: the timeouts that took it out are history.
+        if(!alive.load(memory_order_relaxed) && !alive.exchange(true))
+            timeoutRate.store(0, memory_order_relaxed);
+    }
+
+    double  Upstream::cost(Clock::duration timeout) const noexcept{
+        // The expected wait of a query: an upstream never measured is tried first.
+        return static_cast<double>(window.smoothedRtt().count()) +
+               timeoutRate.load(memory_order_relaxed) * static_cast<double>(timeout.count());
+    }
+
+    bool  Upstream::isAlive(void) const noexcept{
+        return alive.load();
+    }
+
+    bool  Upstream::startProbe(void) noexcept{
+        return !probing.exchange(true);
+    }
+
+    void  Upstream::endProbe(void) noexcept{
+        probing.store(false);
+    }
+
+    UpstreamStats  Upstream::getStats(void) const anyexcept{
+        UpstreamStats  stats;
+        stats.server       =  server;
+        stats.latencyMs    =  std::chrono::duration<double, std::milli>(window.smoothedRtt()).count();
+        stats.timeoutRate  =  timeoutRate.load(memory_order_relaxed);
+        stats.window       =  window.getWindow();
+        stats.queries      =  queries.load(memory_order_relaxed);
+        stats.timeouts     =  timeouts.load(memory_order_relaxed);
+        for(size_t idx { 0 }; idx < rcodes.size(); ++idx)
+            stats.rcodes[idx]  =  rcodes[idx].load(memory_order_relaxed);
+        stats.alive        =  alive.load();
+        return stats;
+    }
+
+    const string&  Upstream::getServer(void) const noexcept{
+        return server;
+    }
+
+    TokenBucket&  Upstream::getLimiter(void) noexcept{
+        return limiter;
+    }
+
+    CongestionWindow&  Upstream::getWindow(void) noexcept{
+        return window;
+    }
+
+    const CongestionWindow&  Upstream::getWindow(void) const noexcept{
+        return window;
+    }
+
+    void  CancelWaker::operator()(void) const noexcept{
+        worker->wake();
+    }
+
+    RingState::RingState(size_t entries) anyexcept
+        :  submissions{entries},
+           completions{entries},
+           outstanding{0},
+           queued{0},
+           ready{0},
+           waiters{0},
+           waitMtx{},
+           waitCv{}
+    {}
+
+    bool  RingState::pull(RingRequest& request) noexcept{
+        if(queued.load() == 0 || !submissions.pop(request))
+            return false;
+        queued.fetch_sub(1);
+        return true;
+    }
+
+    void  RingState::complete(uint64_t tag, EngineAnswer&& answer) noexcept{
+        // Can't fail: no more than its capacity is ever submitted and not reaped.
+        static_cast<void>(completions.push(RingCompletion{ std::move(answer), tag }));
+        ready.fetch_add(1);
+        // Paired with reap(): either the waiter is seen here, or the new total there.
+        if(waiters.load() > 0){
+            lock_guard<mutex>  lock  { waitMtx };
+            waitCv.notify_all();
+        }
+    }
+
+    EngineRing::EngineRing(ResolverEngine& owner, size_t entries) anyexcept
+        :  engine{owner},
+           state{}
+    {
+        try{
+            state  =  std::make_shared<RingState>(entries);
+            engine.attach(state);
+        }catch(const string& err){
+            throw string("EngineRing: ").append(err);
+        }catch(...){
+            throw string("EngineRing: can't create the queues.");
+        }
+    }
+
+    EngineRing::~EngineRing(void){
+        // What is in flight completes on the state, which goes with the last query.
+        engine.detach(state);
+    }
+
+    size_t  EngineRing::submit(span<RingRequest> requests) noexcept{
+        // The room is reserved first: submitters never overfill the completion queue.
+        size_t  taken  { 0 },
+                used   { state->outstanding.load() };
+        do{
+            taken  =  min(requests.size(), capacity() - min(used, capacity()));
+        }while(taken > 0 && !state->outstanding.compare_exchange_weak(used, used + taken));
+        if(taken == 0)
+            return 0;
+
+        for(size_t idx { 0 }; idx < taken; ++idx)
+            static_cast<void>(state->submissions.push(std::move(requests[idx])));
+        state->queued.fetch_add(taken);
+        engine.wakeIdle();
+        return taken;
+    }
+
+    size_t  EngineRing::reap(span<RingCompletion> dest, size_t waitFor, int timeoutMs) noexcept{
+        const size_t  wanted  { min({ waitFor, dest.size(), state->outstanding.load() }) };
+        if(state->ready.load() < wanted){
+            const auto  enough  { [&](){ return state->ready.load() >= wanted; } };
+            state->waiters.fetch_add(1);
+            {
+                std::unique_lock  lock  { state->waitMtx };
+                if(timeoutMs < 0)
+                    state->waitCv.wait(lock, enough);
+                else
+                    state->waitCv.wait_for(lock, milliseconds(timeoutMs), enough);
+            }
+            state->waiters.fetch_sub(1);
+        }
+
+        // Only what is counted: a completion still being pushed is left for the next call.
+        const size_t  avail  { min(dest.size(), state->ready.load()) };
+        size_t        reaped { 0 };
+        while(reaped < avail && state->completions.pop(dest[reaped]))
+            ++reaped;
+        state->ready.fetch_sub(reaped);
+        state->outstanding.fetch_sub(reaped);
+        return reaped;
+    }
+
+    size_t  EngineRing::pending(void) const noexcept{
+        return state->outstanding.load();
+    }
+
+    size_t  EngineRing::capacity(void) const noexcept{
+        return state->completions.capacity();
+    }
+
+    QueryAwaiter::QueryAwaiter(ResolverEngine& owner, EngineQuery qry) noexcept
+        :  engine{owner},
+           query{std::move(qry)},
+           answer{}
+    {}
+
+    bool  QueryAwaiter::await_ready(void) const noexcept{
+        return false;
+    }
+
+    void  QueryAwaiter::await_suspend(std::coroutine_handle<> handle) anyexcept{
+        // Once submitted, the awaiter belongs to the worker: it may resume the coroutine,
+        // and so destroy this object, before submit() even returns here.
+        engine.submit(std::move(query), [this, handle](EngineAnswer&& result){
+            answer  =  std::move(result);
+            handle.resume();
+        });
+    }
+
+    EngineAnswer  QueryAwaiter::await_resume(void) noexcept{
+        return std::move(answer);
+    }
+
+} // End Namespace
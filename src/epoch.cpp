@@ -0,0 +1,155 @@
+// -----------------------------------------------------------------
+// libdnsquery - a library to interrogate DNSs and more.
+// Copyright (C) 2018-2023  Gabriele Bonacini
+//
+// This program is free software for no profit use; you can redistribute 
+// it and/or modify it under the terms of the GNU General Public License 
+// as published by the Free Software Foundation; either version 2 of 
+// the License, or (at your option) any later version.
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation,
+// Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+// A commercial license is also available for a lucrative use.
+// -----------------------------------------------------------------
+
+#include <epoch.hpp>
+
+#include <algorithm>
+
+namespace epochutils{
+
+    using std::lock_guard,
+          std::mutex,
+          std::memory_order_relaxed,
+          std::memory_order_release,
+          std::memory_order_seq_cst;
+
+    namespace {
+
+        // Every thread keeps its slot until it exits; nested guards share it.
+        class ReaderRecord{
+            public:
+               ReaderSlot*    slot   { nullptr };
+               bool           overflow { false };
+               unsigned int   depth  { 0 };
+
+                              ~ReaderRecord(void){
+                                  if(slot != nullptr)
+                                      slot->used.store(false, memory_order_release);
+                              }
+        };
+
+        thread_local ReaderRecord  readerRecord;
+
+    } // End Anonymous Namespace
+
+    EpochDomain::EpochDomain(void) noexcept
+        :  slots{},
+           globalEpoch{0},
+           overflowReaders{0},
+           retiredMtx{},
+           retired{}
+    {}
+
+    EpochDomain::~EpochDomain(void){
+        for(const auto& obj : retired)
+            obj.deleter(obj.ptr);
+    }
+
+    EpochDomain&  EpochDomain::getInstance(void) noexcept{
+        #if defined __clang_major__ &&  __clang_major__ >= 4 
+        #pragma clang diagnostic push 
+        #pragma clang diagnostic ignored "-Wexit-time-destructors"
+        #endif
+
+        static  EpochDomain  domain;
+
+        #ifdef __clang__
+        #pragma clang diagnostic pop
+        #endif
+
+        return  domain;
+    }
+
+    ReaderSlot*  EpochDomain::acquireSlot(void) noexcept{
+        for(auto& slot : slots){
+            bool  expected  { false };
+            if(!slot.used.load(memory_order_relaxed) && slot.used.compare_exchange_strong(expected, true))
+                return &slot;
+        }
+        return nullptr;
+    }
+
+    void  EpochDomain::enter(void) noexcept{
+        if(readerRecord.depth++ != 0)
+            return;
+
+        if(readerRecord.slot == nullptr)
+            readerRecord.slot  =  acquireSlot();
+
+        if(readerRecord.slot == nullptr){
+            readerRecord.overflow  =  true;
+            overflowReaders.fetch_add(1, memory_order_seq_cst);
+        }else{
+            // The announcement must be visible before any shared pointer is loaded.
+            readerRecord.slot->epoch.store(globalEpoch.load(memory_order_seq_cst), memory_order_seq_cst);
+        }
+    }
+
+    void  EpochDomain::leave(void) noexcept{
+        if(--readerRecord.depth != 0)
+            return;
+
+        if(readerRecord.overflow){
+            readerRecord.overflow  =  false;
+            overflowReaders.fetch_sub(1, memory_order_release);
+        }else{
+            readerRecord.slot->epoch.store(EPOCH_IDLE, memory_order_release);
+        }
+    }
+
+    void  EpochDomain::retireObject(void* ptr, void (*deleter)(void*)) noexcept{
+        lock_guard<mutex>   lock { retiredMtx };
+        try{
+            retired.push_back({ ptr, deleter, globalEpoch.fetch_add(1, memory_order_seq_cst) });
+        }catch(...){
+            // No room to defer it: wait for the readers and free it right away.
+            const uint64_t  epoch  { globalEpoch.fetch_add(1, memory_order_seq_cst) };
+            for(const auto& slot : slots)
+                while(slot.epoch.load(memory_order_seq_cst) <= epoch) {}
+            while(overflowReaders.load(memory_order_seq_cst) != 0) {}
+            deleter(ptr);
+        }
+        reclaim();
+    }
+
+    void  EpochDomain::reclaim(void) noexcept{
+        if(overflowReaders.load(memory_order_seq_cst) != 0)
+            return;
+
+        uint64_t  oldest  { EPOCH_IDLE };
+        for(const auto& slot : slots)
+            oldest  =  std::min(oldest, slot.epoch.load(memory_order_seq_cst));
+
+        // A reader announcing an epoch later than the retirement can't see the object.
+        std::erase_if(retired, [oldest](const RetiredObject& obj){
+                                   if(obj.epoch >= oldest)
+                                       return false;
+                                   obj.deleter(obj.ptr);
+                                   return true;
+                               });
+    }
+
+    EpochGuard::EpochGuard(void) noexcept{
+        EpochDomain::getInstance().enter();
+    }
+
+    EpochGuard::~EpochGuard(void){
+        EpochDomain::getInstance().leave();
+    }
+
+} // End Namespace
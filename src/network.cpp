@@ -29,9 +29,16 @@
 
 namespace networkutils{
 
+    #ifdef MSG_NOSIGNAL
+    constexpr int  TCP_SEND_FLAGS  { MSG_NOSIGNAL };
+    #else
+    constexpr int  TCP_SEND_FLAGS  { 0 };
+    #endif
+
     using std::cerr,
           std::string,
           std::to_string,
+          std::span,
           std::unique_ptr,
           std::make_pair,
           std::make_unique,
@@ -39,13 +46,13 @@ namespace networkutils{
           std::chrono::system_clock,
           stringutils::trace;
 
-    SocketCreator& SocketCreator::getInstance(ServerId hst, const string& sp, time_t tout) anyexcept{
+    const SocketCreator& SocketCreator::getInstance(void) anyexcept{
             #if defined __clang_major__ &&  __clang_major__ >= 4 
             #pragma clang diagnostic push 
             #pragma clang diagnostic ignored "-Wexit-time-destructors"
             #endif
 
-           static SocketCreator instance(hst, sp, tout);
+           static const SocketCreator instance;
 
            #ifdef __clang__
            #pragma clang diagnostic pop
@@ -54,9 +61,16 @@ namespace networkutils{
            return instance;
     }
 
-    unique_ptr<Socket>  SocketCreator::createSocket(SocketTypes stype) anyexcept {
+    unique_ptr<Socket>  SocketCreator::createSocket(SocketTypes stype, const ServerId& hst,
+                                                    const string& sp, time_t tout) const anyexcept {
+         const auto  creator  { creatorsMap.find(stype) };
+         if(creator == creatorsMap.end())
+             throw string("SocketCreator::createSocket: unsupported socket type.");
+
          try{
-             return creatorsMap[stype]();
+             auto  sckt  { creator->second(hst, sp) };
+             sckt->setTimeoutSecs(tout);
+             return sckt;
          }catch(string& err){
              throw string("SocketCreator::createSocket: error : ").append(err);
          }catch(...){
@@ -64,74 +78,83 @@ namespace networkutils{
          }
     }
 
-    SocketCreator::SocketCreator(ServerId hst, const string& sp, time_t tou)
-        :  servername{hst},
-           timeoutSecs{tou},
-           spoofing{sp},
-           creatorsMap {  make_pair(SocketTypes::UdpSocket,          
-                                    [&]() -> unique_ptr<Socket>{ auto sckt { make_unique<SocketUdp>(servername) }; 
-                                                                 sckt->setTimeoutSecs(timeoutSecs);
-                                                                 return sckt; }),
+    SocketCreator::SocketCreator(void)
+        :  creatorsMap {  make_pair(SocketTypes::UdpSocket,          
+                                    [](const ServerId& hst, const string&) -> unique_ptr<Socket>{
+                                         return make_unique<SocketUdp>(hst); }),
                           #ifdef OFFENSIVE_REL
                           make_pair(SocketTypes::UdpSocketSp,          
-                                    [&]() -> unique_ptr<Socket>{ auto sckt { make_unique<SocketRawUdp>(servername, spoofing) }; 
-                                                                 sckt->setTimeoutSecs(timeoutSecs);
-                                                                 return sckt; }),
+                                    [](const ServerId& hst, const string& sp) -> unique_ptr<Socket>{
+                                         return make_unique<SocketRawUdp>(hst, sp); }),
                           #endif
                           make_pair(SocketTypes::UdpSocketVerbose,   
-                                    [&]() -> unique_ptr<Socket>{ auto sckt { make_unique<SocketUdpVerbose>(servername) }; 
-                                                                 sckt->setTimeoutSecs(timeoutSecs);
-                                                                 return sckt; }),
+                                    [](const ServerId& hst, const string&) -> unique_ptr<Socket>{
+                                         return make_unique<SocketUdpVerbose>(hst); }),
                           make_pair(SocketTypes::UdpSocketPing,   
-                                    [&]() -> unique_ptr<Socket>{ auto sckt { make_unique<SocketUdpPing>(servername) }; 
-                                                                 sckt->setTimeoutSecs(timeoutSecs);
-                                                                 return sckt; }),
+                                    [](const ServerId& hst, const string&) -> unique_ptr<Socket>{
+                                         return make_unique<SocketUdpPing>(hst); }),
                           make_pair(SocketTypes::TcpSocket,          
-                                    [&]() -> unique_ptr<Socket>{ auto sckt {  make_unique<SocketTcp>(servername) }; 
-                                                                 sckt->setTimeoutSecs(timeoutSecs);
-                                                                 return sckt; }),
+                                    [](const ServerId& hst, const string&) -> unique_ptr<Socket>{
+                                         return make_unique<SocketTcp>(hst); }),
                           make_pair(SocketTypes::TcpSocketVerbose,   
-                                    [&]() -> unique_ptr<Socket>{ auto sckt {  make_unique<SocketTcpVerbose>(servername) }; 
-                                                                 sckt->setTimeoutSecs(timeoutSecs);
-                                                                 return sckt; }),
+                                    [](const ServerId& hst, const string&) -> unique_ptr<Socket>{
+                                         return make_unique<SocketTcpVerbose>(hst); }),
                           make_pair(SocketTypes::UdpConnectedSocket,   
-                                    [&]() -> unique_ptr<Socket>{ auto sckt {  make_unique<SocketUdpConnected>(servername) }; 
-                                                                 sckt->setTimeoutSecs(timeoutSecs);
-                                                                 return sckt; })
+                                    [](const ServerId& hst, const string&) -> unique_ptr<Socket>{
+                                         return make_unique<SocketUdpConnected>(hst); })
                        }
     {}
 
-    atomic_bool Socket::sigpipeOn{false};
-
     Socket::Socket(ServerId hst)
          : fd{-1}, serverid{hst}, len{0}, rcvResp{0}, 
            timeout_sec{DNS_DEFAULT_TIMEOUT, 0}, 
-           wrnMsg{""}, timeExc{false}, signalExit{false},
-           sockSet{}, sigActionPipe{}
-    {
-        Socket::sigpipeOn            =  false;
-        sigActionPipe.sa_handler     =  [](int){ Socket::sigpipeOn = true; };
-        if(sigaction(SIGPIPE, &sigActionPipe, nullptr) != 0)
-             throw string("SocketUdpTraceroute: setting sigpipe hdlr.").append(strerror(errno));
-    }
-
-    Socket::~Socket(void){ 
-        sigemptyset(&sigActionPipe.sa_mask);
-        sigActionPipe.sa_flags       = 0;
-        sigActionPipe.sa_flags       = sigActionPipe.sa_flags | SA_RESETHAND;
-        sigActionPipe.sa_handler     = nullptr;
+           wrnMsg{""}, errMsg{""}, wrnText{nullptr}, errText{nullptr}, errNo{0},
+           timeExc{false}, signalExit{false},
+           sockSet{}
+    {}
 
-        static_cast<void>(sigaction(SIGPIPE, &sigActionPipe, nullptr));
-    }
+    // No process wide SIGPIPE handler: a closed peer shows up as EPIPE on the tcp send.
+    Socket::~Socket(void){}
 
     ssize_t Socket::getRecvLen(void)  const noexcept{
         return rcvResp;
     }
 
     const string&  Socket::getWarningMsg(void) const noexcept{
+        if(wrnText != nullptr){
+            wrnMsg.append(wrnText);
+            wrnText  =  nullptr;
+        }
         return wrnMsg; 
     }
 
+    const string&  Socket::getErrorMsg(void) const noexcept{
+        if(errText != nullptr){
+            errMsg.assign(errText);
+            if(errNo != 0)
+                errMsg.append(strerror(errNo));
+            errText  =  nullptr;
+        }
+        return errMsg; 
+    }
+
+    SOCK_STATUS  Socket::setError(const char* text, int err) noexcept{
+        errText  =  text;
+        errNo    =  err;
+        return SOCK_STATUS::SOCK_ERROR;
+    }
+
+    void  Socket::raiseOnError(SOCK_STATUS status) const anyexcept{
+        switch(status){
+            case SOCK_STATUS::SOCK_TIMEOUT:
+                throw string("Timeout.");
+            case SOCK_STATUS::SOCK_ERROR:
+                throw string(getErrorMsg());
+            case SOCK_STATUS::SOCK_OK:
+            break;
+        }
+    }
+
     double  Socket::getElapsedTime(void) const noexcept{
         return elapsed_seconds.count();
     }
@@ -145,6 +168,35 @@ namespace networkutils{
         timeout_sec.tv_usec  =  0;
     }
 
+    void  Socket::setTimeoutMs(uint32_t tou)  noexcept{
+        timeout_sec.tv_sec   =  static_cast<time_t>(tou / 1000);
+        timeout_sec.tv_usec  =  static_cast<suseconds_t>(tou % 1000 * 1000);
+    }
+
+    void  Socket::sendMsgv(const Iovec* segments, size_t segmentsNo, Response& response) anyexcept{
+        Buffer  query;
+        for(size_t idx{0}; idx < segmentsNo; ++idx){
+            const uint8_t*  base  { static_cast<const uint8_t*>(segments[idx].iov_base) };
+            query.insert(query.end(), base, base + segments[idx].iov_len);
+        }
+        sendMsg(query, response);
+    }
+
+    SOCK_STATUS  Socket::trySendMsgv(const Iovec* segments, size_t segmentsNo, Response& response) noexcept{
+        try{
+            sendMsgv(segments, segmentsNo, response);
+        }catch(const string& err){
+            if(timeExc)
+                return SOCK_STATUS::SOCK_TIMEOUT;
+            errMsg   =  err;
+            errText  =  nullptr;
+            return SOCK_STATUS::SOCK_ERROR;
+        }catch(...){
+            return setError("Socket::trySendMsgv: unexpected error.", 0);
+        }
+        return SOCK_STATUS::SOCK_OK;
+    }
+
     #ifdef OFFENSIVE_REL
     #include "networkraw.cpp"
     #endif
@@ -173,25 +225,40 @@ namespace networkutils{
     }
 
     void SocketUdp::sendMsg(const Buffer& query, Response& response) anyexcept {
+        const Iovec  segment { const_cast<uint8_t*>(query.data()), query.size() };
+        SocketUdp::sendMsgv(&segment, 1, response);
+    }
+
+    void SocketUdp::sendMsgv(const Iovec* segments, size_t segmentsNo, Response& response) anyexcept {
+        raiseOnError(SocketUdp::trySendMsgv(segments, segmentsNo, response));
+    }
+
+    SOCK_STATUS SocketUdp::trySendMsgv(const Iovec* segments, size_t segmentsNo, Response& response) noexcept {
         FD_ZERO(&sockSet);
         FD_SET(fd, &sockSet);
 
         int selret  {  select(fd+1, nullptr, &sockSet, nullptr, &timeout_sec) };
         if(selret < 0){
-            throw string("SocketUdp::sendMsg: select() error: ").append(strerror(errno));
+            return setError("SocketUdp::sendMsg: select() error: ", errno);
         } else if(selret == 0){
             timeExc  =  true;
-            throw string("Timeout.");
+            return SOCK_STATUS::SOCK_TIMEOUT;
         } 
 
-        ssize_t   ret   {  ::sendto(fd, query.data(),                           query.size(), 
-                                    0,  reinterpret_cast<const Sockaddr*>(&sv), sizeof(sv)) };
+        Msghdr    msg   {};
+        msg.msg_name     =  &sv;
+        msg.msg_namelen  =  sizeof(sv);
+        msg.msg_iov      =  const_cast<Iovec*>(segments);
+        msg.msg_iovlen   =  segmentsNo;
+
+        ssize_t   ret   {  ::sendmsg(fd, &msg, 0) };
         if(ret == -1 ){ 
+            const int  err  { errno };
             if(closeOnError){ 
 	            close(fd); 
                 fd  =  -1;
             }
-            throw string("SocketUdp::sendMsg: can't send the query: ").append(strerror(errno));
+            return setError("SocketUdp::sendMsg: can't send the query: ", err);
         }
 
         FD_ZERO(&sockSet);
@@ -199,23 +266,25 @@ namespace networkutils{
 
         selret  =  select(fd+1, &sockSet, nullptr, nullptr, &timeout_sec);
         if(selret < 0){
-            throw string("SocketUdp::sendMsg: select() error: ").append(strerror(errno));
+            return setError("SocketUdp::sendMsg: select() error: ", errno);
         } else if(selret == 0) {
-            wrnMsg   =  "SocketUdp::sendMsg: time exceed."; 
+            wrnText  =  "SocketUdp::sendMsg: time exceed."; 
             timeExc  =  true;
-            throw string("Timeout.");
+            return SOCK_STATUS::SOCK_TIMEOUT;
         } 
 
 	    rcvResp     =  ::recvfrom(fd, response.data(), response.size(), 0, reinterpret_cast< Sockaddr*>(&sv), &len);
         if(rcvResp == -1){ 
+            const int  err  { errno };
             if(closeOnError){ 
 	            close(fd);  
                 fd  =  -1;
             }
 
-            throw string("SocketUdp::sendMsg: can't read query response: ").append(strerror(errno));
+            return setError("SocketUdp::sendMsg: can't read query response: ", err);
         }
-        
+
+        return SOCK_STATUS::SOCK_OK;
     }
 
     SocketUdpConnected::SocketUdpConnected(ServerId hst)
@@ -337,6 +406,11 @@ namespace networkutils{
         int reuse { 1 };
         if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int)) < 0)
             throw string("SocketTcp: can't configure socket SO_REUSEADDR.");
+
+        #ifdef SO_NOSIGPIPE
+        if (int nosig { 1 }; setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &nosig, sizeof(int)) < 0)
+            throw string("SocketTcp: can't configure socket SO_NOSIGPIPE.");
+        #endif
     }
 
     SocketTcp::~SocketTcp(void){
@@ -344,104 +418,291 @@ namespace networkutils{
     }
 
     void SocketTcp::sendMsg(const Buffer& query, Response& response) anyexcept{
+        const Iovec  segment { const_cast<uint8_t*>(query.data()), query.size() };
+        SocketTcp::sendMsgv(&segment, 1, response);
+    }
 
-        auto checkResult  { [&](ssize_t result, bool isSend){
-            const string fName { isSend ? "SocketTcp::sendMsg:sendto: " : "SocketTcp::sendMsg:recvfrom: " };
-            if(timeExc){
-                shutdown(fd, SHUT_RDWR);
-                fd       =  -1;
-                wrnMsg.append(fName).append(" time exceed."); 
-                timeExc  =  true;
-                return;
-            }
+    void SocketTcp::sendMsgv(const Iovec* segments, size_t segmentsNo, Response& response) anyexcept{
+        raiseOnError(SocketTcp::trySendMsgv(segments, segmentsNo, response));
+    }
 
-            if(Socket::sigpipeOn){
-                shutdown(fd, SHUT_RDWR);
-                fd       =  -1;
-                wrnMsg.append(fName).append(" sigpipe received."); 
-                return;
-            }
+    SOCK_STATUS SocketTcp::trySendMsgv(const Iovec* segments, size_t segmentsNo, Response& response) noexcept{
+        enum class CHECK_STATUS { CHECK_CONTINUE, CHECK_PARTIAL, CHECK_FAILED };
+        SOCK_STATUS  failure  { SOCK_STATUS::SOCK_ERROR };
+
+        auto closeSock    { [&](){
+            shutdown(fd, SHUT_RDWR);
+            close(fd);
+            fd  =  -1;
+        }};
 
+        auto checkResult  { [&](ssize_t result, bool isSend) -> CHECK_STATUS {
             switch(result) {
                 case -1:
-	                shutdown(fd, SHUT_RDWR);
-                    fd  =  -1;
-                    if(errno == EAGAIN && rcvResp > 0 && !isSend){
-                        wrnMsg.append(fName).append(" recvfrom timeout, partial read.");
-                        return;
+                {
+                    const int  err  { errno };
+                    closeSock();
+                    if(err == EAGAIN && rcvResp > 0 && !isSend){
+                        wrnText  =  "SocketTcp::sendMsg:recvfrom: recvfrom timeout, partial read.";
+                        return CHECK_STATUS::CHECK_PARTIAL;
                     }
-                    throw string(fName).append(" error, can't read query response: ").append(strerror(errno));
+                    failure  =  setError(isSend ? "SocketTcp::sendMsg:sendto: error, can't send the query: "
+                                                : "SocketTcp::sendMsg:recvfrom: error, can't read query response: ", err);
+                    return CHECK_STATUS::CHECK_FAILED;
+                }
                 case 0:
-	                shutdown(fd, SHUT_RDWR);
-                    fd  =  -1;
+                    closeSock();
                     if(rcvResp > 0){
-                        wrnMsg.append(fName).append(" recvfrom detect close, partial read.");
-                        return;
+                        wrnText  =  "SocketTcp::sendMsg:recvfrom: recvfrom detect close, partial read.";
+                        return CHECK_STATUS::CHECK_PARTIAL;
                     }
-                    throw string(fName).append(" can't read, socket close on other side.");
+                    failure  =  setError("SocketTcp::sendMsg:recvfrom: can't read, socket close on other side.", 0);
+                    return CHECK_STATUS::CHECK_FAILED;
                 default:
-                    if(result < 0 || result > DNS_RESPONSE_TCP_SIZE)
-                        throw string(fName).append(" unexpected response size : ").append(to_string(result));
+                    if(result < 0 || result > DNS_RESPONSE_TCP_SIZE){
+                        failure  =  setError("SocketTcp::sendMsg: unexpected response size.", 0);
+                        return CHECK_STATUS::CHECK_FAILED;
+                    }
             }
+            return CHECK_STATUS::CHECK_CONTINUE;
         }};
 
-        FD_ZERO(&sockSet);
-        FD_SET(fd, &sockSet);
-
-        int selret  {  select(fd+1, nullptr, &sockSet, nullptr, &timeout_sec) };
-        if(selret < 0){
-            throw string("SocketTcp::sendMsg: select() error: ").append(strerror(errno));
-        } else if(selret == 0) {
-            timeExc  =  true;
-        } 
+        auto waitFd       { [&](bool isRead) -> int {
+            FD_ZERO(&sockSet);
+            FD_SET(fd, &sockSet);
 
-        ssize_t   ret   {  ::sendto(fd, query.data(),                           query.size(), 
-                                    0,  reinterpret_cast<const Sockaddr*>(&sv), sizeof(sv)) };
-        checkResult(ret, true);
+            int selret  {  isRead ? select(fd+1, &sockSet, nullptr, nullptr, &timeout_sec)
+                                  : select(fd+1, nullptr, &sockSet, nullptr, &timeout_sec) };
+            if(selret < 0){
+                failure  =  setError("SocketTcp::sendMsg: select() error: ", errno);
+            } else if(selret == 0) {
+                closeSock();
+                wrnText  =  isRead ? "SocketTcp::sendMsg:recvfrom: time exceed." 
+                                   : "SocketTcp::sendMsg:sendto: time exceed."; 
+                timeExc  =  true;
+                failure  =  SOCK_STATUS::SOCK_TIMEOUT;
+            } 
+            return selret;
+        }};
 
-        response.clear();
-        rcvResp  =  0;
+        if(fd == -1)
+            return setError("SocketTcp::sendMsg: socket not connected.", 0);
 
-        size_t   pos { 0 };
-        FD_ZERO(&sockSet);
-        FD_SET(fd, &sockSet);
+        if(waitFd(false) <= 0)
+            return failure;
 
-        selret  =  select(fd+1, &sockSet, nullptr, nullptr, &timeout_sec);
-        if(selret < 0){
-            throw string("SocketTcp::sendMsg: select() error: ").append(strerror(errno));
-        } else if(selret == 0) {
-            timeExc  =  true;
-            throw string("Timeout.");
-        } 
+        Msghdr    msg   {};
+        msg.msg_iov      =  const_cast<Iovec*>(segments);
+        msg.msg_iovlen   =  segmentsNo;
 
-        ret     =  ::recvfrom(fd, tcpBuffer.data() + pos, tcpBuffer.size() - pos, 0, reinterpret_cast<Sockaddr*>(&sv), &len);
+        ssize_t   ret   {  ::sendmsg(fd, &msg, TCP_SEND_FLAGS) };
+        if(checkResult(ret, true) != CHECK_STATUS::CHECK_CONTINUE)
+            return failure;
 
-        checkResult(ret, false);
-        pos              += static_cast<size_t>(ret);
-        rcvResp          =  ret - 2;
+        response.clear();
+        rcvResp  =  0;
 
-        size_t declaredLen { ntohs(*(reinterpret_cast<uint16_t*>(tcpBuffer.data()))) };
+        size_t   pos          { 0 },
+                 declaredLen  { 0 };
 
-        while( pos < declaredLen ) {
-            FD_ZERO(&sockSet);
-            FD_SET(fd, &sockSet);
-      
-            selret  =  select(fd+1, &sockSet, nullptr, nullptr, &timeout_sec);
-            if(selret < 0){
-                throw string("SocketTcp::sendMsg: select() error: ").append(strerror(errno));
-            } else if(selret == 0) {
-                timeExc  =  true;
-                throw string("Timeout.");
-            } 
+        while( pos < sizeof(uint16_t) || pos < declaredLen + sizeof(uint16_t) ) {
+            if(waitFd(true) <= 0)
+                return failure;
                          
             ret     =  ::recvfrom(fd, tcpBuffer.data() + pos, tcpBuffer.size() - pos, 0, reinterpret_cast<Sockaddr*>(&sv), &len);
 
-            checkResult(ret, false);
+            const CHECK_STATUS  check  { checkResult(ret, false) };
+            if(check == CHECK_STATUS::CHECK_FAILED)
+                return failure;
+            if(check == CHECK_STATUS::CHECK_PARTIAL)
+                break;
+
             pos     += static_cast<size_t>(ret);
-            rcvResp += ret;
+            if(pos >= sizeof(uint16_t)){
+                declaredLen  =  static_cast<size_t>(tcpBuffer[0] << 8 | tcpBuffer[1]);
+                rcvResp      =  static_cast<ssize_t>(pos - sizeof(uint16_t));
+            }
         }
 
+        if(rcvResp > static_cast<ssize_t>(declaredLen))
+            rcvResp  =  static_cast<ssize_t>(declaredLen);
+
         response.insert(response.end(), tcpBuffer.begin() + 2, tcpBuffer.begin() + rcvResp + 2);
+
+        return SOCK_STATUS::SOCK_OK;
+    }
+
+    SocketUdpAsync::SocketUdpAsync(ServerId hst)
+         : fd{-1}, sv{}, errMsg{}
+    {
+        sv.sin_family       = AF_INET;
+        sv.sin_port         = htons(DNS_PORT); 
+        sv.sin_addr.s_addr  = inet_addr(hst.c_str());
+
+        fd    =  socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        if(fd == -1)  
+            throw string("SocketUdpAsync: can't create socket.").append(strerror(errno));
+
+        // Connected, so that the kernel drops datagrams coming from anybody else.
+        if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, nullptr) | O_NONBLOCK) == -1 ||
+           connect(fd, reinterpret_cast<const Sockaddr*>(&sv), sizeof(sv)) == -1){
+            const int  err  { errno };
+            close(fd);
+            throw string("SocketUdpAsync: can't configure socket: ").append(strerror(err));
+        }
+    }
+
+    SocketUdpAsync::~SocketUdpAsync(void){
+        if(fd != -1)  close(fd);
+    }
+
+    int  SocketUdpAsync::getFd(void) const noexcept{
+        return fd;
+    }
+
+    SOCK_STATUS  SocketUdpAsync::trySend(const Iovec* segments, size_t segmentsNo) noexcept{
+        Msghdr    msg   {};
+        msg.msg_iov      =  const_cast<Iovec*>(segments);
+        msg.msg_iovlen   =  segmentsNo;
+
+        if(::sendmsg(fd, &msg, 0) != -1)
+            return SOCK_STATUS::SOCK_OK;
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+            return SOCK_STATUS::SOCK_TIMEOUT;
+
+        errMsg.assign("SocketUdpAsync::trySend: can't send the query: ").append(strerror(errno));
+        return SOCK_STATUS::SOCK_ERROR;
+    }
+
+    ssize_t  SocketUdpAsync::tryRecv(uint8_t* buffer, size_t size) noexcept{
+        const ssize_t  ret  { ::recv(fd, buffer, size, 0) };
+        if(ret != -1)
+            return ret;
+        if(errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        // ICMP errors of earlier sends are reported here, they don't stop the socket.
+        errMsg.assign("SocketUdpAsync::tryRecv: can't read the response: ").append(strerror(errno));
+        return -1;
+    }
+
+    const string&  SocketUdpAsync::getErrorMsg(void) const noexcept{
+        return errMsg;
+    }
+
+    SocketTcpAsync::SocketTcpAsync(ServerId hst, const Iovec* segments, size_t segmentsNo)
+         : fd{-1}, sv{}, query{}, tcpBuffer(sizeof(uint16_t), 0), sentLen{0}, recvLen{0}, connected{false}, errMsg{}
+    {
+        sv.sin_family       = AF_INET;
+        sv.sin_port         = htons(DNS_PORT); 
+        sv.sin_addr.s_addr  = inet_addr(hst.c_str());
+
+        for(size_t idx{0}; idx < segmentsNo; ++idx){
+            const uint8_t*  base  { static_cast<const uint8_t*>(segments[idx].iov_base) };
+            query.insert(query.end(), base, base + segments[idx].iov_len);
+        }
+
+        fd    =  socket(AF_INET, SOCK_STREAM, 0);
+        if(fd == -1)  
+            throw string("SocketTcpAsync: can't create socket.").append(strerror(errno));
+
+        if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, nullptr) | O_NONBLOCK) == -1){
+            const int  err  { errno };
+            close(fd);
+            throw string("SocketTcpAsync: can't configure socket: ").append(strerror(err));
+        }
+
+        #ifdef SO_NOSIGPIPE
+        if (int nosig { 1 }; setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &nosig, sizeof(int)) < 0){
+            close(fd);
+            throw string("SocketTcpAsync: can't configure socket SO_NOSIGPIPE.");
+        }
+        #endif
+
+        if(connect(fd, reinterpret_cast<const Sockaddr*>(&sv), sizeof(sv)) == 0){
+            connected  =  true;
+        }else if(errno != EINPROGRESS){
+            const int  err  { errno };
+            close(fd);
+            throw string("SocketTcpAsync: can't connect socket: ").append(strerror(err));
+        }
+    }
+
+    SocketTcpAsync::~SocketTcpAsync(void){
+        if(fd != -1)  close(fd);
+    }
+
+    int  SocketTcpAsync::getFd(void) const noexcept{
+        return fd;
+    }
+
+    bool  SocketTcpAsync::wantsWrite(void) const noexcept{
+        return !connected || sentLen < query.size();
+    }
+
+    SOCK_STATUS  SocketTcpAsync::advance(void) noexcept{
+        if(!connected){
+            int        opt   { 0 };
+            socklen_t  sckl  { sizeof(int) };
+            if(getsockopt(fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<void*>(&opt), &sckl) == -1)
+                return setError("SocketTcpAsync::advance: can't read the connect outcome: ", errno);
+            if(opt != 0)
+                return setError("SocketTcpAsync::advance: can't connect socket: ", opt);
+            connected  =  true;
+        }
+
+        while(sentLen < query.size()){
+            const ssize_t  ret  { ::send(fd, query.data() + sentLen, query.size() - sentLen, TCP_SEND_FLAGS) };
+            if(ret == -1){
+                if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    return SOCK_STATUS::SOCK_TIMEOUT;
+                return setError("SocketTcpAsync::advance: can't send the query: ", errno);
+            }
+            sentLen  +=  static_cast<size_t>(ret);
+        }
+
+        // The length prefix first, then as much as it declares.
+        while(recvLen < tcpBuffer.size()){
+            const ssize_t  ret  { ::recv(fd, tcpBuffer.data() + recvLen, tcpBuffer.size() - recvLen, 0) };
+            if(ret == -1){
+                if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                    return SOCK_STATUS::SOCK_TIMEOUT;
+                return setError("SocketTcpAsync::advance: can't read query response: ", errno);
+            }
+            if(ret == 0)
+                return setError("SocketTcpAsync::advance: can't read, socket close on other side.", 0);
+
+            recvLen  +=  static_cast<size_t>(ret);
+            if(recvLen == sizeof(uint16_t)){
+                const size_t  declaredLen  { static_cast<size_t>(tcpBuffer[0] << 8 | tcpBuffer[1]) };
+                try{
+                    tcpBuffer.resize(sizeof(uint16_t) + declaredLen);
+                }catch(...){
+                    return setError("SocketTcpAsync::advance: can't allocate the response buffer.", 0);
+                }
+            }
+        }
+
+        return SOCK_STATUS::SOCK_OK;
+    }
+
+    span<const uint8_t>  SocketTcpAsync::getResponse(void) const noexcept{
+        return span<const uint8_t>{ tcpBuffer }.subspan(sizeof(uint16_t));
+    }
+
+    const string&  SocketTcpAsync::getErrorMsg(void) const noexcept{
+        return errMsg;
+    }
+
+    SOCK_STATUS  SocketTcpAsync::setError(const char* text, int err) noexcept{
+        try{
+            errMsg.assign(text);
+            if(err != 0)
+                errMsg.append(strerror(err));
+        }catch(...){
+            errMsg.clear();
+        }
+        return SOCK_STATUS::SOCK_ERROR;
     }
 
     SocketUdpVerbose::SocketUdpVerbose(ServerId hst)
@@ -459,6 +720,14 @@ namespace networkutils{
        trace("Message received:", response.data(), static_cast<size_t>(rcvResp), 0, 12);
     } 
 
+    void SocketUdpVerbose::sendMsgv(const Iovec* segments, size_t segmentsNo, Response& response)  anyexcept{
+       Socket::sendMsgv(segments, segmentsNo, response);
+    }
+
+    SOCK_STATUS SocketUdpVerbose::trySendMsgv(const Iovec* segments, size_t segmentsNo, Response& response)  noexcept{
+       return Socket::trySendMsgv(segments, segmentsNo, response);
+    }
+
     SocketUdpPing::SocketUdpPing(ServerId hst)
         :  SocketUdp{hst}
     {
@@ -488,6 +757,14 @@ namespace networkutils{
        }
     } 
 
+    void SocketUdpPing::sendMsgv(const Iovec* segments, size_t segmentsNo, Response& response)  anyexcept{
+       Socket::sendMsgv(segments, segmentsNo, response);
+    }
+
+    SOCK_STATUS SocketUdpPing::trySendMsgv(const Iovec* segments, size_t segmentsNo, Response& response)  noexcept{
+       return Socket::trySendMsgv(segments, segmentsNo, response);
+    }
+
     atomic_bool SocketUdpTraceroute::alarmOn{false};
 
     SocketUdpTraceroute::SocketUdpTraceroute(ServerId hst)
@@ -631,4 +908,12 @@ namespace networkutils{
         trace("Message received:", response.data(), static_cast<size_t>(rcvResp), 0, 12);
     }
 
+    void SocketTcpVerbose::sendMsgv(const Iovec* segments, size_t segmentsNo, Response& response)  anyexcept{
+        Socket::sendMsgv(segments, segmentsNo, response);
+    }
+
+    SOCK_STATUS SocketTcpVerbose::trySendMsgv(const Iovec* segments, size_t segmentsNo, Response& response)  noexcept{
+        return Socket::trySendMsgv(segments, segmentsNo, response);
+    }
+
 } // End Namespace